@@ -0,0 +1,356 @@
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define GLIB_GRAPHICS_IMPL
+#include <graphics.hpp>
+
+#define GLIB_MODEL_IMPL
+#include <model.hpp>
+
+#define GLIB_OPTIMIZE_IMPL
+#include <optimize.hpp>
+
+namespace fs = std::filesystem;
+
+// Bumped when the passes change, every output is baked again
+const uint32_t BAKE_VERSION = 4;
+
+const char *usage =
+    "usage: glib_bake [--output dir] [--jobs N] [--lods N] [--force]\n"
+    "                 [--no-textures] [--guess-roles] path...\n";
+
+struct bake_options_t {
+  std::vector<fs::path> roots; // directories walked or single files
+  fs::path output;             // models next to their source if empty
+  int jobs = 0;                // 0 for every hardware thread
+  int lods = MESH_MAX_LODS;
+  bool force = false;
+  bool textures = true;
+  bool guess_roles = false; // of the textures of no model, else albedo
+};
+
+enum bake_kind_e { BAKE_MODEL, BAKE_TEXTURE };
+
+struct bake_item_t {
+  bake_kind_e kind;
+  fs::path source, destination;
+  uint64_t hash;
+  glib::texture_role_e role; // of textures, from the models using them
+};
+
+// Outputs and the hash of what produced them, one "hash path" per line
+static std::map<std::string, uint64_t> manifest_read(const fs::path &path) {
+  std::map<std::string, uint64_t> result;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t space = line.find(' ');
+    if (space != std::string::npos)
+      result[line.substr(space + 1)] =
+          strtoull(line.substr(0, space).c_str(), NULL, 16);
+  }
+  return result;
+}
+
+static void manifest_write(const fs::path &path,
+                           const std::map<std::string, uint64_t> &manifest) {
+  std::ofstream file(path);
+  for (auto &[output, hash] : manifest) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+    file << hex << " " << output << "\n";
+  }
+}
+
+static uint64_t hash_file(const fs::path &path, uint64_t hash) {
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> buffer(1 << 16);
+  while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0)
+    hash = glib::baked_hash(buffer.data(), file.gcount(), hash);
+  return hash;
+}
+
+// The source and the files next to it sharing its stem, like the .mtl of an
+// .obj, with the options of the passes
+static uint64_t hash_item(const bake_item_t &item,
+                          const bake_options_t &options) {
+  uint64_t hash = glib::baked_hash(&BAKE_VERSION, sizeof(BAKE_VERSION));
+  hash = hash_file(item.source, hash);
+  if (item.kind == BAKE_TEXTURE)
+    return glib::baked_hash(&item.role, sizeof(item.role), hash);
+
+  hash = glib::baked_hash(&options.lods, sizeof(options.lods), hash);
+  std::vector<fs::path> siblings;
+  std::error_code error;
+  for (const fs::directory_entry &entry :
+       fs::directory_iterator(item.source.parent_path(), error))
+    if (entry.path() != item.source &&
+        entry.path().stem() == item.source.stem() &&
+        entry.path().extension() != ".glbm")
+      siblings.push_back(entry.path());
+  std::sort(siblings.begin(), siblings.end());
+  for (const fs::path &sibling : siblings)
+    hash = hash_file(sibling, hash);
+  return hash;
+}
+
+static bool is_texture(const fs::path &path) {
+  static const char *extensions[] = {".png", ".jpg", ".jpeg", ".tga", ".bmp"};
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 ::tolower);
+  return std::find_if(std::begin(extensions), std::end(extensions),
+                      [&](const char *e) { return extension == e; }) !=
+         std::end(extensions);
+}
+
+static void collect(const fs::path &root, const fs::path &source,
+                    const bake_options_t &options,
+                    const Assimp::Importer &importer,
+                    std::vector<bake_item_t> &items) {
+  std::string extension = source.extension().string();
+  if (extension == ".glbm" || extension == ".dds")
+    return;
+
+  if (importer.IsExtensionSupported(extension)) {
+    fs::path destination = fs::path(source).replace_extension(".glbm");
+    if (!options.output.empty())
+      destination = options.output / destination.lexically_relative(root);
+    items.push_back({BAKE_MODEL, source, destination, 0, {}});
+  } else if (options.textures && is_texture(source)) {
+    // Next to the source, where texture_load looks for it
+    items.push_back({BAKE_TEXTURE, source,
+                     fs::path(source).replace_extension(".dds"), 0, {}});
+  }
+}
+
+// Roles of the albedo, specular and normal slots of the baked materials
+static const glib::texture_role_e slot_roles[BAKED_TEXTURES] = {
+    glib::TEXTURE_ALBEDO, glib::TEXTURE_MASK, glib::TEXTURE_NORMAL};
+
+// Textures referenced by a baked model by absolute path, the first role
+// found is kept
+static void model_roles(
+    const bake_item_t &item,
+    std::map<std::string, glib::texture_role_e> &roles) {
+  std::error_code error;
+  glib::baked_file_t file;
+  if (!fs::exists(item.destination, error) ||
+      !glib::baked_open(item.destination.c_str(), file))
+    return;
+  fs::path folder = fs::absolute(item.destination).parent_path();
+  for (uint32_t i = 0; i < file.header->mesh_count; ++i)
+    for (int t = 0; t < BAKED_TEXTURES; ++t) {
+      const char *path = glib::baked_string(file, file.meshes[i].textures[t]);
+      if (path != NULL)
+        roles.emplace((folder / path).lexically_normal().string(),
+                      slot_roles[t]);
+    }
+  glib::baked_close(file);
+}
+
+// Textures of no model are told by their name with --guess-roles, a mask
+// keeps only its red channel
+static glib::texture_role_e guess_role(const fs::path &path) {
+  std::string name = path.stem().string();
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  if (name.find("normal") != std::string::npos ||
+      name.find("nrm") != std::string::npos)
+    return glib::TEXTURE_NORMAL;
+  for (const char *mask : {"spec", "rough", "metal", "gloss", "occlusion"})
+    if (name.find(mask) != std::string::npos)
+      return glib::TEXTURE_MASK;
+  return glib::TEXTURE_ALBEDO;
+}
+
+// Weld, optimise for the vertex cache, build the levels of detail and order
+// the vertices for fetching
+static void bake_passes(glib::model_data_t &model,
+                        const bake_options_t &options, const fs::path &path) {
+  size_t vertices = 0, welded = 0, triangles = 0, lods = 0;
+  float before = 0.0f, after = 0.0f;
+  for (glib::mesh_data_t &mesh : model.meshes) {
+    size_t count = mesh.vertices.size() / BAKED_VERTEX_FLOATS;
+    std::vector<uint32_t> &indices = mesh.lods[0].indices;
+    vertices += count;
+    triangles += indices.size() / 3;
+    before += glib::mesh_acmr(indices, count) * indices.size() / 3;
+
+    welded += glib::mesh_weld(mesh);
+    count = mesh.vertices.size() / BAKED_VERTEX_FLOATS;
+    glib::mesh_optimize_cache(indices, count);
+    after += glib::mesh_acmr(indices, count) * indices.size() / 3;
+
+    glib::mesh_build_lods(mesh, options.lods);
+    glib::mesh_optimize_fetch(mesh);
+    lods += mesh.lods.size();
+  }
+
+  triangles = std::max<size_t>(triangles, 1);
+  printf("optimized %s: %zu vertices welded to %zu, acmr %.2f to %.2f, "
+         "%zu lods\n",
+         path.c_str(), vertices, vertices - welded, before / triangles,
+         after / triangles, lods);
+}
+
+static bool bake(const bake_item_t &item, const bake_options_t &options) {
+  std::error_code error;
+  fs::create_directories(item.destination.parent_path(), error);
+  if (item.kind == BAKE_TEXTURE)
+    return glib::texture_encode(item.source.c_str(), item.destination.c_str(),
+                                item.role);
+
+  return glib::model_bake(item.source.c_str(), item.destination.c_str(),
+                          [&](glib::model_data_t &model) {
+                            bake_passes(model, options, item.source);
+                          });
+}
+
+int main(int argc, char **argv) {
+  bake_options_t options;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "--force") == 0) {
+      options.force = true;
+      continue;
+    }
+    if (strcmp(arg, "--no-textures") == 0) {
+      options.textures = false;
+      continue;
+    }
+    if (strcmp(arg, "--guess-roles") == 0) {
+      options.guess_roles = true;
+      continue;
+    }
+    if (strncmp(arg, "--", 2) != 0) {
+      options.roots.push_back(arg);
+      continue;
+    }
+    if (strcmp(arg, "--help") == 0 || value == NULL) {
+      std::cout << usage;
+      return strcmp(arg, "--help") == 0 ? 0 : 1;
+    }
+
+    if (strcmp(arg, "--output") == 0)
+      options.output = value;
+    else if (strcmp(arg, "--jobs") == 0)
+      options.jobs = atoi(value);
+    else if (strcmp(arg, "--lods") == 0)
+      options.lods = std::clamp(atoi(value), 1, MESH_MAX_LODS);
+    else {
+      std::cout << usage;
+      return 1;
+    }
+    i += 1;
+  }
+
+  if (options.roots.empty()) {
+    std::cout << usage;
+    return 1;
+  }
+
+  // Every input under the roots
+  std::vector<bake_item_t> items;
+  Assimp::Importer importer;
+  for (const fs::path &root : options.roots) {
+    std::error_code error;
+    if (fs::is_regular_file(root, error)) {
+      collect(root.parent_path(), root, options, importer, items);
+      continue;
+    }
+    for (const fs::directory_entry &entry :
+         fs::recursive_directory_iterator(root, error))
+      if (entry.is_regular_file())
+        collect(root, entry.path(), options, importer, items);
+    if (error) {
+      std::cout << "ERROR::BAKE: Unable to walk " << root << "\n";
+      return 1;
+    }
+  }
+
+  // Kept with the outputs, or in the first root
+  fs::path manifest_path = options.output;
+  if (manifest_path.empty())
+    manifest_path = fs::is_directory(options.roots[0])
+                        ? options.roots[0]
+                        : options.roots[0].parent_path();
+  manifest_path /= ".glib_bake";
+  std::map<std::string, uint64_t> manifest = manifest_read(manifest_path);
+
+  auto start = std::chrono::steady_clock::now();
+  // The importer runs its own jobs on the same pool
+  if (options.jobs > 0)
+    setenv("GLIB_JOBS", std::to_string(options.jobs).c_str(), 1);
+  glib::jobs_t &jobs = glib::jobs_shared();
+  std::mutex mutex;
+  size_t baked = 0, skipped = 0, failed = 0;
+
+  auto run = [&](size_t i) {
+    bake_item_t &item = items[i];
+    item.hash = hash_item(item, options);
+    std::string key = item.destination.lexically_normal().string();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = manifest.find(key);
+      std::error_code error;
+      if (!options.force && it != manifest.end() && it->second == item.hash &&
+          fs::exists(item.destination, error)) {
+        skipped += 1;
+        return;
+      }
+    }
+
+    bool done = bake(item, options);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (done) {
+      manifest[key] = item.hash;
+      baked += 1;
+    } else {
+      manifest.erase(key);
+      failed += 1;
+    }
+  };
+
+  // Models first, the textures they use are encoded for their role
+  size_t models =
+      std::stable_partition(items.begin(), items.end(),
+                            [](const bake_item_t &item) {
+                              return item.kind == BAKE_MODEL;
+                            }) -
+      items.begin();
+  glib::jobs_for(jobs, models, run);
+
+  std::map<std::string, glib::texture_role_e> roles;
+  for (size_t i = 0; i < models; ++i)
+    model_roles(items[i], roles);
+  for (size_t i = models; i < items.size(); ++i) {
+    bake_item_t &item = items[i];
+    auto it = roles.find(fs::absolute(item.source).lexically_normal().string());
+    item.role = it != roles.end()   ? it->second
+                : options.guess_roles ? guess_role(item.source)
+                                      : glib::TEXTURE_ALBEDO;
+  }
+  glib::jobs_for(jobs, items.size() - models,
+                 [&](size_t i) { run(models + i); });
+  manifest_write(manifest_path, manifest);
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  printf("baked %zu, unchanged %zu, failed %zu in %.2fs\n", baked, skipped,
+         failed, seconds);
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,416 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define GLIB_INIT_IMPL
+#include <initialization.hpp>
+
+#define GLIB_GRAPHICS_IMPL
+#include <graphics.hpp>
+
+#define GLIB_TRANSFORM_IMPL
+#include <transform.hpp>
+
+#define GLIB_MODEL_IMPL
+#include <model.hpp>
+
+#define GLIB_GBUFFER_IMPL
+#include <gbuffer.hpp>
+
+#define GLIB_TEMPORAL_IMPL
+#include <temporal.hpp>
+
+#define GLIB_PERMUTATION_IMPL
+#include <permutation.hpp>
+
+#define GLIB_GPU_TIMER_IMPL
+#include <gpu_timer.hpp>
+
+#define GLIB_DYNAMIC_IMPL
+#include <dynamic.hpp>
+
+#define GLIB_SOFTRASTER_IMPL
+#include <softraster.hpp>
+
+#define GLIB_PACING_IMPL
+#include <pacing.hpp>
+
+#include "scenes.hpp"
+
+// Scripted time advances by a fixed step per frame
+const float TIMESTEP = 1.0f / 60.0f;
+
+const char *usage =
+    "usage: glib_bench [--scene gbuffer|final|soft] [--frames N] [--warmup N]\n"
+    "                  [--instances N] [--lights N] [--width W] [--height H]\n"
+    "                  [--model path|cube] [--output file.json] [--windowed]\n"
+    "                  [--trace trace.json] [--budget counter=N]...\n"
+    "                  [--no-alloc] [--threads N] [--frames-in-flight N]\n";
+
+struct bench_options_t {
+  std::string scene = "gbuffer";
+  int frames = 300;
+  int warmup = 30;
+  std::string output = "-";
+  std::string trace;
+  bool windowed = false;
+  bool no_alloc = false; // abort on a heap allocation after the warmup
+  int threads = 0;       // of the soft scene, 0 for every hardware thread
+  int frames_in_flight = 2; // 0 lets the driver queue frames
+
+  // Upper bounds of the per frame GL counters, exceeding one fails the run
+  std::vector<std::pair<const glib::frame_stats_field_t *, unsigned long>>
+      budgets;
+};
+
+static double percentile(const std::vector<double> &sorted, double q) {
+  if (sorted.empty())
+    return 0.0;
+  size_t index = std::min(sorted.size() - 1, (size_t)(q * sorted.size()));
+  return sorted[index];
+}
+
+// Resident and peak resident memory of the process in KiB
+static void process_memory(long &rss, long &peak) {
+  rss = peak = 0;
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmRSS:", 0) == 0)
+      rss = atol(line.c_str() + 6);
+    else if (line.rfind("VmHWM:", 0) == 0)
+      peak = atol(line.c_str() + 6);
+  }
+}
+
+int main(int argc, char **argv) {
+  bench_options_t options;
+  bench_params_t params = {.width = 1600,
+                           .height = 900,
+                           .instances = 9,
+                           .lights = 128,
+                           .model = "../../data/models/backpack/backpack.obj"};
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "--windowed") == 0) {
+      options.windowed = true;
+      continue;
+    }
+    if (strcmp(arg, "--no-alloc") == 0) {
+      options.no_alloc = true;
+      continue;
+    }
+    if (strncmp(arg, "--headless", 10) == 0)
+      continue;
+    if (strcmp(arg, "--help") == 0 || value == NULL) {
+      std::cout << usage;
+      return strcmp(arg, "--help") == 0 ? 0 : 1;
+    }
+
+    if (strcmp(arg, "--scene") == 0)
+      options.scene = value;
+    else if (strcmp(arg, "--frames") == 0)
+      options.frames = atoi(value);
+    else if (strcmp(arg, "--warmup") == 0)
+      options.warmup = atoi(value);
+    else if (strcmp(arg, "--instances") == 0)
+      params.instances = atoi(value);
+    else if (strcmp(arg, "--lights") == 0)
+      params.lights = atoi(value);
+    else if (strcmp(arg, "--width") == 0)
+      params.width = atoi(value);
+    else if (strcmp(arg, "--height") == 0)
+      params.height = atoi(value);
+    else if (strcmp(arg, "--model") == 0)
+      params.model = value;
+    else if (strcmp(arg, "--output") == 0)
+      options.output = value;
+    else if (strcmp(arg, "--trace") == 0)
+      options.trace = value;
+    else if (strcmp(arg, "--threads") == 0)
+      options.threads = atoi(value);
+    else if (strcmp(arg, "--frames-in-flight") == 0)
+      options.frames_in_flight = atoi(value);
+    else if (strcmp(arg, "--budget") == 0) {
+      std::string budget = value;
+      size_t equal = budget.find('=');
+      const glib::frame_stats_field_t *field =
+          glib::frame_stats_find(budget.substr(0, equal).c_str());
+      if (equal == std::string::npos || field == NULL) {
+        std::cout << "Unknown budget " << budget << "\n" << usage;
+        return 1;
+      }
+      options.budgets.push_back(
+          {field, strtoul(budget.c_str() + equal + 1, NULL, 10)});
+    }
+    else {
+      std::cout << usage;
+      return 1;
+    }
+    i += 1;
+  }
+
+  if (options.scene != "gbuffer" && options.scene != "final" &&
+      options.scene != "soft") {
+    std::cout << "Unknown scene " << options.scene << "\n" << usage;
+    return 1;
+  }
+
+  // Every measure is averaged over the frames
+  if (options.frames < 1 || options.warmup < 0) {
+    std::cout << "Invalid frame counts\n" << usage;
+    return 1;
+  }
+
+  // Sizes of the framebuffers, the grid and the light block
+  if (params.width < 1 || params.height < 1 || params.instances < 1 ||
+      params.lights < 1) {
+    std::cout << "Invalid scene parameters\n" << usage;
+    return 1;
+  }
+
+  // Offscreen unless asked otherwise, the frame loop is ours
+#ifdef GLIB_EGL
+  if (!options.windowed)
+    setenv("GLIB_HEADLESS", "egl", 0);
+#else
+  if (!options.windowed)
+    setenv("GLIB_HEADLESS", "osmesa", 0);
+#endif
+  GLFWwindow *window =
+      glib::initialize(params.width, params.height, "glib_bench", argc, argv);
+  if (window == NULL)
+    return -1;
+  glViewport(0, 0, params.width, params.height);
+  glEnable(GL_DEPTH_TEST);
+
+  // Allocations of this thread go in the frame counters
+  glib::alloc_track_thread();
+  glib::alloc_phase("load");
+
+  auto load_start = std::chrono::steady_clock::now();
+  bench_gbuffer_t gbuffer_scene;
+  bench_final_t final_scene;
+  bench_soft_t soft_scene;
+  if (options.scene == "gbuffer") {
+    gbuffer_scene = bench_gbuffer_create(params);
+    params = gbuffer_scene.params;
+  } else if (options.scene == "soft") {
+    glib::soft_initialize(options.threads);
+    bench_soft_create(soft_scene, params);
+  } else {
+    final_scene = bench_final_create(params);
+  }
+  glFinish();
+  double load_ms = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - load_start)
+                       .count();
+
+  std::vector<double> frame_ms;
+  frame_ms.reserve(options.frames);
+
+  // Largest GL counters of a measured frame
+  glib::frame_stats_t gl_max = {};
+
+  bool paced = options.frames_in_flight > 0;
+  glib::frame_pacer_t pacer;
+  if (paced)
+    pacer = glib::pacing_create(options.frames_in_flight);
+
+  glib::gpu_timer_t &timer = (options.scene == "gbuffer") ? gbuffer_scene.timer
+                             : (options.scene == "soft") ? soft_scene.timer
+                                                         : final_scene.timer;
+
+  auto run_start = std::chrono::steady_clock::now();
+  for (int frame = 0; frame < options.warmup + options.frames; ++frame) {
+    if (frame == options.warmup) {
+      glFinish();
+      glib::gpu_timer_reset(timer);
+      if (paced)
+        glib::pacing_reset(pacer);
+      glib::alloc_sites_reset();
+      glib::alloc_expect_none(options.no_alloc);
+      run_start = std::chrono::steady_clock::now();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (paced)
+      glib::pacing_begin(pacer);
+
+    float time = frame * TIMESTEP;
+    glib::alloc_phase("render");
+    if (options.scene == "gbuffer")
+      bench_gbuffer_frame(gbuffer_scene, time);
+    else if (options.scene == "soft")
+      bench_soft_frame(soft_scene, time);
+    else
+      bench_final_frame(final_scene, time);
+    glib::alloc_phase("present");
+    glib::window_present(window);
+    if (paced)
+      glib::pacing_end(pacer);
+    glib::profile_frame();
+
+    auto end = std::chrono::steady_clock::now();
+    if (frame < options.warmup)
+      continue;
+
+    frame_ms.push_back(
+        std::chrono::duration<double, std::milli>(end - start).count());
+    for (const glib::frame_stats_field_t &field : glib::frame_stats_fields) {
+      unsigned long &value = glib::frame_stats_get(gl_max, field);
+      value = std::max(value,
+                       glib::frame_stats_get(glib::frame_stats_last, field));
+    }
+  }
+  glib::alloc_expect_none(false);
+  glib::alloc_phase("report");
+  std::vector<glib::alloc_site_t> sites = glib::alloc_sites();
+  glFinish();
+
+  // Results still in flight are ready after the finish
+  for (int i = 0; i < GPU_TIMER_LATENCY; ++i)
+    glib::gpu_timer_frame(timer);
+
+  double run_ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - run_start)
+                      .count();
+
+  std::vector<double> sorted = frame_ms;
+  std::sort(sorted.begin(), sorted.end());
+  double mean = 0.0;
+  for (double ms : frame_ms)
+    mean += ms;
+  mean /= std::max<size_t>(frame_ms.size(), 1);
+
+  long rss, peak;
+  process_memory(rss, peak);
+
+  // Report
+  std::ostringstream json;
+  json << "{\n";
+  json << "  \"scene\": \"" << options.scene << "\",\n";
+  json << "  \"renderer\": \"" << glGetString(GL_RENDERER) << "\",\n";
+  json << "  \"width\": " << params.width << ",\n";
+  json << "  \"height\": " << params.height << ",\n";
+  json << "  \"instances\": " << params.instances << ",\n";
+  json << "  \"lights\": " << params.lights << ",\n";
+  json << "  \"frames\": " << options.frames << ",\n";
+  json << "  \"warmup\": " << options.warmup << ",\n";
+  json << "  \"load_ms\": " << load_ms << ",\n";
+  json << "  \"total_ms\": " << run_ms << ",\n";
+  json << "  \"fps\": " << options.frames / (run_ms / 1000.0) << ",\n";
+  json << "  \"cpu_frame_ms\": {\"mean\": " << mean
+       << ", \"min\": " << percentile(sorted, 0.0)
+       << ", \"p50\": " << percentile(sorted, 0.5)
+       << ", \"p90\": " << percentile(sorted, 0.9)
+       << ", \"p99\": " << percentile(sorted, 0.99)
+       << ", \"max\": " << percentile(sorted, 1.0) << "},\n";
+  json << "  \"gpu\": {\"frame_ms\": "
+       << timer.frame_total_ms / std::max<unsigned long>(timer.frame_samples, 1)
+       << ", \"dropped\": " << timer.dropped << ", \"passes\": {";
+  for (int i = 0; i < timer.pass_count; ++i) {
+    const glib::gpu_pass_t &pass = timer.passes[i];
+    json << (i ? ", " : "") << "\"" << pass.name << "\": {\"mean_ms\": "
+         << pass.total_ms / std::max<unsigned long>(pass.samples, 1)
+         << ", \"dropped\": " << pass.dropped
+         << ", \"vertices\": " << pass.vertices
+         << ", \"fragments\": " << pass.fragments << "}";
+  }
+  json << "}},\n";
+
+  // Allocations of the measured frames by zone, empty unless built with
+  // GLIB_TRACK_ALLOCATIONS
+  json << "  \"allocations\": {";
+  for (size_t i = 0; i < sites.size(); ++i)
+    json << (i ? ", " : "") << "\"" << sites[i].name << "\": {\"count\": "
+         << sites[i].count << ", \"bytes\": " << sites[i].bytes << "}";
+  json << "},\n";
+
+  // Rasteriser work of the last frame of the soft scene
+  if (options.scene == "soft")
+    json << "  \"soft\": {\"threads\": " << glib::soft_threads()
+         << ", \"triangles\": " << soft_scene.stats.triangles
+         << ", \"culled\": " << soft_scene.stats.culled
+         << ", \"fragments\": " << soft_scene.stats.fragments
+         << ", \"shaded\": " << soft_scene.stats.shaded << "},\n";
+
+  // CPU time blocked on the GPU and input to GPU completion latency, means
+  // of the measured frames
+  if (paced) {
+    unsigned long samples = std::max<unsigned long>(pacer.samples, 1);
+    json << "  \"pacing\": {\"frames_in_flight\": " << pacer.frames_in_flight
+         << ", \"wait_ms\": " << pacer.wait_total_ms / options.frames
+         << ", \"latency_ms\": " << pacer.latency_total_ms / samples
+         << ", \"latency_max_ms\": " << pacer.latency_max_ms << "},\n";
+  }
+
+  json << "  \"gl_per_frame\": {";
+  for (const glib::frame_stats_field_t &field : glib::frame_stats_fields)
+    json << (&field == glib::frame_stats_fields ? "" : ", ") << "\""
+         << field.name << "\": " << glib::frame_stats_get(gl_max, field);
+  json << "},\n";
+
+  // CPU zones of the last frame, empty unless built with GLIB_PROFILE
+  std::vector<glib::profile_stat_t> zones = glib::profile_frame_stats();
+  json << "  \"cpu_zones\": {";
+  for (size_t i = 0; i < zones.size(); ++i)
+    json << (i ? ", " : "") << "\"" << zones[i].name << "\": {\"calls\": "
+         << zones[i].calls << ", \"ms\": " << zones[i].ms << "}";
+  json << "},\n";
+  json << "  \"gpu_memory_kb\": {";
+  std::vector<glib::gpu_memory_usage_t> usages = glib::gpu_memory_usage();
+  for (size_t i = 0; i < usages.size(); ++i)
+    json << (i ? ", " : "") << "\"" << usages[i].subsystem
+         << "\": {\"live\": " << usages[i].live / 1024
+         << ", \"peak\": " << usages[i].peak / 1024 << "}";
+  json << "},\n";
+  json << "  \"memory_kb\": {\"rss\": " << rss << ", \"peak\": " << peak
+       << "}\n";
+  json << "}\n";
+
+  if (options.output == "-") {
+    std::cout << json.str();
+  } else {
+    std::ofstream file(options.output);
+    file << json.str();
+    printf("written %s\n", options.output.c_str());
+  }
+
+  if (!options.trace.empty())
+    glib::profile_export_chrome(options.trace.c_str());
+
+  // Report every exceeded budget, not only the first
+  int result = 0;
+  for (auto &[field, limit] : options.budgets) {
+    unsigned long value = glib::frame_stats_get(gl_max, *field);
+    if (value > limit) {
+      printf("budget exceeded: %s %lu > %lu\n", field->name, value, limit);
+      result = 2;
+    }
+  }
+
+  if (options.scene == "gbuffer")
+    bench_gbuffer_destroy(gbuffer_scene);
+  else if (options.scene == "soft")
+    bench_soft_destroy(soft_scene);
+  else
+    bench_final_destroy(final_scene);
+  if (paced)
+    glib::pacing_destroy(pacer);
+  glib::program_variant_clear();
+
+  // Leaked GPU memory fails the run too
+  if (glib::terminate() != 0)
+    result = 3;
+  return result;
+}
@@ -0,0 +1,290 @@
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GLIB_INIT_IMPL
+#include <initialization.hpp>
+
+#define GLIB_GRAPHICS_IMPL
+#include <graphics.hpp>
+
+#define GLIB_TRANSFORM_IMPL
+#include <transform.hpp>
+
+#define GLIB_MODEL_IMPL
+#include <model.hpp>
+
+#define GLIB_GBUFFER_IMPL
+#include <gbuffer.hpp>
+
+#define GLIB_TEMPORAL_IMPL
+#include <temporal.hpp>
+
+#define GLIB_PERMUTATION_IMPL
+#include <permutation.hpp>
+
+#define GLIB_GPU_TIMER_IMPL
+#include <gpu_timer.hpp>
+
+#define GLIB_DYNAMIC_IMPL
+#include <dynamic.hpp>
+
+#define GLIB_IMAGE_IMPL
+#include <image.hpp>
+
+#define GLIB_SOFTRASTER_IMPL
+#include <softraster.hpp>
+
+#include "scenes.hpp"
+
+// Renders fixed frames of the bench scenes and compares them with the
+// reference images, run from bench/ or pass --reference
+
+const char *usage =
+    "usage: glib_regress [--scene gbuffer|final|soft] [--reference dir]\n"
+    "                    [--output dir] [--update]\n";
+
+// Scripted time advances by a fixed step per frame
+const float TIMESTEP = 1.0f / 60.0f;
+
+// Frames read back, later ones include the temporal history
+const int CAPTURE_FRAMES[] = {1, 45};
+
+// Perceptual error above which a pixel is bad
+const float TOLERANCE = 0.05f;
+
+// The references are rendered with these, changing them needs --update
+const bench_params_t PARAMS = {
+    .width = 256, .height = 144, .instances = 4, .lights = 16, .model = "cube"};
+
+// An image read back after a captured frame
+struct regress_target_t {
+  const char *name;
+  bool gbuffer;            // attachment of the G-buffer or of the backbuffer
+  unsigned int attachment;
+  float scale, bias;       // fit the values in 8 bits
+  double min_psnr;         // dB
+  double max_bad;          // ratio of bad pixels
+};
+
+const regress_target_t gbuffer_targets[] = {
+    {"color", false, GL_COLOR_ATTACHMENT0, 1.0f, 0.0f, 35.0, 0.005},
+    {"position", true, GL_COLOR_ATTACHMENT0, 1.0f / 16.0f, 0.5f, 40.0, 0.002},
+    {"normal", true, GL_COLOR_ATTACHMENT1, 0.5f, 0.5f, 40.0, 0.002},
+    {"albedo", true, GL_COLOR_ATTACHMENT2, 1.0f, 0.0f, 40.0, 0.002},
+    {"velocity", true, GL_COLOR_ATTACHMENT3, 16.0f, 0.5f, 40.0, 0.002}};
+
+const regress_target_t final_targets[] = {
+    {"color", false, GL_COLOR_ATTACHMENT0, 1.0f, 0.0f, 35.0, 0.005}};
+
+// Read from the software framebuffer, the attachment is unused
+const regress_target_t soft_targets[] = {
+    {"color", false, 0, 1.0f, 0.0f, 35.0, 0.005}};
+
+struct regress_options_t {
+  std::string scene;
+  std::string reference = "reference";
+  std::string output = "regress";
+  bool update = false;
+};
+
+// Compare or store one target, true if it passes. A target can be compared
+// with the reference of another scene, which alone updates it.
+static bool regress_check(const regress_options_t &options,
+                          const regress_target_t &target,
+                          const std::string &name, const glib::image_t &image,
+                          const std::string &shared = "") {
+  std::string reference_path =
+      options.reference + "/" + (shared.empty() ? name : shared) + ".png";
+  if (options.update && !shared.empty())
+    return true;
+  if (options.update) {
+    glib::image_write_png(reference_path.c_str(), image);
+    printf("updated %s\n", reference_path.c_str());
+    return true;
+  }
+
+  glib::image_t reference;
+  if (!glib::image_load(reference_path.c_str(), reference)) {
+    printf("%-24s missing reference %s\n", name.c_str(),
+           reference_path.c_str());
+    return false;
+  }
+  if (reference.width != image.width || reference.height != image.height ||
+      reference.channels != image.channels) {
+    printf("%-24s reference is %dx%dx%d, expected %dx%dx%d\n", name.c_str(),
+           reference.width, reference.height, reference.channels, image.width,
+           image.height, image.channels);
+    return false;
+  }
+
+  glib::image_diff_t diff = glib::image_compare(image, reference, TOLERANCE);
+  bool passed = diff.psnr >= target.min_psnr && diff.bad <= target.max_bad;
+  printf("%-24s psnr %6.2f dB  bad %6.3f%%  max %.3f  %s\n", name.c_str(),
+         diff.psnr, diff.bad * 100.0, diff.max, passed ? "ok" : "FAILED");
+
+  // The image and where it differs, next to the reference
+  if (!passed) {
+    std::string prefix = options.output + "/" + name;
+    glib::image_write_png((prefix + ".png").c_str(), image);
+    glib::image_write_png((prefix + "_diff.png").c_str(), diff.errors);
+    printf("written %s.png and %s_diff.png\n", prefix.c_str(), prefix.c_str());
+  }
+  return passed;
+}
+
+// Read back the targets of a captured frame
+static int regress_capture(const regress_options_t &options, const char *scene,
+                           int frame, const regress_target_t *targets,
+                           size_t count, unsigned int gbuffer) {
+  int failures = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const regress_target_t &target = targets[i];
+    unsigned int fbo = target.gbuffer ? gbuffer : glib::framebuffer_default;
+    glib::image_t image = glib::image_read(
+        fbo, target.attachment, PARAMS.width, PARAMS.height, target.scale,
+        target.bias);
+
+    std::string name = std::string(scene) + "_" + std::to_string(frame) +
+                       "_" + target.name;
+    if (!regress_check(options, target, name, image))
+      failures += 1;
+  }
+  framebuffer_default_bind();
+  return failures;
+}
+
+static int regress_gbuffer(const regress_options_t &options,
+                           GLFWwindow *window) {
+  bench_gbuffer_t scene = bench_gbuffer_create(PARAMS);
+  int failures = 0;
+  int last = CAPTURE_FRAMES[std::size(CAPTURE_FRAMES) - 1];
+  for (int frame = 0; frame <= last; ++frame) {
+    bench_gbuffer_frame(scene, frame * TIMESTEP);
+    for (int capture : CAPTURE_FRAMES)
+      if (capture == frame)
+        failures += regress_capture(options, "gbuffer", frame,
+                                    gbuffer_targets,
+                                    std::size(gbuffer_targets),
+                                    scene.gbuffer.id);
+    glib::window_present(window);
+  }
+  bench_gbuffer_destroy(scene);
+  return failures;
+}
+
+static int regress_final(const regress_options_t &options,
+                         GLFWwindow *window) {
+  bench_final_t scene = bench_final_create(PARAMS);
+  int failures = 0;
+  int last = CAPTURE_FRAMES[std::size(CAPTURE_FRAMES) - 1];
+  for (int frame = 0; frame <= last; ++frame) {
+    bench_final_frame(scene, frame * TIMESTEP);
+    for (int capture : CAPTURE_FRAMES)
+      if (capture == frame)
+        failures += regress_capture(options, "final", frame, final_targets,
+                                    std::size(final_targets), 0);
+    glib::window_present(window);
+  }
+  bench_final_destroy(scene);
+  return failures;
+}
+
+static int regress_soft(const regress_options_t &options) {
+  bench_soft_t scene;
+  bench_soft_create(scene, PARAMS);
+  int failures = 0;
+  int last = CAPTURE_FRAMES[std::size(CAPTURE_FRAMES) - 1];
+  for (int frame = 0; frame <= last; ++frame) {
+    bench_soft_draw(scene, frame * TIMESTEP);
+    for (int capture : CAPTURE_FRAMES) {
+      if (capture != frame)
+        continue;
+      const regress_target_t &target = soft_targets[0];
+      glib::image_t image = {
+          .width = PARAMS.width, .height = PARAMS.height, .channels = 3};
+      glib::soft_framebuffer_rgb8(scene.target, 0, image.pixels, target.scale,
+                                  target.bias);
+
+      // Matches llvmpipe pixel for pixel, so the final scene references
+      std::string suffix = std::to_string(frame) + "_" + target.name;
+      if (!regress_check(options, target, "soft_" + suffix, image,
+                         "final_" + suffix))
+        failures += 1;
+    }
+  }
+  bench_soft_destroy(scene);
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  regress_options_t options;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+    if (strcmp(arg, "--update") == 0) {
+      options.update = true;
+      continue;
+    }
+    if (strcmp(arg, "--help") == 0 || value == NULL) {
+      std::cout << usage;
+      return strcmp(arg, "--help") == 0 ? 0 : 1;
+    }
+
+    if (strcmp(arg, "--scene") == 0)
+      options.scene = value;
+    else if (strcmp(arg, "--reference") == 0)
+      options.reference = value;
+    else if (strcmp(arg, "--output") == 0)
+      options.output = value;
+    else {
+      std::cout << usage;
+      return 1;
+    }
+    i += 1;
+  }
+
+  if (!options.scene.empty() && options.scene != "gbuffer" &&
+      options.scene != "final" && options.scene != "soft") {
+    std::cout << "Unknown scene " << options.scene << "\n" << usage;
+    return 1;
+  }
+  std::filesystem::create_directories(options.update ? options.reference
+                                                     : options.output);
+
+  // Always offscreen, the backbuffer is an FBO we can read at any time
+#ifdef GLIB_EGL
+  setenv("GLIB_HEADLESS", "egl", 0);
+#else
+  setenv("GLIB_HEADLESS", "osmesa", 0);
+#endif
+  GLFWwindow *window =
+      glib::initialize(PARAMS.width, PARAMS.height, "glib_regress", argc, argv);
+  if (window == NULL)
+    return -1;
+  glViewport(0, 0, PARAMS.width, PARAMS.height);
+  glEnable(GL_DEPTH_TEST);
+
+  int failures = 0;
+  if (options.scene.empty() || options.scene == "gbuffer")
+    failures += regress_gbuffer(options, window);
+  if (options.scene.empty() || options.scene == "final")
+    failures += regress_final(options, window);
+  if (options.scene.empty() || options.scene == "soft")
+    failures += regress_soft(options);
+  glib::program_variant_clear();
+
+  int result = 0;
+  if (failures > 0) {
+    printf("%d images differ from the references\n", failures);
+    result = 2;
+  }
+  if (glib::terminate() != 0)
+    result = 3;
+  return result;
+}
@@ -0,0 +1,494 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <dynamic.hpp>
+#include <gbuffer.hpp>
+#include <gpu_timer.hpp>
+#include <graphics.hpp>
+#include <mesh.hpp>
+#include <model.hpp>
+#include <permutation.hpp>
+#include <softraster.hpp>
+#include <temporal.hpp>
+#include <transform.hpp>
+
+#include "../final/shaders.hpp"
+#include "../gbuffer/shaders.hpp"
+
+// Scale of a benchmark scene
+struct bench_params_t {
+  int width, height;
+  int instances; // models laid out on a square grid
+  int lights;    // point lights of the deferred scene
+  const char *model;
+};
+
+// Camera orbit of the demos driven by the scripted time
+inline void bench_camera_orbit(glib::camera_t &camera, float time,
+                               float distance) {
+  camera.position.x = sinf(time) * distance;
+  camera.position.z = cosf(time) * distance;
+  glib::camera_look_at(camera, glm::vec3(0.0f));
+}
+
+// Positions of the instances, centered on the origin 3 units apart
+inline std::vector<glm::vec3> bench_grid(int instances) {
+  std::vector<glm::vec3> result;
+  int side = (int)ceilf(sqrtf((float)instances));
+  for (int i = 0; i < instances; ++i) {
+    float x = (i % side - (side - 1) * 0.5f) * 3.0f;
+    float z = (i / side - (side - 1) * 0.5f) * 3.0f;
+    result.push_back(glm::vec3(x, -0.5f, z));
+  }
+  return result;
+}
+
+// 1x1 texture of a single color
+inline glib::texture_t bench_texture(unsigned char r, unsigned char g,
+                                     unsigned char b) {
+  unsigned char pixel[3] = {r, g, b};
+
+  unsigned int tid;
+  glGenTextures(1, &tid);
+  glBindTexture(GL_TEXTURE_2D, tid);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE,
+               pixel);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glib::gpu_memory_track(glib::GPU_TEXTURE, tid,
+                         glib::texture_bytes(GL_RGB, 1, 1, false));
+  return {.id = tid};
+}
+
+// Cube of layout_3F3F3F2F, the tangents follow the u direction
+inline std::vector<float> bench_cube_vertices() {
+  std::vector<float> source = glib::mesh_cube_with_normals_and_uvs();
+  std::vector<float> vertices;
+  vertices.reserve(source.size() / 8 * 11);
+
+  for (size_t v = 0; v < source.size(); v += 8) {
+    // Faces are axis aligned
+    size_t first = v - v % (8 * 3);
+    glm::vec3 p0(source[first + 0], source[first + 1], source[first + 2]);
+    glm::vec3 p1(source[first + 8], source[first + 9], source[first + 10]);
+    glm::vec3 p2(source[first + 16], source[first + 17], source[first + 18]);
+    glm::vec2 t0(source[first + 6], source[first + 7]);
+    glm::vec2 t1(source[first + 14], source[first + 15]);
+    glm::vec2 t2(source[first + 22], source[first + 23]);
+
+    glm::vec3 e1 = p1 - p0, e2 = p2 - p0;
+    glm::vec2 d1 = t1 - t0, d2 = t2 - t0;
+    float f = 1.0f / (d1.x * d2.y - d2.x * d1.y);
+    glm::vec3 tangent = glm::normalize(f * (d2.y * e1 - d1.y * e2));
+
+    vertices.insert(vertices.end(), &source[v], &source[v] + 6);
+    vertices.insert(vertices.end(), {tangent.x, tangent.y, tangent.z});
+    vertices.insert(vertices.end(), &source[v + 6], &source[v + 6] + 2);
+  }
+  return vertices;
+}
+
+// Textured cube with tangents, used when no model file is available
+inline glib::model_t bench_cube_model() {
+  std::vector<float> vertices = bench_cube_vertices();
+  glib::mesh_t mesh = {
+      .buffer = glib::buffer_create(&vertices, NULL, glib::layout_3F3F3F2F),
+      .albedo = bench_texture(200, 160, 120),
+      .specular = bench_texture(128, 128, 128),
+      .normal = bench_texture(128, 128, 255)};
+
+  // buffer_create counts floats, draw arrays needs vertices
+  mesh.buffer.v_count = vertices.size() / 11;
+
+  glib::model_t result;
+  result.meshes.push_back(mesh);
+  return result;
+}
+
+inline bool bench_model_is_cube(const bench_params_t &params) {
+  return params.model == NULL || std::string(params.model) == "cube";
+}
+
+inline glib::model_t bench_model(const bench_params_t &params) {
+  if (bench_model_is_cube(params)) {
+    glib::gpu_memory_scope_t scope("bench");
+    return bench_cube_model();
+  }
+  return glib::model_load(params.model);
+}
+
+// The textures of the cube are its own, loaded models release theirs to the
+// texture manager which frees the ones left unreferenced
+inline void bench_model_destroy(glib::model_t &model) {
+  glib::model_destroy(model);
+  glib::model_textures_release();
+}
+
+// =============================================================================
+// Deferred scene of gbuffer/main.cpp
+
+struct bench_gbuffer_t {
+  bench_params_t params;
+  glib::program_t geometry, lighting;
+  glib::buffer_t screen;
+  glib::model_t model;
+  glib::gbuffer_t gbuffer;
+  glib::temporal_t temporal;
+  glib::camera_t camera;
+  glib::gpu_timer_t timer;
+  glib::dynamic_ring_t ring; // lights of each frame
+
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> light_positions, light_colors;
+};
+
+inline bench_gbuffer_t bench_gbuffer_create(bench_params_t params) {
+  bench_gbuffer_t scene = {};
+
+  // Lights are a uniform block, stay within its size limit
+  int block_size = 0;
+  glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &block_size);
+  int capacity = block_size / sizeof(shader_light_point_t);
+  if (params.lights > capacity) {
+    printf("clamping lights to %d\n", capacity);
+    params.lights = capacity;
+  }
+  scene.params = params;
+
+  scene.geometry =
+      glib::program_create(shader_geometry_vs, shader_geometry_fs);
+  std::string lighting_fs =
+      glib::shader_insert(shader_lighting_fs, glib::shader_temporal);
+  scene.lighting = glib::program_variant(
+      shader_lighting_vs, lighting_fs.c_str(),
+      {{"LIGHT_CAPACITY", std::to_string(params.lights)}});
+
+  glib::program_uniform_1i(scene.geometry, "material.diffuse", 0);
+  glib::program_uniform_1i(scene.geometry, "material.specular", 1);
+  glib::program_uniform_1i(scene.geometry, "material.normal", 2);
+  glib::program_uniform_1i(scene.lighting, "gbuffer.position", 0);
+  glib::program_uniform_1i(scene.lighting, "gbuffer.normal", 1);
+  glib::program_uniform_1i(scene.lighting, "gbuffer.color_spec", 2);
+  glib::program_uniform_block(scene.lighting, "lights_block", LIGHTS_BINDING);
+
+  std::vector<float> screen_vertices = glib::mesh_screen_ndc();
+  scene.screen = glib::buffer_create(&screen_vertices, NULL, glib::layout_3F2F);
+
+  scene.model = bench_model(params);
+  scene.positions = bench_grid(params.instances);
+  scene.gbuffer = glib::gbuffer_create(params.width, params.height, true);
+  scene.temporal = glib::temporal_create(params.width, params.height);
+  scene.camera = glib::camera_base(glm::vec3(0.0f, 0.0f, 3.0f));
+  scene.timer = glib::gpu_timer_create();
+  scene.ring = glib::dynamic_ring_create(params.lights *
+                                         sizeof(shader_light_point_t));
+
+  // Same distribution as the demo with a fixed seed
+  srand(1234);
+  float extent = sqrtf((float)params.instances) * 2.0f;
+  for (int i = 0; i < params.lights; ++i) {
+    float x = ((rand() % 100) / 100.0f) * 2.0f * extent - extent;
+    float y = ((rand() % 100) / 100.0f) * 6.0f - 4.0f;
+    float z = ((rand() % 100) / 100.0f) * 2.0f * extent - extent;
+    scene.light_positions.push_back(glm::vec3(x, y, z));
+    scene.light_colors.push_back(glm::vec3((rand() % 100) / 200.0f + 0.5f,
+                                           (rand() % 100) / 200.0f + 0.5f,
+                                           (rand() % 100) / 200.0f + 0.5f));
+  }
+  return scene;
+}
+
+inline void bench_gbuffer_destroy(bench_gbuffer_t &scene) {
+  glib::dynamic_ring_destroy(scene.ring);
+  glib::temporal_destroy(scene.temporal);
+  glib::gbuffer_destroy(scene.gbuffer);
+  glib::buffer_destroy(scene.screen);
+  bench_model_destroy(scene.model);
+  glib::program_destroy(scene.geometry);
+  glib::gpu_timer_destroy(scene.timer);
+}
+
+inline void bench_gbuffer_frame(bench_gbuffer_t &scene, float time) {
+  const bench_params_t &params = scene.params;
+  const float aspect = (float)params.width / params.height;
+
+  bench_camera_orbit(scene.camera, time * 0.5f,
+                     sqrtf((float)params.instances) * 3.0f + 4.0f);
+  glm::mat4 view = glib::camera_view(scene.camera);
+  glm::mat4 proj =
+      glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+
+  glib::gpu_timer_frame(scene.timer);
+  glib::dynamic_ring_begin(scene.ring);
+  glib::temporal_begin(scene.temporal, proj * view);
+  glib::program_uniform_mf(scene.geometry, "view", glm::value_ptr(view));
+  glib::program_uniform_mf(scene.geometry, "proj", glm::value_ptr(proj));
+  glib::program_uniform_mf(scene.geometry, "prev_view_proj",
+                           glm::value_ptr(scene.temporal.prev_view_proj));
+
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // Geometry pass
+  gbuffer_bind(scene.gbuffer);
+  {
+    GLIB_GPU_ZONE(scene.timer, "geometry");
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    const float no_motion[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 3, no_motion);
+
+    for (glm::vec3 &position : scene.positions) {
+      glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+      glib::program_uniform_mf(scene.geometry, "model", glm::value_ptr(model));
+      glib::program_uniform_mf(scene.geometry, "prev_model",
+                               glm::value_ptr(model));
+      glib::model_render(scene.model, scene.geometry);
+    }
+  }
+  gbuffer_unbind();
+
+  // Lighting pass
+  temporal_bind(scene.temporal);
+  {
+    GLIB_GPU_ZONE(scene.timer, "lighting");
+    glib::texture_bind(scene.gbuffer.position, 0);
+    glib::texture_bind(scene.gbuffer.normal, 1);
+    glib::texture_bind(scene.gbuffer.color, 2);
+    glib::temporal_uniforms(scene.temporal, scene.lighting,
+                            scene.gbuffer.velocity, 3);
+
+    glib::program_uniform_3f(scene.lighting, "camera_pos",
+                             scene.camera.position.x, scene.camera.position.y,
+                             scene.camera.position.z);
+
+    // Written straight into this frame slice of the ring
+    glib::dynamic_range_t range = glib::dynamic_ring_alloc(
+        scene.ring, params.lights * sizeof(shader_light_point_t));
+    shader_light_point_t *lights = (shader_light_point_t *)range.data;
+    for (int i = 0; i < params.lights; ++i) {
+      const glm::vec3 &position = scene.light_positions[i];
+      const glm::vec3 &color = scene.light_colors[i];
+      lights[i] = {{position.x, position.y, position.z, 0.0f},
+                   {color.x, color.y, color.z, 0.0f},
+                   {1.0f, 0.7f, 1.8f, 0.0f}};
+    }
+    glib::dynamic_ring_bind(scene.ring, range, GL_UNIFORM_BUFFER,
+                            LIGHTS_BINDING);
+
+    glib::render(scene.screen, scene.lighting, GL_TRIANGLE_STRIP);
+  }
+
+  // Present
+  glib::gl_bind_framebuffer(GL_READ_FRAMEBUFFER,
+                            scene.temporal.fbo[scene.temporal.current]);
+  glib::gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, glib::framebuffer_default);
+  {
+    GLIB_GPU_ZONE(scene.timer, "present");
+    GLIB_GL(glBlitFramebuffer(0, 0, params.width, params.height, 0, 0,
+                              params.width, params.height, GL_COLOR_BUFFER_BIT,
+                              GL_NEAREST));
+  }
+  framebuffer_default_bind();
+  glib::temporal_end(scene.temporal);
+  glib::dynamic_ring_end(scene.ring);
+}
+
+// =============================================================================
+// Forward scene of final/main.cpp
+
+struct bench_final_t {
+  bench_params_t params;
+  glib::program_t program;
+  glib::model_t model;
+  glib::camera_t camera;
+  glib::gpu_timer_t timer;
+  std::vector<glm::vec3> positions;
+};
+
+inline bench_final_t bench_final_create(const bench_params_t &params) {
+  bench_final_t scene = {};
+  scene.params = params;
+  scene.program =
+      glib::program_variant(shader_vertex, shader_fragment, {{"TORCH", "1"}});
+  scene.model = bench_model(params);
+  scene.positions = bench_grid(params.instances);
+  scene.camera = glib::camera_base(glm::vec3(0.0f, 0.0f, 3.0f));
+  scene.timer = glib::gpu_timer_create();
+
+  glib::program_uniform_1i(scene.program, "diffuse_map", 0);
+  glib::program_uniform_1i(scene.program, "specular_map", 1);
+  glib::program_uniform_1i(scene.program, "normal_map", 2);
+  return scene;
+}
+
+inline void bench_final_destroy(bench_final_t &scene) {
+  bench_model_destroy(scene.model);
+  glib::gpu_timer_destroy(scene.timer);
+}
+
+inline void bench_final_frame(bench_final_t &scene, float time) {
+  const bench_params_t &params = scene.params;
+  const float aspect = (float)params.width / params.height;
+  const glm::vec3 sun_dir = glm::normalize(-glm::vec3(10.0f, 10.0f, 10.0f));
+
+  glm::vec3 point_light_pos(0.0f, cosf(time) * 3.0f, sinf(time) * 3.0f);
+
+  glib::gpu_timer_frame(scene.timer);
+  GLIB_GPU_ZONE(scene.timer, "forward");
+  glClearColor(0.25f, 0.25f, 0.25f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  bench_camera_orbit(scene.camera, time,
+                     sqrtf((float)params.instances) * 3.0f + 7.0f);
+  glm::mat4 view = glib::camera_view(scene.camera);
+  glm::mat4 proj =
+      glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+
+  glib::program_uniform_3f(scene.program, "camera_pos",
+                           scene.camera.position.x, scene.camera.position.y,
+                           scene.camera.position.z);
+  glib::program_uniform_mf(scene.program, "view", glm::value_ptr(view));
+  glib::program_uniform_mf(scene.program, "proj", glm::value_ptr(proj));
+  glib::program_uniform_3f(scene.program, "sun_dir", sun_dir.x, sun_dir.y,
+                           sun_dir.z);
+  glib::program_uniform_3f(scene.program, "light_pos", point_light_pos.x,
+                           point_light_pos.y, point_light_pos.z);
+
+  for (glm::vec3 &position : scene.positions) {
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    glib::program_uniform_mf(scene.program, "model", glm::value_ptr(model));
+    glib::model_render(scene.model, scene.program);
+  }
+}
+
+// =============================================================================
+// Forward scene of final/main.cpp on the software rasteriser
+
+struct bench_soft_t {
+  bench_params_t params;
+  glib::soft_framebuffer_t target;
+  glib::soft_buffer_t cube;
+  glib::soft_texture_t albedo, specular, normal;
+  glib::soft_lit_uniforms_t uniforms;
+  glib::soft_program_t program;
+  glib::camera_t camera;
+  std::vector<glm::vec3> positions;
+  glib::soft_stats_t stats; // of the last frame
+
+  // Presented through a texture blitted to the default framebuffer
+  unsigned int texture, fbo;
+  std::vector<unsigned char> pixels;
+  glib::gpu_timer_t timer;
+};
+
+// Loaded models live on the GPU only, the cube is always drawn. Created in
+// place since the program reads the uniforms of the scene by reference.
+inline void bench_soft_create(bench_soft_t &scene,
+                              const bench_params_t &params) {
+  if (!bench_model_is_cube(params))
+    printf("the soft scene draws the cube, ignoring %s\n", params.model);
+
+  scene.params = params;
+  scene.target = glib::soft_framebuffer_create(params.width, params.height);
+
+  std::vector<float> vertices = bench_cube_vertices();
+  scene.cube = glib::soft_buffer_create(&vertices, NULL, 11);
+
+  // Same colors as bench_cube_model
+  const unsigned char albedo[3] = {200, 160, 120};
+  const unsigned char specular[3] = {128, 128, 128};
+  const unsigned char normal[3] = {128, 128, 255};
+  scene.albedo = glib::soft_texture_create(1, 1, 3, albedo);
+  scene.specular = glib::soft_texture_create(1, 1, 3, specular);
+  scene.normal = glib::soft_texture_create(1, 1, 3, normal);
+
+  scene.uniforms = {.diffuse = &scene.albedo,
+                     .specular = &scene.specular,
+                     .normal = &scene.normal,
+                     .torch = true};
+  scene.program = glib::soft_program_lit(scene.uniforms);
+  scene.positions = bench_grid(params.instances);
+  scene.camera = glib::camera_base(glm::vec3(0.0f, 0.0f, 3.0f));
+
+  glGenTextures(1, &scene.texture);
+  glBindTexture(GL_TEXTURE_2D, scene.texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, params.width, params.height, 0,
+               GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  glib::gpu_memory_track(
+      glib::GPU_TEXTURE, scene.texture,
+      glib::texture_bytes(GL_RGB8, params.width, params.height, false),
+      "bench");
+  glGenFramebuffers(1, &scene.fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, scene.fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         scene.texture, 0);
+  framebuffer_default_bind();
+  scene.timer = glib::gpu_timer_create();
+}
+
+inline void bench_soft_destroy(bench_soft_t &scene) {
+  glib::gpu_memory_untrack(glib::GPU_TEXTURE, scene.texture);
+  glDeleteFramebuffers(1, &scene.fbo);
+  glDeleteTextures(1, &scene.texture);
+  glib::gpu_timer_destroy(scene.timer);
+  glib::soft_terminate();
+}
+
+// Render on the CPU only, see bench_soft_present
+inline void bench_soft_draw(bench_soft_t &scene, float time) {
+  const bench_params_t &params = scene.params;
+  const float aspect = (float)params.width / params.height;
+  glib::soft_lit_uniforms_t &uniforms = scene.uniforms;
+
+  glib::soft_clear(scene.target, glm::vec4(0.25f, 0.25f, 0.25f, 1.0f));
+  scene.stats = {};
+
+  bench_camera_orbit(scene.camera, time,
+                     sqrtf((float)params.instances) * 3.0f + 7.0f);
+  uniforms.view = glib::camera_view(scene.camera);
+  uniforms.proj = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+  uniforms.camera_pos = scene.camera.position;
+  uniforms.sun_dir = glm::normalize(-glm::vec3(10.0f, 10.0f, 10.0f));
+  uniforms.light_pos = glm::vec3(0.0f, cosf(time) * 3.0f, sinf(time) * 3.0f);
+
+  for (glm::vec3 &position : scene.positions) {
+    uniforms.model = glm::translate(glm::mat4(1.0f), position);
+    glib::soft_render(scene.target, scene.cube, scene.program);
+
+    const glib::soft_stats_t &stats = glib::soft_stats();
+    scene.stats.triangles += stats.triangles;
+    scene.stats.culled += stats.culled;
+    scene.stats.fragments += stats.fragments;
+    scene.stats.shaded += stats.shaded;
+  }
+}
+
+inline void bench_soft_present(bench_soft_t &scene) {
+  const bench_params_t &params = scene.params;
+  GLIB_GPU_ZONE(scene.timer, "present");
+
+  // Rows top to bottom, flip them back with the blit
+  glib::soft_framebuffer_rgb8(scene.target, 0, scene.pixels);
+  glib::gl_bind_texture(GL_TEXTURE_2D, scene.texture);
+  GLIB_GL(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+  GLIB_GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, params.width, params.height,
+                          GL_RGB, GL_UNSIGNED_BYTE, scene.pixels.data()));
+
+  glib::gl_bind_framebuffer(GL_READ_FRAMEBUFFER, scene.fbo);
+  glib::gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, glib::framebuffer_default);
+  GLIB_GL(glBlitFramebuffer(0, 0, params.width, params.height, 0,
+                            params.height, params.width, 0,
+                            GL_COLOR_BUFFER_BIT, GL_NEAREST));
+  framebuffer_default_bind();
+}
+
+inline void bench_soft_frame(bench_soft_t &scene, float time) {
+  glib::gpu_timer_frame(scene.timer);
+  bench_soft_draw(scene, time);
+  bench_soft_present(scene);
+}
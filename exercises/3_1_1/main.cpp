@@ -17,6 +17,9 @@
 #define GLIB_MODEL_IMPL
 #include <model.hpp>
 
+#define GLIB_PERMUTATION_IMPL
+#include <permutation.hpp>
+
 const std::vector<glm::vec3> cube_positions = {
     glm::vec3(0.0f, 0.0f, 0.0f),    glm::vec3(2.0f, 5.0f, -15.0f),
     glm::vec3(-1.5f, -2.2f, -2.5f), glm::vec3(-3.8f, -2.0f, -12.3f),
@@ -105,11 +108,15 @@ struct spot_light_t {
   float cutoff_outer;
 };
 
+#ifndef POINT_LIGHT_CAP
 #define POINT_LIGHT_CAP 10
+#endif
 uniform point_light_t point_light_list[POINT_LIGHT_CAP];
 uniform int point_light_count = 0;
 
+#ifndef SPOT_LIGHT_CAP
 #define SPOT_LIGHT_CAP 10
+#endif
 uniform spot_light_t spot_light_list[SPOT_LIGHT_CAP];
 uniform int spot_light_count = 0;
 
@@ -123,7 +130,7 @@ vec3 light_sun(vec3 N, vec3 V) {
 
   vec3 ambient  = sun.color * 0.1f * texture(diffuse_map, uv).rgb;
   vec3 diffuse  = sun.color * kD   * texture(diffuse_map, uv).rgb;
-  vec3 specular = sun.color * kS   * texture(specular_map, uv).rgb;
+  vec3 specular = sun.color * kS   * vec3(texture(specular_map, uv).r);
 
   return ambient + diffuse + specular;
 }
@@ -143,7 +150,7 @@ vec3 light_point(vec3 N, vec3 V, int i) {
       + light.quadratic * distance * distance);
 
   vec3 diffuse  = light.color * kFO * kD * texture(diffuse_map, uv).rgb;
-  vec3 specular = light.color * kFO * kS * texture(specular_map, uv).rgb;
+  vec3 specular = light.color * kFO * kS * vec3(texture(specular_map, uv).r);
 
   return diffuse + specular;
 }
@@ -163,7 +170,7 @@ vec3 light_spot(vec3 N, vec3 V, int i) {
   float kFO = clamp((theta - light.cutoff_outer) / epsilon, 0.0f, 1.0f);
 
   vec3 diffuse  = light.color * kFO * kD * texture(diffuse_map, uv).rgb;
-  vec3 specular = light.color * kFO * kS * texture(specular_map, uv).rgb;
+  vec3 specular = light.color * kFO * kS * vec3(texture(specular_map, uv).r);
 
   return diffuse + specular;
 }
@@ -177,13 +184,17 @@ void main() {
   // Apply sun light
   result += light_sun(N, V);
 
-  // Apply all point lights
-  for (int i = 0; i < point_light_count; i++) {
+  // Apply all point lights, the loop is unrolled up to the capacity
+  for (int i = 0; i < POINT_LIGHT_CAP; i++) {
+    if (i >= point_light_count)
+      break;
     result += light_point(N, V, i);
   }
 
   // Apply all spot lights
-  for (int i = 0; i < spot_light_count; i++) {
+  for (int i = 0; i < SPOT_LIGHT_CAP; i++) {
+    if (i >= spot_light_count)
+      break;
     result += light_spot(N, V, i);
   }
 
@@ -227,8 +238,10 @@ int main(int argc, char **argv) {
   glib::model_t backpack = glib::model_load(
       "/home/z1ko/develop/glexercises/data/models/backpack/backpack.obj");
 
-  glib::program_t program =
-      glib::program_create(shader_vertex, shader_fragment);
+  // Only one point and one spot light are used
+  glib::program_t program = glib::program_variant(
+      shader_vertex, shader_fragment,
+      {{"POINT_LIGHT_CAP", "1"}, {"SPOT_LIGHT_CAP", "1"}});
   glib::program_t program_light =
       glib::program_create(shader_vertex_light, shader_fragment_light);
 
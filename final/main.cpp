@@ -17,165 +17,27 @@
 #define GLIB_MODEL_IMPL
 #include <model.hpp>
 
-const int WIDTH = 1600;
-const int HEIGHT = 900;
+#define GLIB_PERMUTATION_IMPL
+#include <permutation.hpp>
 
-const char *shader_vertex_light = R"(
-#version 330 core
-layout (location = 0) in vec3 aPos;
+#define GLIB_PACING_IMPL
+#include <pacing.hpp>
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
-
-void main() {
-  gl_Position = proj * view * model * vec4(aPos, 1.0);
-}
-
-)";
+const int WIDTH = 1600;
+const int HEIGHT = 900;
 
-const char *shader_vertex = R"(
+#include "shaders.hpp"
 
+const char *shader_vertex_light = R"(
 #version 330 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec3 aTangent;
-layout (location = 3) in vec2 aUV;
-
-out vec2 uv;
-out vertex_output_tangent {
-  vec3 frag_pos;
-  vec3 camera_pos;
-  vec3 sun_dir;
-  vec3 light_pos;
-
-} tspace;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
 
-uniform vec3 camera_pos;
-uniform vec3 sun_dir;
-uniform vec3 light_pos;
-
 void main() {
   gl_Position = proj * view * model * vec4(aPos, 1.0);
-
-  // Calculate TBN matrix for Tangent Space
-  mat3 normalizer = transpose(inverse(mat3(model)));
-  vec3 T = normalize(vec3(normalizer * aTangent));
-  vec3 N = normalize(vec3(normalizer * aNormal));
-  T = normalize(T - dot(T, N) * N);
-  vec3 B = cross(N, T);
-
-  // We want to do the lighting calculation in T-Space, 
-  // so we need the inverse of the TBN. (orthonormal)
-  mat3 TBN = transpose(mat3(T, B, N));
-
-  // Send all relevant world data to the T-Space
-  tspace.frag_pos   = TBN * vec3(model * vec4(aPos, 1.0));
-  tspace.camera_pos = TBN * camera_pos;
-  tspace.sun_dir    = TBN * sun_dir;
-  tspace.light_pos  = TBN * light_pos;
-
-  uv = aUV;
-}
-
-)";
-const char *shader_fragment = R"(
-
-#version 330 core
-out vec4 FragColor;
-
-in vec2 uv;
-in vertex_output_tangent {
-  
-  vec3 frag_pos;
-  vec3 camera_pos;
-  vec3 sun_dir;
-  vec3 light_pos;
-
-} tspace;
-
-uniform sampler2D diffuse_map;
-uniform sampler2D specular_map;
-uniform sampler2D normal_map;
-uniform float shininess;
-
-// 1 - use torch
-uniform int torch = 1;
-
-vec3 light_dir(vec3 N, vec3 V, vec3 direction, vec3 color) {
-  
-  vec3 L = normalize(-direction);
-  vec3 R = reflect(-L, N);
-
-  float kD = max(dot(L, N), 0.0f);
-  float kS = pow(max(dot(V, R), 0.0f), shininess);
-
-  vec3 ambient  = color * 0.1f * texture(diffuse_map, uv).rgb;
-  vec3 diffuse  = color * kD   * texture(diffuse_map, uv).rgb;
-  vec3 specular = color * kS   * texture(specular_map, uv).rgb;
-
-  return ambient + diffuse + specular;
-}
-
-vec3 light_point(vec3 N, vec3 V, vec3 position, vec3 attenuation, vec3 color) {
-  
-  vec3 L = normalize(position - tspace.frag_pos);
-  vec3 R = reflect(-L, N);
-
-  float kD = max(dot(L, N), 0.0f);
-  float kS = pow(max(dot(V, R), 0.0f), shininess);
-
-  // Attenuazione
-  float distance = length(position - tspace.frag_pos);
-  float kFO = 1.0f / (attenuation.x + attenuation.y * distance 
-      + attenuation.z * distance * distance);
-
-  vec3 diffuse  = color * kFO * kD * texture(diffuse_map, uv).rgb;
-  vec3 specular = color * kFO * kS * texture(specular_map, uv).rgb;
-
-  return diffuse + specular;
-}
-
-vec3 light_spot(vec3 N, vec3 V, vec3 position, vec3 direction, vec2 cutoff, vec3 color) {
-
-  vec3 L = normalize(position - tspace.frag_pos);
-  vec3 R = reflect(-L, N);
-
-  float kD = max(dot(L, N), 0.0f);
-  float kS = pow(max(dot(V, R), 0.0f), shininess);
-
-  float inner = cos(radians(cutoff.x));
-  float outer = cos(radians(cutoff.y));
-
-  // Cutoff
-  float theta = dot(L, normalize(-direction));
-  float epsilon = inner - outer;
-  float kFO = clamp((theta - inner) / epsilon, 0.0f, 1.0f);
-
-  vec3 diffuse  = color * kFO * kD * texture(diffuse_map, uv).rgb;
-  vec3 specular = color * kFO * kS * texture(specular_map, uv).rgb;
-
-  return diffuse + specular;
-}
-
-// All lighting is in tangent space.
-void main() {
-  vec3 result = vec3(0.0f);
-
-  vec3 V = normalize(tspace.camera_pos - tspace.frag_pos);
-  vec3 N = texture(normal_map, uv).rgb;
-  N = normalize(N * 2.0 - 1.0);
-
-  // Calculate contribution of all lights
-  result += light_dir(N, V, tspace.sun_dir, vec3(0.15f, 0.5f, 0.15f));
-  result += light_point(N, V, tspace.light_pos, vec3(1.0f, 0.01f, 0.032f), vec3(1.0f, 0.3f, 0.3f));
-  result += light_spot(N, V, tspace.camera_pos, -tspace.camera_pos, vec2(6.5f, 8.5f), vec3(0.3f, 0.3f, 1.0f) * torch);
-
-  FragColor = vec4(result, 1.0f);
 }
 
 )";
@@ -199,7 +61,7 @@ bool firstMouse = true;
 
 int main(int argc, char **argv) {
 
-  GLFWwindow *window = glib::initialize(WIDTH, HEIGHT, "Window!");
+  GLFWwindow *window = glib::initialize(WIDTH, HEIGHT, "Window!", argc, argv);
   if (window == NULL) {
     return -1;
   }
@@ -215,8 +77,11 @@ int main(int argc, char **argv) {
   glib::model_t backpack =
       glib::model_load("../../data/models/backpack/backpack.obj");
 
-  glib::program_t program =
-      glib::program_create(shader_vertex, shader_fragment);
+  // Torch is compiled in or out instead of branching per pixel
+  glib::program_t program_torch =
+      glib::program_variant(shader_vertex, shader_fragment, {{"TORCH", "1"}});
+  glib::program_t program_no_torch =
+      glib::program_variant(shader_vertex, shader_fragment, {{"TORCH", "0"}});
   glib::program_t program_light =
       glib::program_create(shader_vertex_light, shader_fragment_light);
 
@@ -227,15 +92,13 @@ int main(int argc, char **argv) {
   glm::vec3 sun_pos = glm::vec3(10.0f, 10.0f, 10.0f);
   glm::vec3 sun_dir = glm::normalize(-sun_pos);
 
-  float deltaTime = 0.0f;
-  float lastFrame = 0.0f;
+  // Input sampled after the wait reaches the screen within a few frames,
+  // GLIB_FRAMES_IN_FLIGHT sets how many
+  glib::frame_pacer_t pacer = glib::pacing_create();
 
   glEnable(GL_DEPTH_TEST);
-  while (!glfwWindowShouldClose(window)) {
-
-    float currentTime = glfwGetTime();
-    deltaTime = currentTime - lastFrame;
-    lastFrame = currentTime;
+  while (glib::window_running(window)) {
+    glib::pacing_begin(pacer);
 
     glib::input_handle_standard(window);
 
@@ -244,8 +107,8 @@ int main(int argc, char **argv) {
     if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && !t_pressed) {
       t_pressed = true;
       torch = !torch;
-      glib::program_uniform_1i(program, "torch", torch);
     }
+    glib::program_t program = torch ? program_torch : program_no_torch;
 
     if (glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE)
       t_pressed = false;
@@ -280,7 +143,6 @@ int main(int argc, char **argv) {
     glib::program_uniform_1i(program, "diffuse_map", 0);  // sampler
     glib::program_uniform_1i(program, "specular_map", 1); // sampler
     glib::program_uniform_1i(program, "normal_map", 2);   // sampler
-    glib::program_uniform_1f(program, "shininess", 64.0f);
 
     // Set sunlight properties
     glib::program_uniform_3f(program, "sun_dir", sun_dir.x, sun_dir.y,
@@ -309,11 +171,18 @@ int main(int argc, char **argv) {
       glib::render(cube, program_light);
     }
 
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+    glib::window_present(window);
+    glib::pacing_end(pacer);
   }
+  glib::pacing_destroy(pacer);
+
+  glib::buffer_destroy(cube);
+  glib::model_destroy(backpack);
+  glib::model_textures_release();
+  glib::program_destroy(program_light);
+  glib::program_variant_clear();
 
-  glfwTerminate();
+  glib::terminate();
   return 0;
 }
 
@@ -0,0 +1,158 @@
+#pragma once
+
+// Shaders of the forward renderer, shared with the benchmark scenes
+
+const char *shader_vertex = R"(
+
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec3 aTangent;
+layout (location = 3) in vec2 aUV;
+
+out vec2 uv;
+out vertex_output_tangent {
+  vec3 frag_pos;
+  vec3 camera_pos;
+  vec3 sun_dir;
+  vec3 light_pos;
+
+} tspace;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+
+uniform vec3 camera_pos;
+uniform vec3 sun_dir;
+uniform vec3 light_pos;
+
+void main() {
+  gl_Position = proj * view * model * vec4(aPos, 1.0);
+
+  // Calculate TBN matrix for Tangent Space
+  mat3 normalizer = transpose(inverse(mat3(model)));
+  vec3 T = normalize(vec3(normalizer * aTangent));
+  vec3 N = normalize(vec3(normalizer * aNormal));
+  T = normalize(T - dot(T, N) * N);
+  vec3 B = cross(N, T);
+
+  // We want to do the lighting calculation in T-Space, 
+  // so we need the inverse of the TBN. (orthonormal)
+  mat3 TBN = transpose(mat3(T, B, N));
+
+  // Send all relevant world data to the T-Space
+  tspace.frag_pos   = TBN * vec3(model * vec4(aPos, 1.0));
+  tspace.camera_pos = TBN * camera_pos;
+  tspace.sun_dir    = TBN * sun_dir;
+  tspace.light_pos  = TBN * light_pos;
+
+  uv = aUV;
+}
+
+)";
+
+const char *shader_fragment = R"(
+
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+in vertex_output_tangent {
+  
+  vec3 frag_pos;
+  vec3 camera_pos;
+  vec3 sun_dir;
+  vec3 light_pos;
+
+} tspace;
+
+uniform sampler2D diffuse_map;
+uniform sampler2D specular_map;
+uniform sampler2D normal_map;
+
+#ifndef SHININESS
+#define SHININESS 64.0f
+#endif
+
+// 1 - use torch
+#ifndef TORCH
+#define TORCH 1
+#endif
+
+vec3 light_dir(vec3 N, vec3 V, vec3 direction, vec3 color) {
+  
+  vec3 L = normalize(-direction);
+  vec3 R = reflect(-L, N);
+
+  float kD = max(dot(L, N), 0.0f);
+  float kS = pow(max(dot(V, R), 0.0f), SHININESS);
+
+  vec3 ambient  = color * 0.1f * texture(diffuse_map, uv).rgb;
+  vec3 diffuse  = color * kD   * texture(diffuse_map, uv).rgb;
+  vec3 specular = color * kS   * texture(specular_map, uv).r;
+
+  return ambient + diffuse + specular;
+}
+
+vec3 light_point(vec3 N, vec3 V, vec3 position, vec3 attenuation, vec3 color) {
+  
+  vec3 L = normalize(position - tspace.frag_pos);
+  vec3 R = reflect(-L, N);
+
+  float kD = max(dot(L, N), 0.0f);
+  float kS = pow(max(dot(V, R), 0.0f), SHININESS);
+
+  // Attenuazione
+  float distance = length(position - tspace.frag_pos);
+  float kFO = 1.0f / (attenuation.x + attenuation.y * distance 
+      + attenuation.z * distance * distance);
+
+  vec3 diffuse  = color * kFO * kD * texture(diffuse_map, uv).rgb;
+  vec3 specular = color * kFO * kS * texture(specular_map, uv).r;
+
+  return diffuse + specular;
+}
+
+vec3 light_spot(vec3 N, vec3 V, vec3 position, vec3 direction, vec2 cutoff, vec3 color) {
+
+  vec3 L = normalize(position - tspace.frag_pos);
+  vec3 R = reflect(-L, N);
+
+  float kD = max(dot(L, N), 0.0f);
+  float kS = pow(max(dot(V, R), 0.0f), SHININESS);
+
+  float inner = cos(radians(cutoff.x));
+  float outer = cos(radians(cutoff.y));
+
+  // Cutoff
+  float theta = dot(L, normalize(-direction));
+  float epsilon = inner - outer;
+  float kFO = clamp((theta - inner) / epsilon, 0.0f, 1.0f);
+
+  vec3 diffuse  = color * kFO * kD * texture(diffuse_map, uv).rgb;
+  vec3 specular = color * kFO * kS * texture(specular_map, uv).r;
+
+  return diffuse + specular;
+}
+
+// All lighting is in tangent space.
+void main() {
+  vec3 result = vec3(0.0f);
+
+  vec3 V = normalize(tspace.camera_pos - tspace.frag_pos);
+  // Z is rebuilt for two channel maps
+  vec2 XY = texture(normal_map, uv).xy * 2.0 - 1.0;
+  vec3 N = normalize(vec3(XY, sqrt(max(1.0 - dot(XY, XY), 0.0))));
+
+  // Calculate contribution of all lights
+  result += light_dir(N, V, tspace.sun_dir, vec3(0.15f, 0.5f, 0.15f));
+  result += light_point(N, V, tspace.light_pos, vec3(1.0f, 0.01f, 0.032f), vec3(1.0f, 0.3f, 0.3f));
+#if TORCH
+  result += light_spot(N, V, tspace.camera_pos, -tspace.camera_pos, vec2(6.5f, 8.5f), vec3(0.3f, 0.3f, 1.0f));
+#endif
+
+  FragColor = vec4(result, 1.0f);
+}
+
+)";
@@ -0,0 +1,314 @@
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#define GLIB_INIT_IMPL
+#include <initialization.hpp>
+
+#define GLIB_INPUT_IMPL
+#include <input.hpp>
+
+#define GLIB_GRAPHICS_IMPL
+#include <graphics.hpp>
+
+#define GLIB_TRANSFORM_IMPL
+#include <transform.hpp>
+
+#define GLIB_MODEL_IMPL
+#include <model.hpp>
+
+#define GLIB_PERMUTATION_IMPL
+#include <permutation.hpp>
+
+#define GLIB_PACING_IMPL
+#include <pacing.hpp>
+
+#define GLIB_FORWARD_IMPL
+#include <forward.hpp>
+
+const int WIDTH = 1600;
+const int HEIGHT = 900;
+const int POINT_LIGHT_COUNT = 512;
+const int SPOT_LIGHT_COUNT = 8;
+const int TILE_SIZE = 16;
+
+// Depth only, used by the pre-pass
+const char *shader_depth_vs = R"(
+#version 330 core
+layout (location = 0) in vec3 a_position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+
+invariant gl_Position;
+
+void main() {
+  gl_Position = proj * view * model * vec4(a_position, 1.0);
+}
+)";
+
+const char *shader_depth_fs = R"(
+#version 330 core
+void main() {}
+)";
+
+const char *shader_forward_vs = R"(
+#version 330 core
+
+layout (location = 0) in vec3 a_position;
+layout (location = 1) in vec3 a_normal;
+layout (location = 2) in vec3 a_tangent;
+layout (location = 3) in vec2 a_uv;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+
+invariant gl_Position;
+
+out mat3 TBN;
+out vec3 frag_pos;
+out vec2 uv;
+
+void main() {
+  gl_Position = proj * view * model * vec4(a_position, 1.0);
+
+  // Calculate TBN matrix for tangent space
+  mat3 nmodel = transpose(inverse(mat3(model)));
+  vec3 T = normalize(nmodel * a_tangent);
+  vec3 N = normalize(nmodel * a_normal);
+  T = normalize(T - dot(T, N) * N);
+  vec3 B = cross(N, T);
+
+  TBN = mat3(T, B, N);
+  frag_pos = vec3(model * vec4(a_position, 1.0));
+  uv = a_uv;
+}
+)";
+
+const char *shader_forward_fs = R"(
+#version 330 core
+out vec4 FragColor;
+
+in mat3 TBN;
+in vec3 frag_pos;
+in vec2 uv;
+
+uniform struct {
+  sampler2D diffuse;
+  sampler2D specular;
+  sampler2D normal;
+} material;
+
+uniform vec3 camera_pos;
+
+#ifndef SHININESS
+#define SHININESS 64.0f
+#endif
+
+#define AMBIENT 0.1f
+void main() {
+
+  // Get normal in world-space, Z is rebuilt for two channel maps
+  vec2 XY = texture(material.normal, uv).xy * 2.0 - 1.0;
+  vec3 N = vec3(XY, sqrt(max(1.0 - dot(XY, XY), 0.0)));
+  N = normalize(TBN * normalize(N));
+  vec3 V = normalize(camera_pos - frag_pos);
+
+  vec3 color = texture(material.diffuse, uv).rgb;
+  float spec = texture(material.specular, uv).r;
+
+  // Only the lights touching this tile
+  vec3 result = color * AMBIENT;
+  uvec2 tile = forward_tile();
+  for (uint i = tile.x; i < tile.x + tile.y; ++i) {
+    grid_light_t light = forward_light(i);
+
+    vec3 L = normalize(light.position - frag_pos);
+    vec3 R = reflect(-L, N);
+
+    float kD = max(dot(L, N), 0.0f);
+    float kS = pow(max(dot(R, V), 0.0f), SHININESS);
+    float kA = forward_attenuation(light, frag_pos, L);
+
+    result += (color * kD + spec * kS) * kA * light.color;
+  }
+
+  FragColor = vec4(result, 1.0f);
+}
+)";
+
+void framebuffer_size_callback(GLFWwindow *window, int width, int height);
+void generate_lights(std::vector<glib::light_t> &lights);
+
+glib::camera_t camera = glib::camera_base(glm::vec3(0.0f, 0.0f, 3.0f));
+
+// Framebuffer size, the light grid is rebuilt when it changes
+int framebuffer_width = WIDTH;
+int framebuffer_height = HEIGHT;
+
+int main(int argc, char **argv) {
+  GLFWwindow *window = glib::initialize(WIDTH, HEIGHT, "Window!", argc, argv);
+  if (window == NULL) {
+    return -1;
+  }
+  glViewport(0, 0, WIDTH, HEIGHT);
+
+  glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
+  glib::program_t program_depth =
+      glib::program_create(shader_depth_vs, shader_depth_fs);
+
+  std::string forward_fs =
+      glib::shader_insert(shader_forward_fs, glib::shader_forward_plus);
+  glib::program_t program_forward =
+      glib::program_variant(shader_forward_vs, forward_fs.c_str(), {});
+
+  // Set attached texture slot to samplers
+  glib::program_uniform_1i(program_forward, "material.diffuse", 0);
+  glib::program_uniform_1i(program_forward, "material.specular", 1);
+  glib::program_uniform_1i(program_forward, "material.normal", 2);
+
+  // Load model of backpack
+  glib::model_t backpack =
+      glib::model_load("../../data/models/backpack/backpack.obj");
+  std::vector<glm::vec3> positions;
+  for (int z = -1; z <= 1; ++z)
+    for (int x = -1; x <= 1; ++x)
+      positions.push_back(glm::vec3(x * 3.0f, -0.5f, z * 3.0f));
+
+  const float FOV = 45.0f;
+  const float ORBIT_DISTANCE = 10.0f;
+
+  // Per tile light lists
+  glib::light_grid_t grid =
+      glib::light_grid_create(WIDTH, HEIGHT, TILE_SIZE,
+                              POINT_LIGHT_COUNT + SPOT_LIGHT_COUNT);
+
+  std::vector<glib::light_t> lights;
+  generate_lights(lights);
+
+  // Input sampled after the wait reaches the screen within a few frames,
+  // GLIB_FRAMES_IN_FLIGHT sets how many
+  glib::frame_pacer_t pacer = glib::pacing_create();
+
+  glEnable(GL_DEPTH_TEST);
+  while (glib::window_running(window)) {
+    glib::pacing_begin(pacer);
+
+    glib::input_handle_standard(window);
+
+    // Tiles follow the framebuffer, nothing to rebuild while minimised
+    if ((framebuffer_width != grid.width ||
+         framebuffer_height != grid.height) &&
+        framebuffer_width > 0 && framebuffer_height > 0) {
+      glib::light_grid_destroy(grid);
+      grid = glib::light_grid_create(framebuffer_width, framebuffer_height,
+                                     TILE_SIZE,
+                                     POINT_LIGHT_COUNT + SPOT_LIGHT_COUNT);
+    }
+
+    // Orbit camera around the scene
+    float time = glfwGetTime();
+    camera.position.x = sinf(time * 0.2f) * ORBIT_DISTANCE;
+    camera.position.y = 3.0f;
+    camera.position.z = cosf(time * 0.2f) * ORBIT_DISTANCE;
+    glib::camera_look_at(camera, glm::vec3(0.0f));
+
+    glm::mat4 view = glib::camera_view(camera);
+    float aspect_ratio = (float)grid.width / grid.height;
+    glm::mat4 proj =
+        glm::perspective(glm::radians(FOV), aspect_ratio, 0.1f, 100.0f);
+
+    glib::program_uniform_mf(program_depth, "view", glm::value_ptr(view));
+    glib::program_uniform_mf(program_depth, "proj", glm::value_ptr(proj));
+    glib::program_uniform_mf(program_forward, "view", glm::value_ptr(view));
+    glib::program_uniform_mf(program_forward, "proj", glm::value_ptr(proj));
+    glib::program_uniform_3f(program_forward, "camera_pos", camera.position.x,
+                             camera.position.y, camera.position.z);
+
+    // Point lights spin around the vertical axis
+    for (int i = 0; i < POINT_LIGHT_COUNT; ++i) {
+      glib::light_t &light = lights[i];
+      float angle = 0.01f * (1.0f + (i % 7) * 0.25f);
+      glm::mat4 spin = glm::rotate(glm::mat4(1.0f), angle, glib::UP);
+      light.position = glm::vec3(spin * glm::vec4(light.position, 1.0f));
+    }
+
+    // Bin the lights in screen tiles
+    glib::light_grid_cull(grid, lights, view, proj);
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Depth pre-pass, shading then runs once per visible pixel
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    for (glm::vec3 &position : positions) {
+      glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+      glib::program_uniform_mf(program_depth, "model", glm::value_ptr(model));
+      glib::model_render(backpack, program_depth);
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // Shading pass
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    {
+      glib::light_grid_bind(grid, program_forward, 3);
+      for (glm::vec3 &position : positions) {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+        glib::program_uniform_mf(program_forward, "model",
+                                 glm::value_ptr(model));
+        glib::model_render(backpack, program_forward);
+      }
+    }
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+
+    glib::window_present(window);
+    glib::pacing_end(pacer);
+  }
+  glib::pacing_destroy(pacer);
+  glib::light_grid_destroy(grid);
+  glib::model_destroy(backpack);
+  glib::model_textures_release();
+  glib::program_destroy(program_depth);
+  glib::program_variant_clear();
+
+  glib::terminate();
+  return 0;
+}
+
+void generate_lights(std::vector<glib::light_t> &lights) {
+
+  srand(time(0));
+  lights.clear();
+  for (int i = 0; i < POINT_LIGHT_COUNT; ++i) {
+    float xPos = static_cast<float>(((rand() % 100) / 100.0) * 9.0 - 4.5);
+    float yPos = static_cast<float>(((rand() % 100) / 100.0) * 3.0 - 1.5);
+    float zPos = static_cast<float>(((rand() % 100) / 100.0) * 9.0 - 4.5);
+    float rColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5);
+    float gColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5);
+    float bColor = static_cast<float>(((rand() % 100) / 200.0f) + 0.5);
+    float radius = static_cast<float>(((rand() % 100) / 100.0) + 1.0);
+    lights.push_back(glib::light_point(glm::vec3(xPos, yPos, zPos),
+                                       glm::vec3(rColor, gColor, bColor),
+                                       radius));
+  }
+
+  // Spots looking down at each row of backpacks
+  for (int i = 0; i < SPOT_LIGHT_COUNT; ++i) {
+    float angle = glm::radians(360.0f / SPOT_LIGHT_COUNT * i);
+    glm::vec3 position(sinf(angle) * 4.0f, 4.0f, cosf(angle) * 4.0f);
+    lights.push_back(glib::light_spot(position, -position,
+                                      glm::vec3(4.0f, 4.0f, 3.0f), 10.0f,
+                                      12.5f, 17.5f));
+  }
+}
+
+void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
+  glViewport(0, 0, width, height);
+  framebuffer_width = width;
+  framebuffer_height = height;
+}
@@ -16,9 +16,9 @@ uniform struct {
 
 void main() {
   
-  // Get normal in world-space
-  vec3 N = texture(material.normal, uv).xyz;
-  N = normalize(N * 2.0 - 1.0);
+  // Get normal in world-space, Z is rebuilt for two channel maps
+  vec2 XY = texture(material.normal, uv).xy * 2.0 - 1.0;
+  vec3 N = normalize(vec3(XY, sqrt(max(1.0 - dot(XY, XY), 0.0))));
   N = TBN * N;
 
   g_position = frag_pos;
@@ -1,5 +1,6 @@
 #include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 
 #define GLIB_INIT_IMPL
@@ -20,157 +21,35 @@
 #define GLIB_GBUFFER_IMPL
 #include <gbuffer.hpp>
 
-const int WIDTH = 1600;
-const int HEIGHT = 900;
-const int LIGHT_COUNT = 128;
-
-const char *shader_geometry_fs = R"(
-#version 330 core
-
-layout (location = 0) out vec3 g_position;
-layout (location = 1) out vec3 g_normal;
-layout (location = 2) out vec4 g_color_spec;
-
-//out vec4 FragCol;
-
-in mat3 TBN;
-in vec3 frag_pos;
-in vec2 uv;
-
-uniform struct {
-  sampler2D diffuse;
-  sampler2D specular;
-  sampler2D normal;
-} material;
-
-#define COMPONENT 3
-
-void main() {
-  
-  // Get normal in world-space
-  vec3 N = texture(material.normal, uv).xyz;
-  N = normalize(N * 2.0 - 1.0);
-  N = TBN * N;
-
-#if COMPONENT == 0
-  g_position = frag_pos;
-#elif COMPONENT == 1
-  g_position = N;
-#elif COMPONENT == 2
-  g_position = texture(material.diffuse, uv).rgb;
-#else
-  g_position = vec3(texture(material.specular, uv).r);
-#endif
-
-  g_normal = N;
-  g_color_spec = vec4(texture(material.diffuse, uv).rgb, 
-    texture(material.specular, uv).r);
-}
-)";
-
-const char *shader_geometry_vs = R"(
-#version 330 core
-
-layout (location = 0) in vec3 a_position;
-layout (location = 1) in vec3 a_normal;
-layout (location = 2) in vec3 a_tangent;
-layout (location = 3) in vec2 a_uv;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
-
-out mat3 TBN;
-out vec3 frag_pos;
-out vec2 uv;
-
-void main() {
-  gl_Position = proj * view * model * vec4(a_position, 1.0);
-
-  // Calculate TBN matrix for tangent space
-  mat3 nmodel = transpose(inverse(mat3(model)));
-  vec3 T = normalize(nmodel * a_tangent);
-  vec3 N = normalize(nmodel * a_normal);
-  T = normalize(T - cross(T, N) * N);
-  vec3 B = cross(N, T);
-
-  TBN = mat3(T, B, N);
-  frag_pos = vec3(model * vec4(a_position, 1.0));
-  uv = a_uv;
-}
-)";
-
-const char *shader_lighting_fs = R"(
-#version 330 core
-out vec4 FragCol;
-
-in vec2 uv;
+#define GLIB_TEMPORAL_IMPL
+#include <temporal.hpp>
 
-// Output of geometry pass
-uniform struct {
-  sampler2D position;
-  sampler2D normal;
-  sampler2D color_spec;
-} gbuffer;
-
-struct light_point_t {
-  vec3 position;
-  vec3 color;
-  vec3 attenuation;
-}; 
-
-#define LIGHT_CAPACITY 128
-uniform light_point_t lights[LIGHT_CAPACITY];
-uniform vec3 camera_pos;
-
-#define AMBIENT 0.1f
-void main() {
- 
-  vec3 P = texture(gbuffer.position,   uv).rgb;
-  vec3 N = texture(gbuffer.normal,     uv).rgb;
-  vec4 C = texture(gbuffer.color_spec, uv);
+#define GLIB_PERMUTATION_IMPL
+#include <permutation.hpp>
 
-  vec3 color = C.rgb;
-  float spec = C.a;
+#define GLIB_PACING_IMPL
+#include <pacing.hpp>
 
-  vec3 V = normalize(camera_pos - P);
+#define GLIB_GPU_TIMER_IMPL
+#include <gpu_timer.hpp>
 
-  vec3 result = color * AMBIENT;
-  for (int i = 0; i < LIGHT_CAPACITY; ++i) {
-    light_point_t light = lights[i];
+#define GLIB_DYNAMIC_IMPL
+#include <dynamic.hpp>
 
-    vec3 L = normalize(light.position - P);
-    vec3 R = reflect(-L, N);
+#define GLIB_IMAGE_IMPL
+#include <image.hpp>
 
-    float kD = max(dot(L, N), 0.0f);
-    float kS = pow(max(dot(R, V), 0.0f), 64.0f);
+#define GLIB_CAPTURE_IMPL
+#include <capture.hpp>
 
-    // Attenuation
-    float distance = length(light.position - P);
-    float kA = 1.0 / (light.attenuation.x + light.attenuation.y * distance 
-      + light.attenuation.z * distance * distance);
-
-    result += color * kD * kA * light.color;
-    //result += spec  * kS * kA * light.color;
-  }
-  
-  FragCol = vec4(result, 1.0f);
-}
-)";
-
-const char *shader_lighting_vs = R"(
-#version 330 core
-
-layout (location = 0) in vec3 a_position;
-layout (location = 1) in vec2 a_uv;
+const int WIDTH = 1600;
+const int HEIGHT = 900;
+const int LIGHT_COUNT = 128;
 
-out vec2 uv;
+// Lighting is recomputed for one pixel out of TEMPORAL_RATE each frame
+const int TEMPORAL_RATE = 4;
 
-void main() {
-  gl_Position = vec4(a_position, 1.0);
-  uv = a_uv;
-}
-)";
+#include "shaders.hpp"
 
 const char *shader_vertex_light = R"(
 #version 330 core
@@ -205,7 +84,7 @@ struct light_t {
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
-void generate_lights(std::vector<light_t> &lights);
+void generate_lights(std::vector<light_t> &lights, int count);
 
 glib::camera_t camera = glib::camera_base(glm::vec3(0.0f, 0.0f, 3.0f));
 float lastX = WIDTH / 2.0f;
@@ -213,7 +92,7 @@ float lastY = HEIGHT / 2.0f;
 bool firstMouse = true;
 
 int main(int argc, char **argv) {
-  GLFWwindow *window = glib::initialize(WIDTH, HEIGHT, "Window!");
+  GLFWwindow *window = glib::initialize(WIDTH, HEIGHT, "Window!", argc, argv);
   if (window == NULL) {
     return -1;
   }
@@ -221,11 +100,29 @@ int main(int argc, char **argv) {
 
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
+  // Number of lights with --lights, bounded by the uniform block size
+  int light_count = LIGHT_COUNT;
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], "--lights") == 0)
+      light_count = atoi(argv[i + 1]);
+  int block_size = 0;
+  glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &block_size);
+  int capacity = block_size / sizeof(shader_light_point_t);
+  if (light_count < 1 || light_count > capacity) {
+    light_count = light_count < 1 ? 1 : capacity;
+    printf("clamping lights to %d\n", light_count);
+  }
+
   // Programs for deferred rendering
   glib::program_t program_geometry =
       glib::program_create(shader_geometry_vs, shader_geometry_fs);
-  glib::program_t program_lighting =
-      glib::program_create(shader_lighting_vs, shader_lighting_fs);
+
+  // Light loop is specialised to the exact number of lights
+  std::string lighting_fs =
+      glib::shader_insert(shader_lighting_fs, glib::shader_temporal);
+  glib::program_t program_lighting = glib::program_variant(
+      shader_lighting_vs, lighting_fs.c_str(),
+      {{"LIGHT_CAPACITY", std::to_string(light_count)}});
 
   std::vector<float> cube_vertices = glib::mesh_cube();
   glib::buffer_t cube =
@@ -242,10 +139,14 @@ int main(int argc, char **argv) {
   glib::program_uniform_1i(program_lighting, "gbuffer.position", 0);
   glib::program_uniform_1i(program_lighting, "gbuffer.normal", 1);
   glib::program_uniform_1i(program_lighting, "gbuffer.color_spec", 2);
-
-  // Load model of backpack
-  glib::model_t backpack =
-      glib::model_load("../../data/models/backpack/backpack.obj");
+  glib::program_uniform_block(program_lighting, "lights_block",
+                              LIGHTS_BINDING);
+
+  // Load model of backpack, its textures start coarse and their finer levels
+  // stream in as the camera comes closer
+  glib::stream_t streamer = glib::stream_create();
+  glib::model_t backpack = glib::model_load(
+      "../../data/models/backpack/backpack.obj", NULL, &streamer);
   std::vector<glm::vec3> positions;
   positions.push_back(glm::vec3(-3.0, -0.5, -3.0));
   positions.push_back(glm::vec3(0.0, -0.5, -3.0));
@@ -269,14 +170,42 @@ int main(int argc, char **argv) {
   float lastFrame = 0.0;
 
   // Where to store the output of the geometry pass
-  glib::gbuffer_t gbuffer = glib::gbuffer_create(WIDTH, HEIGHT);
+  glib::gbuffer_t gbuffer = glib::gbuffer_create(WIDTH, HEIGHT, true);
+
+  // Lighting accumulated over multiple frames
+  glib::temporal_t temporal =
+      glib::temporal_create(WIDTH, HEIGHT, TEMPORAL_RATE);
+
+  // GPU time of each pass, printed every few seconds
+  glib::gpu_timer_t timer = glib::gpu_timer_create();
+  unsigned long frame = 0;
+
+  // Per frame data, written without driver copies
+  glib::dynamic_ring_t ring =
+      glib::dynamic_ring_create(light_count * sizeof(shader_light_point_t));
 
   // All lights of the scene
   std::vector<light_t> lights;
-  generate_lights(lights);
+  generate_lights(lights, light_count);
+
+  // Record the frames with --capture out.y4m, out.raw or a PNG directory
+  glib::capture_t capture = {};
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], "--capture") == 0)
+      capture = glib::capture_create(argv[i + 1], WIDTH, HEIGHT);
+  unsigned int capture_attachment =
+      glib::framebuffer_default ? GL_COLOR_ATTACHMENT0 : GL_BACK;
+
+  // Input sampled after the wait reaches the screen within a few frames,
+  // GLIB_FRAMES_IN_FLIGHT sets how many
+  glib::frame_pacer_t pacer = glib::pacing_create();
 
   glEnable(GL_DEPTH_TEST);
-  while (!glfwWindowShouldClose(window)) {
+  while (glib::window_running(window)) {
+    glib::pacing_begin(pacer);
+    glib::gpu_timer_frame(timer);
+    glib::dynamic_ring_begin(ring);
+    glib::stream_update(streamer);
 
     // Regenerate lights
     static bool pressed = false;
@@ -284,7 +213,7 @@ int main(int argc, char **argv) {
     case GLFW_PRESS:
       if (!pressed) {
         pressed = true;
-        generate_lights(lights);
+        generate_lights(lights, light_count);
       }
       break;
     case GLFW_RELEASE:
@@ -311,14 +240,24 @@ int main(int argc, char **argv) {
     glib::program_uniform_mf(program_geometry, "proj", glm::value_ptr(proj));
     glib::program_uniform_mf(program_light, "proj", glm::value_ptr(proj));
 
+    // Camera of the previous frame for motion vectors
+    glib::temporal_begin(temporal, proj * view);
+    glib::program_uniform_mf(program_geometry, "prev_view_proj",
+                             glm::value_ptr(temporal.prev_view_proj));
+
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Render all backpacks in gbuffer
     gbuffer_bind(gbuffer);
     {
+      GLIB_GPU_ZONE(timer, "geometry");
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+      // Zero depth in the velocity marks pixels without geometry
+      const float no_motion[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      glClearBufferfv(GL_COLOR, 3, no_motion);
+
       glm::mat4 model;
       for (glm::vec3 &position : positions) {
 
@@ -326,58 +265,67 @@ int main(int argc, char **argv) {
         model = glm::translate(model, position);
         glib::program_uniform_mf(program_geometry, "model",
                                  glm::value_ptr(model));
+        // Backpacks are static
+        glib::program_uniform_mf(program_geometry, "prev_model",
+                                 glm::value_ptr(model));
         glib::model_render(backpack, program_geometry);
+        glib::model_stream(backpack, streamer, model, camera.position,
+                           HEIGHT / (2.0f * tanf(glm::radians(FOV) / 2.0f)));
       }
     }
     gbuffer_unbind();
 
-    // Lighting pass
+    // Lighting pass, written in the temporal history
+    temporal_bind(temporal);
     {
-      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      GLIB_GPU_ZONE(timer, "lighting");
 
       // Bind all gbuffer textures
       glib::texture_bind(gbuffer.position, 0);
       glib::texture_bind(gbuffer.normal, 1);
       glib::texture_bind(gbuffer.color, 2);
+      glib::temporal_uniforms(temporal, program_lighting, gbuffer.velocity, 3);
 
       glib::program_uniform_3f(program_lighting, "camera_pos",
                                camera.position.x, camera.position.y,
                                camera.position.z);
 
-      // Set al lights
-      char uniform[64];
-      int i = 0;
+      // Set all lights
+      glib::dynamic_range_t range = glib::dynamic_ring_alloc(
+          ring, light_count * sizeof(shader_light_point_t));
+      shader_light_point_t *block = (shader_light_point_t *)range.data;
       for (light_t &light : lights) {
-
-        snprintf(uniform, 64, "lights[%d].position", i);
-        glib::program_uniform_3f(program_lighting, uniform, light.position.x,
-                                 light.position.y, light.position.z);
-
-        snprintf(uniform, 64, "lights[%d].color", i);
-        glib::program_uniform_3f(program_lighting, uniform, light.color.x,
-                                 light.color.y, light.color.z);
-
-        snprintf(uniform, 64, "lights[%d].attenuation", i);
-        glib::program_uniform_3f(program_lighting, uniform, 1.0, 0.7, 1.8);
-        i += 1;
+        *block++ = {{light.position.x, light.position.y, light.position.z},
+                    {light.color.x, light.color.y, light.color.z},
+                    {1.0f, 0.7f, 1.8f}};
       }
+      glib::dynamic_ring_bind(ring, range, GL_UNIFORM_BUFFER, LIGHTS_BINDING);
 
       glib::render(screen, program_lighting, GL_TRIANGLE_STRIP);
     }
 
+    // Present the accumulated lighting
+    glib::gl_bind_framebuffer(GL_READ_FRAMEBUFFER,
+                              temporal.fbo[temporal.current]);
+    glib::gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, glib::framebuffer_default);
+    GLIB_GL(glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST));
+    framebuffer_default_bind();
+    glib::temporal_end(temporal);
+
 #if 1
     // Blit result of geometry pass into screen
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer.id);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT,
-                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glib::gl_bind_framebuffer(GL_READ_FRAMEBUFFER, gbuffer.id);
+    glib::gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, glib::framebuffer_default);
+    GLIB_GL(glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST));
+    framebuffer_default_bind();
 #else
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer.id);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT,
-                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glib::gl_bind_framebuffer(GL_READ_FRAMEBUFFER, gbuffer.id);
+    glib::gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, glib::framebuffer_default);
+    GLIB_GL(glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT,
+                              GL_DEPTH_BUFFER_BIT, GL_NEAREST));
+    framebuffer_default_bind();
 
     // Render point light
     {
@@ -395,18 +343,58 @@ int main(int argc, char **argv) {
     }
 
 #endif
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+
+    if (++frame % 240 == 0) {
+      const glib::gpu_pass_t *geometry =
+          glib::gpu_timer_pass(timer, "geometry");
+      const glib::gpu_pass_t *lighting =
+          glib::gpu_timer_pass(timer, "lighting");
+      if (geometry && lighting)
+        printf("gpu frame %.2fms geometry %.2fms (%lu vertices) lighting "
+               "%.2fms (%lu fragments)\n",
+               timer.frame_ms, geometry->ms, (unsigned long)geometry->vertices,
+               lighting->ms, (unsigned long)lighting->fragments);
+      printf("cpu wait %.2fms input to present %.2fms\n", pacer.wait_ms,
+             pacer.latency_ms);
+      printf("textures %zu KiB resident, %lu levels streamed %lu evicted\n",
+             streamer.resident / 1024, streamer.streamed, streamer.evicted);
+      printf("per frame data at most %zu of %zu bytes\n", ring.peak,
+             ring.slice_size);
+    }
+
+    if (capture.worker != NULL)
+      glib::capture_frame(capture, glib::framebuffer_default,
+                          capture_attachment);
+
+    glib::dynamic_ring_end(ring);
+    glib::window_present(window);
+    glib::pacing_end(pacer);
   }
-  glfwTerminate();
+  glib::pacing_destroy(pacer);
+  glib::gpu_timer_destroy(timer);
+  glib::stream_destroy(streamer);
+  glib::dynamic_ring_destroy(ring);
+  if (capture.worker != NULL)
+    glib::capture_destroy(capture);
+  glib::temporal_destroy(temporal);
+  glib::gbuffer_destroy(gbuffer);
+  glib::buffer_destroy(screen);
+  glib::buffer_destroy(cube);
+  glib::model_destroy(backpack);
+  glib::model_textures_release();
+  glib::program_destroy(program_light);
+  glib::program_destroy(program_geometry);
+  glib::program_variant_clear();
+
+  glib::terminate();
   return 0;
 }
 
-void generate_lights(std::vector<light_t> &lights) {
+void generate_lights(std::vector<light_t> &lights, int count) {
 
   srand(time(0));
   lights.clear();
-  for (int i = 0; i < LIGHT_COUNT; ++i) {
+  for (int i = 0; i < count; ++i) {
     float xPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
     float yPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 4.0);
     float zPos = static_cast<float>(((rand() % 100) / 100.0) * 6.0 - 3.0);
@@ -0,0 +1,190 @@
+#pragma once
+
+// Shaders of the deferred renderer, shared with the benchmark scenes
+
+// Uniform block binding of the lights of the lighting pass
+const unsigned int LIGHTS_BINDING = 0;
+
+// std140 layout of light_point_t, each vec3 takes 16 bytes
+struct shader_light_point_t {
+  float position[4];
+  float color[4];
+  float attenuation[4];
+};
+
+const char *shader_geometry_fs = R"(
+#version 330 core
+
+layout (location = 0) out vec3 g_position;
+layout (location = 1) out vec3 g_normal;
+layout (location = 2) out vec4 g_color_spec;
+layout (location = 3) out vec4 g_velocity;
+
+//out vec4 FragCol;
+
+in mat3 TBN;
+in vec3 frag_pos;
+in vec2 uv;
+in vec4 clip;
+in vec4 prev_clip;
+
+uniform struct {
+  sampler2D diffuse;
+  sampler2D specular;
+  sampler2D normal;
+} material;
+
+#ifndef COMPONENT
+#define COMPONENT 3
+#endif
+
+void main() {
+  
+  // Get normal in world-space, Z is rebuilt for two channel maps
+  vec2 XY = texture(material.normal, uv).xy * 2.0 - 1.0;
+  vec3 N = normalize(vec3(XY, sqrt(max(1.0 - dot(XY, XY), 0.0))));
+  N = TBN * N;
+
+#if COMPONENT == 0
+  g_position = frag_pos;
+#elif COMPONENT == 1
+  g_position = N;
+#elif COMPONENT == 2
+  g_position = texture(material.diffuse, uv).rgb;
+#else
+  g_position = vec3(texture(material.specular, uv).r);
+#endif
+
+  g_normal = N;
+  g_color_spec = vec4(texture(material.diffuse, uv).rgb, 
+    texture(material.specular, uv).r);
+
+  // Screen-space motion in uv units and view depth of both frames
+  vec2 motion = (clip.xy / clip.w - prev_clip.xy / prev_clip.w) * 0.5;
+  g_velocity = vec4(motion, prev_clip.w, clip.w);
+}
+)";
+
+const char *shader_geometry_vs = R"(
+#version 330 core
+
+layout (location = 0) in vec3 a_position;
+layout (location = 1) in vec3 a_normal;
+layout (location = 2) in vec3 a_tangent;
+layout (location = 3) in vec2 a_uv;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+
+// Transforms of the previous frame for motion vectors
+uniform mat4 prev_model;
+uniform mat4 prev_view_proj;
+
+out mat3 TBN;
+out vec3 frag_pos;
+out vec2 uv;
+out vec4 clip;
+out vec4 prev_clip;
+
+void main() {
+  gl_Position = proj * view * model * vec4(a_position, 1.0);
+  clip = gl_Position;
+  prev_clip = prev_view_proj * prev_model * vec4(a_position, 1.0);
+
+  // Calculate TBN matrix for tangent space
+  mat3 nmodel = transpose(inverse(mat3(model)));
+  vec3 T = normalize(nmodel * a_tangent);
+  vec3 N = normalize(nmodel * a_normal);
+  T = normalize(T - cross(T, N) * N);
+  vec3 B = cross(N, T);
+
+  TBN = mat3(T, B, N);
+  frag_pos = vec3(model * vec4(a_position, 1.0));
+  uv = a_uv;
+}
+)";
+
+const char *shader_lighting_fs = R"(
+#version 330 core
+out vec4 FragCol;
+
+in vec2 uv;
+
+// Output of geometry pass
+uniform struct {
+  sampler2D position;
+  sampler2D normal;
+  sampler2D color_spec;
+} gbuffer;
+
+struct light_point_t {
+  vec3 position;
+  vec3 color;
+  vec3 attenuation;
+}; 
+
+#ifndef LIGHT_CAPACITY
+#define LIGHT_CAPACITY 128
+#endif
+layout (std140) uniform lights_block {
+  light_point_t lights[LIGHT_CAPACITY];
+};
+uniform vec3 camera_pos;
+
+#define AMBIENT 0.1f
+void main() {
+
+  // Reuse last frame lighting outside of this frame subset
+  vec4 history;
+  bool valid = temporal_reproject(uv, history);
+  if (valid && !temporal_refresh(ivec2(gl_FragCoord.xy))) {
+    FragCol = temporal_resolve(uv, history.rgb, false, history);
+    return;
+  }
+ 
+  vec3 P = texture(gbuffer.position,   uv).rgb;
+  vec3 N = texture(gbuffer.normal,     uv).rgb;
+  vec4 C = texture(gbuffer.color_spec, uv);
+
+  vec3 color = C.rgb;
+  float spec = C.a;
+
+  vec3 V = normalize(camera_pos - P);
+
+  vec3 result = color * AMBIENT;
+  for (int i = 0; i < LIGHT_CAPACITY; ++i) {
+    light_point_t light = lights[i];
+
+    vec3 L = normalize(light.position - P);
+    vec3 R = reflect(-L, N);
+
+    float kD = max(dot(L, N), 0.0f);
+    float kS = pow(max(dot(R, V), 0.0f), 64.0f);
+
+    // Attenuation
+    float distance = length(light.position - P);
+    float kA = 1.0 / (light.attenuation.x + light.attenuation.y * distance 
+      + light.attenuation.z * distance * distance);
+
+    result += color * kD * kA * light.color;
+    //result += spec  * kS * kA * light.color;
+  }
+  
+  FragCol = temporal_resolve(uv, result, valid, history);
+}
+)";
+
+const char *shader_lighting_vs = R"(
+#version 330 core
+
+layout (location = 0) in vec3 a_position;
+layout (location = 1) in vec2 a_uv;
+
+out vec2 uv;
+
+void main() {
+  gl_Position = vec4(a_position, 1.0);
+  uv = a_uv;
+}
+)";
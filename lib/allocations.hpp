@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "profiler.hpp"
+#include "stats.hpp"
+
+// Heap allocations are counted only with GLIB_TRACK_ALLOCATIONS. The
+// implementation replaces the global operator new/delete. With
+// GLIB_TRACK_MALLOC it also interposes malloc, calloc and realloc on glibc,
+// which counts the allocations of the GL driver too.
+
+namespace glib {
+
+// Allocations attributed to a profiler zone or, outside zones, to the phase
+struct alloc_site_t {
+  const char *name;
+  unsigned long count;
+  unsigned long bytes;
+};
+
+// Count the allocations of the calling thread, the render thread usually.
+// Counts go to frame_stats.allocations and frame_stats.allocated_bytes.
+void alloc_track_thread();
+
+// Name of the frame phase used for allocations outside profiler zones
+void alloc_phase(const char *name);
+
+// Abort on the next tracked allocation, for a steady state render loop
+void alloc_expect_none(bool enabled);
+
+// Allocations by site since the last reset, most frequent first
+std::vector<alloc_site_t> alloc_sites();
+void alloc_sites_reset();
+
+#ifdef GLIB_ALLOC_IMPL
+#undef GLIB_ALLOC_IMPL
+
+#ifdef GLIB_TRACK_ALLOCATIONS
+} // namespace glib
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+
+namespace glib {
+
+// Sites are kept in a fixed table, the hooks must never allocate
+#define ALLOC_SITES_CAPACITY 128
+
+static alloc_site_t alloc_site_table[ALLOC_SITES_CAPACITY];
+static unsigned int alloc_site_count = 0;
+static bool alloc_abort = false;
+
+static thread_local bool alloc_tracked = false;
+static thread_local bool alloc_inside = false;
+static thread_local const char *alloc_phase_name = "untracked";
+
+static void alloc_record(size_t bytes) {
+  if (!alloc_tracked || alloc_inside)
+    return;
+  alloc_inside = true;
+
+  const char *zone = profile_zone_current();
+  const char *name = zone ? zone : alloc_phase_name;
+
+  frame_stats.allocations += 1;
+  frame_stats.allocated_bytes += bytes;
+
+  // Names are literals, compare pointers
+  unsigned int i = 0;
+  while (i < alloc_site_count && alloc_site_table[i].name != name)
+    ++i;
+  if (i == alloc_site_count && i < ALLOC_SITES_CAPACITY)
+    alloc_site_table[alloc_site_count++] = {name, 0, 0};
+  if (i < alloc_site_count) {
+    alloc_site_table[i].count += 1;
+    alloc_site_table[i].bytes += bytes;
+  }
+
+  if (alloc_abort) {
+    // No stdio, it may allocate
+    char message[256];
+    int length = snprintf(message, sizeof(message),
+                          "ERROR::ALLOC: %zu bytes allocated in %s\n", bytes,
+                          name);
+    write(2, message, length);
+#ifdef __GLIBC__
+    void *frames[32];
+    backtrace_symbols_fd(frames, backtrace(frames, 32), 2);
+#endif
+    abort();
+  }
+
+  alloc_inside = false;
+}
+
+void alloc_track_thread() { alloc_tracked = true; }
+void alloc_phase(const char *name) { alloc_phase_name = name; }
+void alloc_expect_none(bool enabled) { alloc_abort = enabled; }
+
+std::vector<alloc_site_t> alloc_sites() {
+  std::vector<alloc_site_t> result(alloc_site_table,
+                                   alloc_site_table + alloc_site_count);
+  std::sort(result.begin(), result.end(),
+            [](const alloc_site_t &a, const alloc_site_t &b) {
+              return a.count > b.count;
+            });
+  return result;
+}
+
+void alloc_sites_reset() { alloc_site_count = 0; }
+
+} // namespace glib
+
+#if defined(__GLIBC__) && defined(GLIB_TRACK_MALLOC)
+// Every allocation of the process, stb_image and the driver included
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void __libc_free(void *pointer);
+
+void *malloc(size_t size) {
+  glib::alloc_record(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  glib::alloc_record(count * size);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+  glib::alloc_record(size);
+  return __libc_realloc(pointer, size);
+}
+
+void free(void *pointer) { __libc_free(pointer); }
+}
+#define GLIB_ALLOC_MALLOC __libc_malloc
+#define GLIB_ALLOC_FREE __libc_free
+#else
+#define GLIB_ALLOC_MALLOC std::malloc
+#define GLIB_ALLOC_FREE std::free
+#endif
+
+// Counted here and not again by malloc
+void *operator new(size_t size) {
+  glib::alloc_record(size);
+  void *pointer = GLIB_ALLOC_MALLOC(size ? size : 1);
+  if (pointer == NULL)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *pointer) noexcept { GLIB_ALLOC_FREE(pointer); }
+void operator delete[](void *pointer) noexcept { GLIB_ALLOC_FREE(pointer); }
+void operator delete(void *pointer, size_t) noexcept {
+  GLIB_ALLOC_FREE(pointer);
+}
+void operator delete[](void *pointer, size_t) noexcept {
+  GLIB_ALLOC_FREE(pointer);
+}
+
+#undef GLIB_ALLOC_MALLOC
+#undef GLIB_ALLOC_FREE
+
+namespace glib {
+
+#else
+
+void alloc_track_thread() {}
+void alloc_phase(const char *) {}
+void alloc_expect_none(bool) {}
+std::vector<alloc_site_t> alloc_sites() { return {}; }
+void alloc_sites_reset() {}
+
+#endif
+#endif
+
+} // namespace glib
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Baked model files (.glbm) hold what model_load would build from an asset:
+// interleaved vertex streams in the layout of layout_3F3F3F2F, index buffers
+// of each level of detail, bounds and the texture paths of the materials.
+// Sections are aligned so the mapped file is handed to GL as is. Little
+// endian only, any change of the layout bumps BAKED_VERSION.
+
+namespace glib {
+
+#define BAKED_MAGIC 0x4d424c47 // "GLBM"
+#define BAKED_VERSION 1
+#define BAKED_ALIGNMENT 16
+#define BAKED_NONE 0xffffffffu // no string
+#define BAKED_TEXTURES 3       // albedo, specular, normal
+
+// Floats of a vertex of layout_3F3F3F2F
+#define BAKED_VERTEX_FLOATS 11
+
+struct baked_header_t {
+  uint32_t magic, version;
+  uint32_t mesh_count, lod_count;
+  uint64_t size;   // of the whole file
+  uint64_t hash;   // of everything after the header
+  uint64_t strings_offset;
+  uint32_t strings_size;
+  uint32_t flags;
+  float bounds_min[3], bounds_max[3];
+};
+
+struct baked_mesh_t {
+  uint64_t vertex_offset;
+  uint32_t vertex_count;
+  uint32_t lod_first, lod_count; // range of the LOD table, finest first
+  uint32_t textures[BAKED_TEXTURES]; // offsets in the strings
+  float bounds_min[3], bounds_max[3];
+};
+
+struct baked_lod_t {
+  uint64_t index_offset;
+  uint32_t index_count;
+  float error; // relative to the mesh extent, 0 for the source
+};
+
+static_assert(sizeof(baked_header_t) == 72, "baked header layout");
+static_assert(sizeof(baked_mesh_t) == 56, "baked mesh layout");
+static_assert(sizeof(baked_lod_t) == 16, "baked lod layout");
+
+// CPU side of a model, what the importer produces and the baker writes
+struct mesh_lod_data_t {
+  std::vector<uint32_t> indices;
+  float error;
+};
+
+struct mesh_data_t {
+  std::vector<float> vertices;       // layout_3F3F3F2F
+  std::vector<mesh_lod_data_t> lods; // finest first, at least one
+  float bounds_min[3], bounds_max[3];
+  std::string textures[BAKED_TEXTURES]; // relative paths, empty if none
+};
+
+struct model_data_t {
+  std::vector<mesh_data_t> meshes;
+};
+
+// A mapped baked file, the pointers stay valid until baked_close
+struct baked_file_t {
+  const unsigned char *data;
+  size_t size;
+  const baked_header_t *header;
+  const baked_mesh_t *meshes;
+  const baked_lod_t *lods;
+  const char *strings;
+};
+
+// True if the file starts with the baked magic
+bool baked_is(const char *path);
+
+// Map and validate a baked file, verify also checks the content hash
+bool baked_open(const char *path, baked_file_t &file, bool verify = false);
+void baked_close(baked_file_t &file);
+
+inline const float *baked_vertices(const baked_file_t &file,
+                                   const baked_mesh_t &mesh) {
+  return (const float *)(file.data + mesh.vertex_offset);
+}
+inline const uint32_t *baked_indices(const baked_file_t &file,
+                                     const baked_lod_t &lod) {
+  return (const uint32_t *)(file.data + lod.index_offset);
+}
+inline const char *baked_string(const baked_file_t &file, uint32_t offset) {
+  return offset == BAKED_NONE ? NULL : file.strings + offset;
+}
+
+// Compute the bounds of a mesh from its vertices
+void mesh_data_bounds(mesh_data_t &mesh);
+
+bool baked_write(const char *path, const model_data_t &model);
+
+// Unique path next to a file, written and renamed to it so readers never see
+// a partial file and concurrent writers do not collide
+std::string baked_temporary(const char *path);
+
+// FNV-1a, the hash of baked contents
+uint64_t baked_hash(const void *data, size_t size,
+                    uint64_t hash = 0xcbf29ce484222325ull);
+
+#ifdef GLIB_BAKED_IMPL
+#undef GLIB_BAKED_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace glib {
+
+uint64_t baked_hash(const void *data, size_t size, uint64_t hash) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string baked_temporary(const char *path) {
+  static std::atomic<unsigned int> serial{0};
+  return std::string(path) + "." + std::to_string(getpid()) + "-" +
+         std::to_string(serial++) + ".tmp";
+}
+
+bool baked_is(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+  uint32_t magic = 0;
+  size_t read = fread(&magic, sizeof(magic), 1, file);
+  fclose(file);
+  return read == 1 && magic == BAKED_MAGIC;
+}
+
+static bool baked_range(const baked_file_t &file, uint64_t offset,
+                        uint64_t bytes) {
+  return offset % 4 == 0 && offset <= file.size && bytes <= file.size - offset;
+}
+
+// Every offset inside the file, so a truncated or corrupt file is refused
+// instead of read out of bounds
+static bool baked_validate(const baked_file_t &file) {
+  const baked_header_t &header = *file.header;
+  if (header.magic != BAKED_MAGIC || header.version != BAKED_VERSION ||
+      header.size != file.size)
+    return false;
+
+  uint64_t tables = sizeof(baked_header_t) +
+                    (uint64_t)header.mesh_count * sizeof(baked_mesh_t) +
+                    (uint64_t)header.lod_count * sizeof(baked_lod_t);
+  if (tables > file.size ||
+      !baked_range(file, header.strings_offset, header.strings_size))
+    return false;
+  if (header.strings_size > 0 &&
+      file.strings[header.strings_size - 1] != '\0')
+    return false;
+
+  for (uint32_t i = 0; i < header.mesh_count; ++i) {
+    const baked_mesh_t &mesh = file.meshes[i];
+    uint64_t bytes =
+        (uint64_t)mesh.vertex_count * BAKED_VERTEX_FLOATS * sizeof(float);
+    if (!baked_range(file, mesh.vertex_offset, bytes) ||
+        mesh.lod_count == 0 || mesh.lod_first > header.lod_count ||
+        mesh.lod_count > header.lod_count - mesh.lod_first)
+      return false;
+    for (uint32_t t = 0; t < BAKED_TEXTURES; ++t)
+      if (mesh.textures[t] != BAKED_NONE &&
+          mesh.textures[t] >= header.strings_size)
+        return false;
+
+    for (uint32_t l = mesh.lod_first; l < mesh.lod_first + mesh.lod_count;
+         ++l) {
+      const baked_lod_t &lod = file.lods[l];
+      if (!baked_range(file, lod.index_offset,
+                       (uint64_t)lod.index_count * sizeof(uint32_t)))
+        return false;
+      // Contiguous, they share one element buffer
+      if (l > mesh.lod_first &&
+          lod.index_offset != file.lods[l - 1].index_offset +
+                                  file.lods[l - 1].index_count * 4ull)
+        return false;
+      // Indices in range, the driver would read past the vertices otherwise
+      const uint32_t *indices = baked_indices(file, lod);
+      for (uint32_t k = 0; k < lod.index_count; ++k)
+        if (indices[k] >= mesh.vertex_count)
+          return false;
+    }
+  }
+  return true;
+}
+
+bool baked_open(const char *path, baked_file_t &file, bool verify) {
+  file = {};
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("ERROR::BAKED: Unable to open %s\n", path);
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(baked_header_t)) {
+    printf("ERROR::BAKED: %s is not a baked model\n", path);
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("ERROR::BAKED: Unable to map %s\n", path);
+    return false;
+  }
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+  file.data = (const unsigned char *)data;
+  file.size = info.st_size;
+  file.header = (const baked_header_t *)file.data;
+  file.meshes = (const baked_mesh_t *)(file.header + 1);
+  file.lods = (const baked_lod_t *)(file.meshes + file.header->mesh_count);
+  file.strings = (const char *)(file.data + file.header->strings_offset);
+
+  // The tables are checked before being followed
+  bool valid = baked_validate(file);
+  if (valid && verify)
+    valid = baked_hash(file.data + sizeof(baked_header_t),
+                       file.size - sizeof(baked_header_t)) ==
+            file.header->hash;
+  if (!valid) {
+    printf("ERROR::BAKED: %s is corrupt or of another version\n", path);
+    baked_close(file);
+    return false;
+  }
+  return true;
+}
+
+void baked_close(baked_file_t &file) {
+  if (file.data != NULL)
+    munmap((void *)file.data, file.size);
+  file = {};
+}
+
+void mesh_data_bounds(mesh_data_t &mesh) {
+  for (int c = 0; c < 3; ++c) {
+    mesh.bounds_min[c] = FLT_MAX;
+    mesh.bounds_max[c] = -FLT_MAX;
+  }
+  for (size_t v = 0; v < mesh.vertices.size(); v += BAKED_VERTEX_FLOATS)
+    for (int c = 0; c < 3; ++c) {
+      mesh.bounds_min[c] = std::min(mesh.bounds_min[c], mesh.vertices[v + c]);
+      mesh.bounds_max[c] = std::max(mesh.bounds_max[c], mesh.vertices[v + c]);
+    }
+}
+
+static uint64_t baked_align(uint64_t offset) {
+  return (offset + BAKED_ALIGNMENT - 1) / BAKED_ALIGNMENT * BAKED_ALIGNMENT;
+}
+
+bool baked_write(const char *path, const model_data_t &model) {
+  std::vector<baked_mesh_t> meshes(model.meshes.size());
+  std::vector<baked_lod_t> lods;
+  std::string strings;
+
+  baked_header_t header = {};
+  header.magic = BAKED_MAGIC;
+  header.version = BAKED_VERSION;
+  header.mesh_count = meshes.size();
+  for (int c = 0; c < 3; ++c) {
+    header.bounds_min[c] = FLT_MAX;
+    header.bounds_max[c] = -FLT_MAX;
+  }
+
+  // Tables first, then the strings and the aligned streams
+  for (const mesh_data_t &mesh : model.meshes)
+    header.lod_count += mesh.lods.size();
+  uint64_t offset = sizeof(baked_header_t) +
+                    meshes.size() * sizeof(baked_mesh_t) +
+                    header.lod_count * sizeof(baked_lod_t);
+
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    const mesh_data_t &mesh = model.meshes[i];
+    baked_mesh_t &entry = meshes[i];
+    entry.vertex_count = mesh.vertices.size() / BAKED_VERTEX_FLOATS;
+    entry.lod_first = lods.size();
+    entry.lod_count = mesh.lods.size();
+    for (int c = 0; c < 3; ++c) {
+      entry.bounds_min[c] = mesh.bounds_min[c];
+      entry.bounds_max[c] = mesh.bounds_max[c];
+      header.bounds_min[c] = std::min(header.bounds_min[c], mesh.bounds_min[c]);
+      header.bounds_max[c] = std::max(header.bounds_max[c], mesh.bounds_max[c]);
+    }
+    for (int t = 0; t < BAKED_TEXTURES; ++t) {
+      entry.textures[t] = BAKED_NONE;
+      if (!mesh.textures[t].empty()) {
+        entry.textures[t] = strings.size();
+        strings += mesh.textures[t];
+        strings += '\0';
+      }
+    }
+    for (const mesh_lod_data_t &lod : mesh.lods)
+      lods.push_back({0, (uint32_t)lod.indices.size(), lod.error});
+  }
+
+  header.strings_offset = offset;
+  header.strings_size = strings.size();
+  offset += strings.size();
+
+  size_t lod = 0;
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    offset = baked_align(offset);
+    meshes[i].vertex_offset = offset;
+    offset += model.meshes[i].vertices.size() * sizeof(float);
+    // Levels follow each other, one element buffer holds them all
+    offset = baked_align(offset);
+    for (uint32_t l = 0; l < meshes[i].lod_count; ++l, ++lod) {
+      lods[lod].index_offset = offset;
+      offset += lods[lod].index_count * sizeof(uint32_t);
+    }
+  }
+  header.size = offset;
+
+  // Assembled in memory, the hash covers everything after the header
+  std::vector<unsigned char> data(header.size, 0);
+  unsigned char *cursor = data.data() + sizeof(baked_header_t);
+  memcpy(cursor, meshes.data(), meshes.size() * sizeof(baked_mesh_t));
+  cursor += meshes.size() * sizeof(baked_mesh_t);
+  memcpy(cursor, lods.data(), lods.size() * sizeof(baked_lod_t));
+  memcpy(data.data() + header.strings_offset, strings.data(), strings.size());
+
+  lod = 0;
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    const mesh_data_t &mesh = model.meshes[i];
+    memcpy(data.data() + meshes[i].vertex_offset, mesh.vertices.data(),
+           mesh.vertices.size() * sizeof(float));
+    for (const mesh_lod_data_t &level : mesh.lods) {
+      memcpy(data.data() + lods[lod++].index_offset, level.indices.data(),
+             level.indices.size() * sizeof(uint32_t));
+    }
+  }
+  header.hash = baked_hash(data.data() + sizeof(baked_header_t),
+                           data.size() - sizeof(baked_header_t));
+  memcpy(data.data(), &header, sizeof(header));
+
+  // Written aside and renamed, readers never see a partial file
+  std::string temporary = baked_temporary(path);
+  FILE *file = fopen(temporary.c_str(), "wb");
+  if (file == NULL) {
+    printf("ERROR::BAKED: Unable to write %s\n", path);
+    return false;
+  }
+  bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+  written = fclose(file) == 0 && written;
+  if (!written || rename(temporary.c_str(), path) != 0) {
+    printf("ERROR::BAKED: Unable to write %s\n", path);
+    remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+#endif
+
+} // namespace glib
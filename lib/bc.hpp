@@ -0,0 +1,311 @@
+#pragma once
+
+#include <cstddef>
+
+#include "dds.hpp"
+
+// Block compression of RGBA8 images to the BCn formats of dds.hpp, the
+// encoder of glib_bake. Each 4x4 block is fitted on its own: BC1 colours lie
+// on the principal axis of the block, refined once by least squares, BC4
+// values between the extremes of the block. BC3 pairs a BC4 alpha block with
+// BC1 colours and BC5 two BC4 blocks for the red and green channels.
+
+namespace glib {
+
+// 16 RGBA8 pixels, rows of 4, to an 8 byte block
+void bc1_block(const unsigned char *pixels, unsigned char *block);
+// One channel of 16 RGBA8 pixels to an 8 byte block
+void bc4_block(const unsigned char *pixels, int channel, unsigned char *block);
+
+// Every level of an RGBA8 image to a block format, the rows of blocks are
+// compressed by the shared jobs (see jobs.hpp). False if the format is not
+// one of blocks or the image is compressed already.
+bool bc_compress(const dds_image_t &image, unsigned int format,
+                 dds_image_t &result);
+
+#ifdef GLIB_BC_IMPL
+#undef GLIB_BC_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "jobs.hpp"
+
+namespace glib {
+
+static inline uint16_t bc_pack565(const float color[3]) {
+  int r = std::clamp((int)(color[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+  int g = std::clamp((int)(color[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+  int b = std::clamp((int)(color[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+  return r << 11 | g << 5 | b;
+}
+
+// As the decoder expands it
+static inline void bc_unpack565(uint16_t packed, float color[3]) {
+  int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+  color[0] = r << 3 | r >> 2;
+  color[1] = g << 2 | g >> 4;
+  color[2] = b << 3 | b >> 2;
+}
+
+// Indices of the pixels for two endpoints in 4 colour mode and the squared
+// error. The palette lies on the segment between the endpoints, so the
+// nearest entry is the one closest to the projection on it.
+static float bc1_fit(const unsigned char *pixels, uint16_t e0, uint16_t e1,
+                     uint32_t &indices) {
+  // Step from e1 to e0 in thirds to the code of the entry
+  static const uint32_t codes[4] = {1, 3, 2, 0};
+  float c0[3], c1[3], dir[3];
+  bc_unpack565(e0, c0);
+  bc_unpack565(e1, c1);
+  for (int c = 0; c < 3; ++c)
+    dir[c] = c0[c] - c1[c];
+  float length = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+  float scale = length > 0.0f ? 3.0f / length : 0.0f;
+
+  // Summed in lanes of 4 pixels either way, so both give the same blocks
+  int steps[16];
+  float lanes[4];
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128 zero = _mm_setzero_ps(), three = _mm_set1_ps(3.0f);
+  __m128 errors = zero;
+  for (int i = 0; i < 16; i += 4) {
+    __m128i rgba = _mm_loadu_si128((const __m128i *)(pixels + i * 4));
+    __m128 x[3], t = zero;
+    for (int c = 0; c < 3; ++c) {
+      x[c] = _mm_sub_ps(
+          _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(rgba, c * 8), mask)),
+          _mm_set1_ps(c1[c]));
+      t = _mm_add_ps(t, _mm_mul_ps(x[c], _mm_set1_ps(dir[c])));
+    }
+    t = _mm_min_ps(_mm_max_ps(_mm_mul_ps(t, _mm_set1_ps(scale)), zero), three);
+    __m128i step = _mm_cvtps_epi32(t);
+    _mm_storeu_si128((__m128i *)(steps + i), step);
+
+    __m128 s = _mm_mul_ps(_mm_cvtepi32_ps(step), _mm_set1_ps(1.0f / 3.0f));
+    for (int c = 0; c < 3; ++c) {
+      __m128 d = _mm_sub_ps(x[c], _mm_mul_ps(s, _mm_set1_ps(dir[c])));
+      errors = _mm_add_ps(errors, _mm_mul_ps(d, d));
+    }
+  }
+  _mm_storeu_ps(lanes, errors);
+#else
+  std::fill(lanes, lanes + 4, 0.0f);
+  for (int i = 0; i < 16; ++i) {
+    float x[3], t = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+      x[c] = pixels[i * 4 + c] - c1[c];
+      t += x[c] * dir[c];
+    }
+    steps[i] = (int)lrintf(std::clamp(t * scale, 0.0f, 3.0f));
+    for (int c = 0; c < 3; ++c) {
+      float d = x[c] - steps[i] * (1.0f / 3.0f) * dir[c];
+      lanes[i % 4] += d * d;
+    }
+  }
+#endif
+
+  indices = 0;
+  for (int i = 0; i < 16; ++i)
+    indices |= codes[steps[i]] << (i * 2);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+void bc1_block(const unsigned char *pixels, unsigned char *block) {
+  // Mean and covariance of the colours
+  float mean[3] = {}, cov[6] = {};
+  for (int i = 0; i < 16; ++i)
+    for (int c = 0; c < 3; ++c)
+      mean[c] += pixels[i * 4 + c] * (1.0f / 16.0f);
+  for (int i = 0; i < 16; ++i) {
+    float d[3];
+    for (int c = 0; c < 3; ++c)
+      d[c] = pixels[i * 4 + c] - mean[c];
+    cov[0] += d[0] * d[0];
+    cov[1] += d[0] * d[1];
+    cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1];
+    cov[4] += d[1] * d[2];
+    cov[5] += d[2] * d[2];
+  }
+
+  // Principal axis by power iteration
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                     cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                     cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    float largest = std::max({fabsf(next[0]), fabsf(next[1]), fabsf(next[2])});
+    if (largest < FLT_EPSILON)
+      break;
+    for (int c = 0; c < 3; ++c)
+      axis[c] = next[c] / largest;
+  }
+
+  // The pixels at the extremes of the axis are the endpoints
+  int low = 0, high = 0;
+  float lowest = FLT_MAX, highest = -FLT_MAX;
+  for (int i = 0; i < 16; ++i) {
+    const unsigned char *p = pixels + i * 4;
+    float t = p[0] * axis[0] + p[1] * axis[1] + p[2] * axis[2];
+    if (t < lowest)
+      lowest = t, low = i;
+    if (t > highest)
+      highest = t, high = i;
+  }
+  float c0[3], c1[3];
+  for (int c = 0; c < 3; ++c) {
+    c0[c] = pixels[high * 4 + c];
+    c1[c] = pixels[low * 4 + c];
+  }
+  uint16_t e0 = bc_pack565(c0), e1 = bc_pack565(c1);
+  uint32_t indices;
+  float error = bc1_fit(pixels, e0, e1, indices);
+
+  // Least squares endpoints for those indices, kept if they fit better
+  static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+  float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = {}, bx[3] = {};
+  for (int i = 0; i < 16; ++i) {
+    float w = weights[indices >> (i * 2) & 3];
+    aa += w * w;
+    bb += (1.0f - w) * (1.0f - w);
+    ab += w * (1.0f - w);
+    for (int c = 0; c < 3; ++c) {
+      ax[c] += w * pixels[i * 4 + c];
+      bx[c] += (1.0f - w) * pixels[i * 4 + c];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (fabsf(det) > FLT_EPSILON) {
+    for (int c = 0; c < 3; ++c) {
+      c0[c] = (ax[c] * bb - bx[c] * ab) / det;
+      c1[c] = (bx[c] * aa - ax[c] * ab) / det;
+    }
+    uint16_t f0 = bc_pack565(c0), f1 = bc_pack565(c1);
+    uint32_t refined;
+    if (bc1_fit(pixels, f0, f1, refined) < error)
+      e0 = f0, e1 = f1, indices = refined;
+  }
+
+  // 4 colour mode needs the first endpoint above the second, swapping them
+  // swaps the codes 0 with 1 and 2 with 3
+  if (e0 < e1) {
+    std::swap(e0, e1);
+    indices ^= 0x55555555u;
+  } else if (e0 == e1) {
+    indices = 0;
+  }
+  block[0] = e0 & 0xff;
+  block[1] = e0 >> 8;
+  block[2] = e1 & 0xff;
+  block[3] = e1 >> 8;
+  for (int b = 0; b < 4; ++b)
+    block[4 + b] = indices >> (b * 8) & 0xff;
+}
+
+void bc4_block(const unsigned char *pixels, int channel,
+               unsigned char *block) {
+  unsigned char low = 255, high = 0;
+  for (int i = 0; i < 16; ++i) {
+    low = std::min(low, pixels[i * 4 + channel]);
+    high = std::max(high, pixels[i * 4 + channel]);
+  }
+
+  // 8 value mode, the first endpoint above the second, steps from the low
+  // endpoint to the code of the value
+  uint64_t indices = 0;
+  if (high > low) {
+    float scale = 7.0f / (high - low);
+    for (int i = 0; i < 16; ++i) {
+      int step = (int)lrintf((pixels[i * 4 + channel] - low) * scale);
+      uint64_t code = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+      indices |= code << (i * 3);
+    }
+  }
+  block[0] = high;
+  block[1] = low;
+  for (int b = 0; b < 6; ++b)
+    block[2 + b] = indices >> (b * 8) & 0xff;
+}
+
+// A block of an RGBA8 level, the edges repeated past the last row or column
+static void bc_tile(const unsigned char *level, int width, int height, int x,
+                    int y, unsigned char *tile) {
+  for (int row = 0; row < 4; ++row) {
+    const unsigned char *source =
+        level + (size_t)std::min(y + row, height - 1) * width * 4;
+    for (int column = 0; column < 4; ++column) {
+      const unsigned char *pixel = source + std::min(x + column, width - 1) * 4;
+      std::copy(pixel, pixel + 4, tile + (row * 4 + column) * 4);
+    }
+  }
+}
+
+static void bc_encode(unsigned int format, const unsigned char *tile,
+                      unsigned char *block) {
+  switch (format) {
+  case DDS_BC1:
+  case DDS_BC1_SRGB:
+    bc1_block(tile, block);
+    break;
+  case DDS_BC3:
+  case DDS_BC3_SRGB:
+    bc4_block(tile, 3, block);
+    bc1_block(tile, block + 8);
+    break;
+  case DDS_BC4:
+    bc4_block(tile, 0, block);
+    break;
+  case DDS_BC5:
+    bc4_block(tile, 0, block);
+    bc4_block(tile, 1, block + 8);
+    break;
+  }
+}
+
+bool bc_compress(const dds_image_t &image, unsigned int format,
+                 dds_image_t &result) {
+  size_t block_size = dds_block_size(format);
+  if (block_size == 0 || dds_block_size(image.format) != 0)
+    return false;
+
+  result = {.format = format,
+            .opaque = image.opaque,
+            .role = image.role,
+            .width = image.width,
+            .height = image.height};
+  result.levels.resize(image.levels.size());
+  int width = image.width, height = image.height;
+  for (size_t l = 0; l < image.levels.size(); ++l) {
+    const unsigned char *level = image.levels[l].data();
+    std::vector<unsigned char> &blocks = result.levels[l];
+    blocks.resize(dds_level_size(format, width, height));
+    int columns = (width + 3) / 4, rows = (height + 3) / 4;
+
+    // A row of blocks per job
+    jobs_for(jobs_shared(), rows, [&, width, height](size_t row) {
+      unsigned char tile[64];
+      unsigned char *block = blocks.data() + row * columns * block_size;
+      for (int column = 0; column < columns; ++column) {
+        bc_tile(level, width, height, column * 4, row * 4, tile);
+        bc_encode(format, tile, block);
+        block += block_size;
+      }
+    });
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+  return true;
+}
+
+#endif
+
+} // namespace glib
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// On disk cache of imported assets, keyed by a hash of the source bytes, the
+// import flags and the version of the format of the entry. model_load keeps
+// baked models (.glbm) and texture_load encoded textures (.dds) there, both
+// verified against their content hash when mapped back.
+//
+// The directory is GLIB_CACHE_DIR, else $XDG_CACHE_HOME/glib or
+// ~/.cache/glib, and GLIB_NO_CACHE disables the cache. Entries used last are
+// kept when the size goes over GLIB_CACHE_SIZE MiB, 1024 by default.
+
+namespace glib {
+
+// Change the directory and the size cap, an empty directory disables it
+void cache_configure(const char *directory, size_t max_bytes);
+bool cache_enabled();
+
+// Key of the contents of a file, 0 if it can not be read
+uint64_t cache_key(const char *source, uint32_t flags, uint32_t version);
+
+// Path of an entry, the extension tells the kind of asset
+std::string cache_path(uint64_t key, const char *extension);
+
+// An entry was used, it is the last to be evicted
+void cache_touch(const std::string &path);
+
+// An entry was written, the oldest ones are evicted to stay under the cap
+void cache_insert(const std::string &path);
+
+// A corrupt entry is dropped
+void cache_remove(const std::string &path);
+
+#ifdef GLIB_CACHE_IMPL
+#undef GLIB_CACHE_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "baked.hpp"
+
+namespace glib {
+
+struct cache_state_t {
+  bool configured = false;
+  std::string directory;
+  size_t max_bytes = 1024ull << 20;
+  std::mutex mutex; // configuration and eviction
+};
+static cache_state_t cache_state;
+
+// Loaders on any thread may be the first to ask
+static void cache_defaults() {
+  std::lock_guard<std::mutex> lock(cache_state.mutex);
+  if (cache_state.configured)
+    return;
+  cache_state.configured = true;
+  if (getenv("GLIB_NO_CACHE") != NULL)
+    return;
+
+  if (const char *size = getenv("GLIB_CACHE_SIZE"))
+    cache_state.max_bytes = strtoull(size, NULL, 10) << 20;
+  if (const char *directory = getenv("GLIB_CACHE_DIR"))
+    cache_state.directory = directory;
+  else if (const char *xdg = getenv("XDG_CACHE_HOME"))
+    cache_state.directory = std::string(xdg) + "/glib";
+  else if (const char *home = getenv("HOME"))
+    cache_state.directory = std::string(home) + "/.cache/glib";
+}
+
+void cache_configure(const char *directory, size_t max_bytes) {
+  std::lock_guard<std::mutex> lock(cache_state.mutex);
+  cache_state.configured = true;
+  cache_state.directory = directory;
+  cache_state.max_bytes = max_bytes;
+}
+
+bool cache_enabled() {
+  cache_defaults();
+  return !cache_state.directory.empty();
+}
+
+uint64_t cache_key(const char *source, uint32_t flags, uint32_t version) {
+  int fd = open(source, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return 0;
+  }
+
+  uint32_t header[2] = {flags, version};
+  uint64_t hash = baked_hash(header, sizeof(header));
+  if (info.st_size > 0) {
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return 0;
+    }
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    hash = baked_hash(data, info.st_size, hash);
+    munmap(data, info.st_size);
+  }
+  close(fd);
+  return hash;
+}
+
+std::string cache_path(uint64_t key, const char *extension) {
+  cache_defaults();
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx", (unsigned long long)key);
+  std::error_code error;
+  std::filesystem::create_directories(cache_state.directory, error);
+  return cache_state.directory + name + extension;
+}
+
+void cache_touch(const std::string &path) {
+  std::error_code error;
+  std::filesystem::last_write_time(
+      path, std::filesystem::file_time_type::clock::now(), error);
+}
+
+void cache_insert(const std::string &path) {
+  namespace fs = std::filesystem;
+  std::lock_guard<std::mutex> lock(cache_state.mutex);
+  cache_touch(path);
+
+  struct entry_t {
+    fs::file_time_type time;
+    size_t size;
+    fs::path path;
+  };
+  std::vector<entry_t> entries;
+  size_t total = 0;
+  std::error_code error;
+  for (const fs::directory_entry &entry :
+       fs::directory_iterator(cache_state.directory, error)) {
+    if (!entry.is_regular_file(error) || entry.path().extension() == ".tmp")
+      continue;
+    entries.push_back({entry.last_write_time(error), entry.file_size(error),
+                       entry.path()});
+    total += entries.back().size;
+  }
+  if (total <= cache_state.max_bytes)
+    return;
+
+  // Least recently used first, the entry just written stays
+  std::sort(entries.begin(), entries.end(),
+            [](const entry_t &a, const entry_t &b) { return a.time < b.time; });
+  for (const entry_t &entry : entries) {
+    if (total <= cache_state.max_bytes)
+      break;
+    if (entry.path == path)
+      continue;
+    if (fs::remove(entry.path, error)) {
+      total -= entry.size;
+      printf("evicted %s from the cache\n", entry.path.c_str());
+    }
+  }
+}
+
+void cache_remove(const std::string &path) {
+  std::error_code error;
+  std::filesystem::remove(path, error);
+}
+
+#endif
+
+} // namespace glib
@@ -0,0 +1,356 @@
+#pragma once
+
+#include <string>
+
+#include "graphics.hpp"
+#include "image.hpp"
+
+namespace glib {
+
+// Frames a readback stays in flight before it is mapped, and frames that
+// can wait for the encoder before capturing blocks
+#define CAPTURE_LATENCY 3
+#define CAPTURE_QUEUE 8
+
+enum capture_format_e {
+  CAPTURE_PNG, // numbered files in a directory
+  CAPTURE_RAW, // one file of RGB8 frames, rows top to bottom
+  CAPTURE_Y4M  // one YUV 4:2:0 stream, playable by ffmpeg and mpv
+};
+
+struct capture_worker_t;
+
+// Records frames without stalling the GPU: each capture reads into a pixel
+// buffer object that is mapped a few frames later, when its fence signaled,
+// and a worker thread encodes and writes the pixels.
+struct capture_t {
+  int width, height;
+  capture_format_e format;
+  std::string path;
+
+  unsigned int pbos[CAPTURE_LATENCY];
+  GLsync fences[CAPTURE_LATENCY];
+  int head, pending; // oldest readback in flight and their count
+
+  unsigned long frames;  // captured
+  unsigned long dropped; // readbacks that could not be mapped
+  unsigned long stalls;  // captures blocked on the GPU or on the encoder
+  double stall_ms;
+  capture_worker_t *worker;
+};
+
+// The format comes from the extension of the path, .y4m or .raw, any other
+// path is a directory of PNG files. The fps is stored in Y4M streams.
+capture_t capture_create(const char *path, int width, int height,
+                         int fps = 60);
+// Waits for the frames in flight and for the encoder
+void capture_destroy(capture_t &capture);
+
+// Read the RGB of a framebuffer attachment (GL_COLOR_ATTACHMENTi or GL_BACK)
+// at 8 bits per channel, values outside [0, 1] are clamped
+void capture_frame(capture_t &capture, unsigned int fbo,
+                   unsigned int attachment);
+
+// Frames written by the worker so far
+unsigned long capture_written(const capture_t &capture);
+
+#ifdef GLIB_CAPTURE_IMPL
+#undef GLIB_CAPTURE_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+namespace glib {
+
+// Frames as read, RGBA rows bottom to top
+struct capture_worker_t {
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::vector<unsigned char>> queue;
+  std::vector<std::vector<unsigned char>> free; // buffers to reuse
+  bool stop = false;
+
+  FILE *stream = NULL;
+  unsigned long written = 0;
+};
+
+// RGB rows top to bottom
+static void capture_rgb(const capture_t &capture,
+                        const std::vector<unsigned char> &rgba,
+                        std::vector<unsigned char> &rgb) {
+  size_t width = capture.width;
+  rgb.resize(width * capture.height * 3);
+  for (int y = 0; y < capture.height; ++y) {
+    const unsigned char *src = &rgba[(capture.height - 1 - y) * width * 4];
+    unsigned char *dst = &rgb[y * width * 3];
+    for (size_t x = 0; x < width; ++x) {
+      dst[x * 3 + 0] = src[x * 4 + 0];
+      dst[x * 3 + 1] = src[x * 4 + 1];
+      dst[x * 3 + 2] = src[x * 4 + 2];
+    }
+  }
+}
+
+// BT.601 studio range, chroma averaged over 2x2 pixels like C420jpeg
+static void capture_yuv(const capture_t &capture,
+                        const std::vector<unsigned char> &rgba,
+                        std::vector<unsigned char> &yuv) {
+  int width = capture.width, height = capture.height;
+  int chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+  size_t luma = (size_t)width * height;
+  size_t chroma = (size_t)chroma_width * chroma_height;
+  yuv.resize(luma + chroma * 2);
+  unsigned char *u_plane = &yuv[luma], *v_plane = &yuv[luma + chroma];
+
+  auto pixel = [&](int x, int y) {
+    x = std::min(x, width - 1);
+    y = std::min(y, height - 1);
+    return &rgba[((size_t)(height - 1 - y) * width + x) * 4];
+  };
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const unsigned char *p = pixel(x, y);
+      yuv[(size_t)y * width + x] =
+          ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16;
+    }
+  }
+  for (int y = 0; y < chroma_height; ++y) {
+    for (int x = 0; x < chroma_width; ++x) {
+      int r = 0, g = 0, b = 0;
+      for (int i = 0; i < 4; ++i) {
+        const unsigned char *p = pixel(x * 2 + (i & 1), y * 2 + (i >> 1));
+        r += p[0], g += p[1], b += p[2];
+      }
+      r = (r + 2) / 4, g = (g + 2) / 4, b = (b + 2) / 4;
+      u_plane[y * chroma_width + x] =
+          ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+      v_plane[y * chroma_width + x] =
+          ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+  }
+}
+
+// Encodes the frames in order, one at a time
+static void capture_work(capture_t capture, capture_worker_t *worker) {
+  std::vector<unsigned char> rgba, converted;
+  char name[64];
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(worker->mutex);
+      worker->cv.wait(lock,
+                      [&] { return worker->stop || !worker->queue.empty(); });
+      if (worker->queue.empty())
+        return;
+      rgba.swap(worker->queue.front());
+      worker->queue.pop_front();
+    }
+
+    switch (capture.format) {
+    case CAPTURE_PNG: {
+      image_t image = {capture.width, capture.height, 3};
+      capture_rgb(capture, rgba, image.pixels);
+      snprintf(name, sizeof(name), "/frame_%05lu.png", worker->written);
+      image_write_png((capture.path + name).c_str(), image);
+      break;
+    }
+    case CAPTURE_RAW:
+      capture_rgb(capture, rgba, converted);
+      fwrite(converted.data(), 1, converted.size(), worker->stream);
+      break;
+    case CAPTURE_Y4M:
+      capture_yuv(capture, rgba, converted);
+      fputs("FRAME\n", worker->stream);
+      fwrite(converted.data(), 1, converted.size(), worker->stream);
+      break;
+    }
+
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->written += 1;
+    worker->free.push_back(std::move(rgba));
+    worker->cv.notify_all();
+  }
+}
+
+capture_t capture_create(const char *path, int width, int height, int fps) {
+  capture_t result = {};
+  result.width = width;
+  result.height = height;
+  result.path = path;
+
+  std::filesystem::path extension = std::filesystem::path(path).extension();
+  result.format = extension == ".y4m"   ? CAPTURE_Y4M
+                  : extension == ".raw" ? CAPTURE_RAW
+                                        : CAPTURE_PNG;
+
+  result.worker = new capture_worker_t();
+  if (result.format == CAPTURE_PNG) {
+    std::filesystem::create_directories(path);
+  } else {
+    result.worker->stream = fopen(path, "wb");
+    if (result.worker->stream == NULL) {
+      std::cout << "ERROR::CAPTURE: Unable to write " << path << "\n";
+      exit(1);
+    }
+    if (result.format == CAPTURE_Y4M)
+      fprintf(result.worker->stream,
+              "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height,
+              fps);
+  }
+
+  size_t bytes = (size_t)width * height * 4;
+  glGenBuffers(CAPTURE_LATENCY, result.pbos);
+  for (int i = 0; i < CAPTURE_LATENCY; ++i) {
+    GLIB_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, result.pbos[i]));
+    gl_buffer_data(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+    gpu_memory_track(GPU_BUFFER, result.pbos[i], bytes, "capture");
+  }
+  GLIB_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+  result.worker->thread = std::thread(capture_work, result, result.worker);
+
+  const char *formats[] = {"png", "raw", "y4m"};
+  printf("created capture(path: %s, format: %s)\n", path,
+         formats[result.format]);
+  return result;
+}
+
+// Copy out the oldest readback and hand it to the worker
+static void capture_retire(capture_t &capture) {
+  capture_worker_t *worker = capture.worker;
+  int slot = capture.head;
+  glDeleteSync(capture.fences[slot]);
+  capture.fences[slot] = NULL;
+  capture.head = (capture.head + 1) % CAPTURE_LATENCY;
+  capture.pending -= 1;
+
+  std::vector<unsigned char> buffer;
+  {
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    if (worker->queue.size() >= CAPTURE_QUEUE) {
+      double start = glfwGetTime();
+      worker->cv.wait(lock,
+                      [&] { return worker->queue.size() < CAPTURE_QUEUE; });
+      capture.stalls += 1;
+      capture.stall_ms += (glfwGetTime() - start) * 1000.0;
+    }
+    if (!worker->free.empty()) {
+      buffer.swap(worker->free.back());
+      worker->free.pop_back();
+    }
+  }
+
+  size_t bytes = (size_t)capture.width * capture.height * 4;
+  buffer.resize(bytes);
+  GLIB_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbos[slot]));
+  void *data =
+      GLIB_GL(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes,
+                               GL_MAP_READ_BIT));
+  if (data != NULL) {
+    memcpy(buffer.data(), data, bytes);
+    GLIB_GL(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+  }
+  GLIB_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+  std::lock_guard<std::mutex> lock(worker->mutex);
+  if (data == NULL) {
+    // The pixels are lost, better a missing frame than a garbage one
+    std::cout << "ERROR::CAPTURE: Unable to map the readback\n";
+    worker->free.push_back(std::move(buffer));
+    capture.dropped += 1;
+    return;
+  }
+  worker->queue.push_back(std::move(buffer));
+  worker->cv.notify_all();
+}
+
+// Block until the oldest readback is complete
+static void capture_wait(capture_t &capture) {
+  GLsync fence = capture.fences[capture.head];
+  if (glClientWaitSync(fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+    return;
+  double start = glfwGetTime();
+  unsigned int flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+  while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+    flags = 0;
+  capture.stalls += 1;
+  capture.stall_ms += (glfwGetTime() - start) * 1000.0;
+}
+
+// Retire readbacks in order, as long as they are complete or if asked to
+static void capture_poll(capture_t &capture, bool wait) {
+  while (capture.pending > 0) {
+    GLsync fence = capture.fences[capture.head];
+    if (!wait && glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+      return;
+    capture_wait(capture);
+    capture_retire(capture);
+  }
+}
+
+void capture_frame(capture_t &capture, unsigned int fbo,
+                   unsigned int attachment) {
+  GLIB_ZONE("capture_frame");
+  capture_poll(capture, false);
+
+  // Every slot in flight, only waits when the GPU is CAPTURE_LATENCY
+  // frames behind
+  if (capture.pending == CAPTURE_LATENCY) {
+    capture_wait(capture);
+    capture_retire(capture);
+  }
+
+  int slot = (capture.head + capture.pending) % CAPTURE_LATENCY;
+  gl_bind_framebuffer(GL_READ_FRAMEBUFFER, fbo);
+  GLIB_GL(glReadBuffer(attachment));
+  GLIB_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, capture.pbos[slot]));
+  GLIB_GL(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+  GLIB_GL(glReadPixels(0, 0, capture.width, capture.height, GL_RGBA,
+                       GL_UNSIGNED_BYTE, NULL));
+  GLIB_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+  gl_bind_framebuffer(GL_READ_FRAMEBUFFER, framebuffer_default);
+
+  capture.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  capture.pending += 1;
+  capture.frames += 1;
+}
+
+unsigned long capture_written(const capture_t &capture) {
+  std::lock_guard<std::mutex> lock(capture.worker->mutex);
+  return capture.worker->written;
+}
+
+void capture_destroy(capture_t &capture) {
+  capture_poll(capture, true);
+
+  capture_worker_t *worker = capture.worker;
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->stop = true;
+    worker->cv.notify_all();
+  }
+  worker->thread.join();
+  if (worker->stream != NULL)
+    fclose(worker->stream);
+  printf("captured %lu frames to %s, %lu dropped, %lu stalls (%.2fms)\n",
+         worker->written, capture.path.c_str(), capture.dropped,
+         capture.stalls, capture.stall_ms);
+  delete worker;
+
+  for (int i = 0; i < CAPTURE_LATENCY; ++i)
+    gpu_memory_untrack(GPU_BUFFER, capture.pbos[i]);
+  glDeleteBuffers(CAPTURE_LATENCY, capture.pbos);
+  capture = {};
+}
+
+#endif
+
+} // namespace glib
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// DirectDraw Surface textures with the DX10 header, what glib_bake encodes
+// textures to and texture_load prefers over the source image. Rows are stored
+// bottom to top, the order texture_load hands them to GL, and so are the rows
+// of 4x4 blocks of the compressed formats. The files written by glib keep a
+// hash of their levels and the role they were encoded for in the reserved
+// words of the header.
+
+namespace glib {
+
+#define DDS_MAGIC 0x20534444 // "DDS "
+#define DDS_MAX_LEVELS 16
+
+// DXGI_FORMAT values of the formats glib reads and writes
+enum dds_format_e {
+  DDS_RGBA8 = 28,      // DXGI_FORMAT_R8G8B8A8_UNORM
+  DDS_RGBA8_SRGB = 29, // DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+  DDS_RG8 = 49,        // DXGI_FORMAT_R8G8_UNORM
+  DDS_R8 = 61,         // DXGI_FORMAT_R8_UNORM
+  DDS_BC1 = 71,        // DXGI_FORMAT_BC1_UNORM, opaque RGB
+  DDS_BC1_SRGB = 72,   // DXGI_FORMAT_BC1_UNORM_SRGB
+  DDS_BC3 = 77,        // DXGI_FORMAT_BC3_UNORM, RGB and alpha
+  DDS_BC3_SRGB = 78,   // DXGI_FORMAT_BC3_UNORM_SRGB
+  DDS_BC4 = 80,        // DXGI_FORMAT_BC4_UNORM, red
+  DDS_BC5 = 83,        // DXGI_FORMAT_BC5_UNORM, red and green
+};
+
+struct dds_level_t {
+  int width, height;
+  const unsigned char *data;
+  size_t size;
+};
+
+// A mapped file, the levels point in it until dds_close
+struct dds_file_t {
+  const unsigned char *map;
+  size_t map_size;
+  unsigned int format;
+  bool opaque;                    // alpha is 1 everywhere
+  unsigned int role;              // texture_role_e + 1, 0 if unknown
+  int width, height, level_count; // finest level first
+  dds_level_t levels[DDS_MAX_LEVELS];
+};
+
+struct dds_image_t {
+  unsigned int format;
+  bool opaque;
+  unsigned int role; // texture_role_e + 1, 0 if unknown
+  int width, height;
+  std::vector<std::vector<unsigned char>> levels; // finest first
+};
+
+// Bytes of a level, 0 for a format glib does not know
+size_t dds_level_size(unsigned int format, int width, int height);
+// Bytes of a 4x4 block, 0 for the formats stored by pixel
+size_t dds_block_size(unsigned int format);
+
+// Map and validate a texture, verify also checks the hash of the levels of
+// the files written by glib
+bool dds_open(const char *path, dds_file_t &file, bool verify = false);
+void dds_close(dds_file_t &file);
+
+bool dds_write(const char *path, const dds_image_t &image);
+
+#ifdef GLIB_DDS_IMPL
+#undef GLIB_DDS_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "baked.hpp"
+
+namespace glib {
+
+#define DDS_FOURCC_DX10 0x30315844 // "DX10"
+#define DDS_GLIB_TAG 0x42494c47    // "GLIB", the hash follows it
+#define DDS_ALPHA_OPAQUE 3         // DDS_ALPHA_MODE_OPAQUE of the DX10 header
+
+// DDS_HEADER and DDS_HEADER_DXT10 of the DirectX documentation
+struct dds_header_t {
+  uint32_t size, flags, height, width, pitch, depth, levels;
+  uint32_t reserved[11];
+  struct {
+    uint32_t size, flags, fourcc, bits, masks[4];
+  } pixel_format;
+  uint32_t caps[4], reserved2;
+  // DX10
+  uint32_t format, dimension, misc, array_size, misc2;
+};
+
+static_assert(sizeof(dds_header_t) == 124 + 20, "dds header layout");
+
+size_t dds_level_size(unsigned int format, int width, int height) {
+  switch (format) {
+  case DDS_RGBA8:
+  case DDS_RGBA8_SRGB:
+    return (size_t)width * height * 4;
+  case DDS_RG8:
+    return (size_t)width * height * 2;
+  case DDS_R8:
+    return (size_t)width * height;
+  }
+  // Partial blocks at the edges are whole in the file
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+         dds_block_size(format);
+}
+
+size_t dds_block_size(unsigned int format) {
+  switch (format) {
+  case DDS_BC1:
+  case DDS_BC1_SRGB:
+  case DDS_BC4:
+    return 8;
+  case DDS_BC3:
+  case DDS_BC3_SRGB:
+  case DDS_BC5:
+    return 16;
+  }
+  return 0;
+}
+
+bool dds_open(const char *path, dds_file_t &file, bool verify) {
+  file = {};
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("ERROR::DDS: Unable to open %s\n", path);
+    return false;
+  }
+  struct stat info;
+  size_t prefix = sizeof(uint32_t) + sizeof(dds_header_t);
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < prefix) {
+    printf("ERROR::DDS: %s is not a texture\n", path);
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("ERROR::DDS: Unable to map %s\n", path);
+    return false;
+  }
+  file.map = (const unsigned char *)data;
+  file.map_size = info.st_size;
+
+  uint32_t magic;
+  dds_header_t header;
+  memcpy(&magic, file.map, sizeof(magic));
+  memcpy(&header, file.map + sizeof(magic), sizeof(header));
+
+  // Only 2D textures of the known formats, every level inside the file
+  bool valid = magic == DDS_MAGIC && header.size == 124 &&
+               header.pixel_format.fourcc == DDS_FOURCC_DX10 &&
+               header.dimension == 3 && header.array_size == 1 &&
+               header.width > 0 && header.height > 0 &&
+               dds_level_size(header.format, 1, 1) > 0;
+  file.format = header.format;
+  file.opaque = (header.misc2 & 0x7) == DDS_ALPHA_OPAQUE;
+  file.role = header.reserved[0] == DDS_GLIB_TAG ? header.reserved[3] : 0;
+  file.width = header.width;
+  file.height = header.height;
+  file.level_count = std::clamp<int>(header.levels, 1, DDS_MAX_LEVELS);
+
+  size_t offset = prefix;
+  int width = file.width, height = file.height;
+  for (int i = 0; valid && i < file.level_count; ++i) {
+    size_t size = dds_level_size(file.format, width, height);
+    valid = size <= file.map_size - offset;
+    file.levels[i] = {width, height, file.map + offset, size};
+    offset += size;
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+  if (valid && verify && header.reserved[0] == DDS_GLIB_TAG) {
+    uint64_t hash = baked_hash(file.map + prefix, offset - prefix);
+    valid = header.reserved[1] == (uint32_t)hash &&
+            header.reserved[2] == (uint32_t)(hash >> 32);
+  }
+  if (!valid) {
+    printf("ERROR::DDS: %s is corrupt or of an unknown format\n", path);
+    dds_close(file);
+    return false;
+  }
+  return true;
+}
+
+void dds_close(dds_file_t &file) {
+  if (file.map != NULL)
+    munmap((void *)file.map, file.map_size);
+  file = {};
+}
+
+bool dds_write(const char *path, const dds_image_t &image) {
+  dds_header_t header = {};
+  header.size = 124;
+  header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000; // caps to mipmap count
+  header.width = image.width;
+  header.height = image.height;
+  header.pitch = dds_level_size(image.format, image.width, 1);
+  if (dds_block_size(image.format) != 0) {
+    header.flags |= 0x80000; // linear size, of the whole first level
+    header.pitch = dds_level_size(image.format, image.width, image.height);
+  }
+  header.levels = image.levels.size();
+  header.pixel_format.size = 32;
+  header.pixel_format.flags = 0x4; // fourcc
+  header.pixel_format.fourcc = DDS_FOURCC_DX10;
+  header.caps[0] = 0x1000; // texture
+  if (image.levels.size() > 1)
+    header.caps[0] |= 0x8 | 0x400000; // complex, mipmap
+  header.format = image.format;
+  header.dimension = 3; // texture 2D
+  header.array_size = 1;
+  header.misc2 = image.opaque ? DDS_ALPHA_OPAQUE : 0;
+
+  uint64_t hash = baked_hash(NULL, 0);
+  for (const std::vector<unsigned char> &level : image.levels)
+    hash = baked_hash(level.data(), level.size(), hash);
+  header.reserved[0] = DDS_GLIB_TAG;
+  header.reserved[1] = (uint32_t)hash;
+  header.reserved[2] = (uint32_t)(hash >> 32);
+  header.reserved[3] = image.role;
+
+  // Written aside and renamed, readers never see a partial file
+  std::string temporary = baked_temporary(path);
+  FILE *file = fopen(temporary.c_str(), "wb");
+  if (file == NULL) {
+    printf("ERROR::DDS: Unable to write %s\n", path);
+    return false;
+  }
+  uint32_t magic = DDS_MAGIC;
+  bool written = fwrite(&magic, sizeof(magic), 1, file) == 1 &&
+                 fwrite(&header, sizeof(header), 1, file) == 1;
+  for (const std::vector<unsigned char> &level : image.levels)
+    written = written &&
+              fwrite(level.data(), 1, level.size(), file) == level.size();
+  written = fclose(file) == 0 && written;
+  if (!written || rename(temporary.c_str(), path) != 0) {
+    printf("ERROR::DDS: Unable to write %s\n", path);
+    remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+#endif
+
+} // namespace glib
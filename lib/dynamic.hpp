@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+#include "graphics.hpp"
+
+namespace glib {
+
+// Frames whose data can be alive at once, as many as the pacer lets queue
+#define DYNAMIC_RING_SLICES 3
+
+// How the CPU writes reach the buffer
+enum dynamic_mode_e {
+  DYNAMIC_PERSISTENT,    // GL 4.4 storage mapped once, coherent
+  DYNAMIC_UNSYNCHRONIZED // GL 3.3, mapped without syncing until flushed
+};
+
+// Per frame data written sequentially into one buffer, split in a slice per
+// frame. A slice is reused only after the fence of its last frame signaled,
+// so writes never wait on the GPU nor make the driver copy.
+struct dynamic_ring_t {
+  unsigned int id;
+  dynamic_mode_e mode;
+  size_t slice_size; // bytes a frame can allocate
+  size_t alignment;  // of uniform and storage buffer ranges
+  unsigned char *mapped; // whole buffer when persistent
+
+  int slice;
+  size_t offset; // next free byte of the slice
+  GLsync fences[DYNAMIC_RING_SLICES];
+
+  size_t peak; // most bytes used by a frame, to size frame_bytes
+
+  // Unsynchronized mapping of the rest of the slice, until flushed
+  unsigned char *pending;
+  size_t pending_offset; // in the buffer
+};
+
+// A range of the current frame, data is writable until the ring is flushed,
+// by dynamic_ring_bind or dynamic_ring_end
+struct dynamic_range_t {
+  unsigned int buffer;
+  size_t offset, size;
+  void *data;
+};
+
+// Persistent mapping where available, GLIB_NO_PERSISTENT_MAP forces the
+// GL 3.3 path
+dynamic_ring_t dynamic_ring_create(size_t frame_bytes);
+void dynamic_ring_destroy(dynamic_ring_t &ring);
+
+// Start the frame on the next slice, waiting for the GPU to release it
+void dynamic_ring_begin(dynamic_ring_t &ring);
+// Fence the slice, after the last draw using it
+void dynamic_ring_end(dynamic_ring_t &ring);
+
+// Aligned to the ring alignment unless a smaller one is given, exits if the
+// frame runs out of space
+dynamic_range_t dynamic_ring_alloc(dynamic_ring_t &ring, size_t bytes,
+                                   size_t alignment = 0);
+// Make the writes visible to the GPU, needed before drawing with them
+void dynamic_ring_flush(dynamic_ring_t &ring);
+// Flush and bind to an indexed target, GL_UNIFORM_BUFFER usually
+void dynamic_ring_bind(dynamic_ring_t &ring, const dynamic_range_t &range,
+                       unsigned int target, unsigned int index);
+
+#ifdef GLIB_DYNAMIC_IMPL
+#undef GLIB_DYNAMIC_IMPL
+
+dynamic_ring_t dynamic_ring_create(size_t frame_bytes) {
+  dynamic_ring_t result = {};
+  result.mode = (GLAD_GL_VERSION_4_4 && !getenv("GLIB_NO_PERSISTENT_MAP"))
+                    ? DYNAMIC_PERSISTENT
+                    : DYNAMIC_UNSYNCHRONIZED;
+
+  int alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  if (GLAD_GL_VERSION_4_3) {
+    int storage = 0;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage);
+    alignment = std::max(alignment, storage);
+  }
+  result.alignment = std::max(alignment, 16);
+  result.slice_size = (frame_bytes + result.alignment - 1) /
+                      result.alignment * result.alignment;
+
+  size_t size = result.slice_size * DYNAMIC_RING_SLICES;
+  glGenBuffers(1, &result.id);
+  GLIB_GL(glBindBuffer(GL_COPY_WRITE_BUFFER, result.id));
+  if (result.mode == DYNAMIC_PERSISTENT) {
+    unsigned int flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLIB_GL(glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags));
+    result.mapped = (unsigned char *)GLIB_GL(
+        glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+    if (result.mapped == NULL) {
+      std::cout << "ERROR::DYNAMIC: Failed to map the ring buffer\n";
+      exit(1);
+    }
+  } else {
+    gl_buffer_data(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+  }
+  GLIB_GL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+  gpu_memory_track(GPU_BUFFER, result.id, size, "dynamic");
+
+  // First dynamic_ring_begin moves to slice 0
+  result.slice = DYNAMIC_RING_SLICES - 1;
+
+  printf("created dynamic ring(id: %d, frame: %zu bytes, persistent: %d)\n",
+         result.id, result.slice_size, result.mode == DYNAMIC_PERSISTENT);
+  return result;
+}
+
+void dynamic_ring_begin(dynamic_ring_t &ring) {
+  GLIB_ZONE("dynamic_ring_begin");
+  ring.slice = (ring.slice + 1) % DYNAMIC_RING_SLICES;
+  ring.offset = 0;
+
+  // Already signaled unless more frames are queued than there are slices
+  GLsync &fence = ring.fences[ring.slice];
+  if (fence != NULL) {
+    unsigned int flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+      flags = 0;
+    glDeleteSync(fence);
+    fence = NULL;
+  }
+}
+
+dynamic_range_t dynamic_ring_alloc(dynamic_ring_t &ring, size_t bytes,
+                                   size_t alignment) {
+  if (alignment == 0 || alignment > ring.alignment)
+    alignment = ring.alignment;
+  size_t offset = (ring.offset + alignment - 1) / alignment * alignment;
+  if (offset + bytes > ring.slice_size) {
+    std::cout << "ERROR::DYNAMIC: Frame allocates more than "
+              << ring.slice_size << " bytes\n";
+    exit(1);
+  }
+  ring.offset = offset + bytes;
+  ring.peak = std::max(ring.peak, ring.offset);
+
+  dynamic_range_t result = {};
+  result.buffer = ring.id;
+  result.offset = ring.slice * ring.slice_size + offset;
+  result.size = bytes;
+
+  if (ring.mode == DYNAMIC_PERSISTENT) {
+    result.data = ring.mapped + result.offset;
+    return result;
+  }
+
+  // Ranges share one mapping of the rest of the slice until it is flushed,
+  // the fence guarantees the GPU is done with it
+  if (ring.pending == NULL) {
+    size_t end = (ring.slice + 1) * ring.slice_size;
+    GLIB_GL(glBindBuffer(GL_COPY_WRITE_BUFFER, ring.id));
+    ring.pending = (unsigned char *)GLIB_GL(glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, result.offset, end - result.offset,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+            GL_MAP_INVALIDATE_RANGE_BIT));
+    GLIB_GL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    if (ring.pending == NULL) {
+      std::cout << "ERROR::DYNAMIC: Failed to map a ring range\n";
+      exit(1);
+    }
+    ring.pending_offset = result.offset;
+  }
+  result.data = ring.pending + (result.offset - ring.pending_offset);
+  return result;
+}
+
+void dynamic_ring_flush(dynamic_ring_t &ring) {
+  if (ring.pending == NULL)
+    return;
+  GLIB_GL(glBindBuffer(GL_COPY_WRITE_BUFFER, ring.id));
+  GLIB_GL(glUnmapBuffer(GL_COPY_WRITE_BUFFER));
+  GLIB_GL(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+  ring.pending = NULL;
+}
+
+void dynamic_ring_bind(dynamic_ring_t &ring, const dynamic_range_t &range,
+                       unsigned int target, unsigned int index) {
+  dynamic_ring_flush(ring);
+  GLIB_GL(glBindBufferRange(target, index, range.buffer, range.offset,
+                            range.size));
+}
+
+void dynamic_ring_end(dynamic_ring_t &ring) {
+  dynamic_ring_flush(ring);
+  ring.fences[ring.slice] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void dynamic_ring_destroy(dynamic_ring_t &ring) {
+  dynamic_ring_flush(ring);
+  for (int i = 0; i < DYNAMIC_RING_SLICES; ++i)
+    if (ring.fences[i] != NULL)
+      glDeleteSync(ring.fences[i]);
+
+  // Deleting the buffer unmaps it
+  gpu_memory_untrack(GPU_BUFFER, ring.id);
+  glDeleteBuffers(1, &ring.id);
+  ring = {};
+}
+
+#endif
+
+} // namespace glib
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "graphics.hpp"
+
+namespace glib {
+
+// Point or spot light with a finite range, points are spots with a full cone
+struct light_t {
+  glm::vec3 position;
+  float radius;
+  glm::vec3 color;
+  glm::vec3 direction;
+
+  // Cosines of the cone angles, only for spots
+  float cutoff_inner, cutoff_outer;
+};
+
+light_t light_point(const glm::vec3 &position, const glm::vec3 &color,
+                    float radius);
+light_t light_spot(const glm::vec3 &position, const glm::vec3 &direction,
+                   const glm::vec3 &color, float radius, float inner_deg,
+                   float outer_deg);
+
+// Screen divided in tiles, each with the list of lights touching it.
+// Lists live in texture buffers so that a 3.3 fragment shader can walk them.
+struct light_grid_t {
+  int width, height;
+  int tile, tiles_x, tiles_y;
+  int capacity;
+
+  // Light data (3 RGBA32F texels per light)
+  unsigned int light_buffer, light_texture;
+  // Light indices of all tiles back to back (R32UI)
+  unsigned int index_buffer, index_texture;
+  unsigned int index_capacity;
+  // Offset and count in the indices of each tile (RG32UI)
+  unsigned int tile_buffer, tile_texture;
+
+  // Scratch memory reused every frame
+  std::vector<float> light_data;
+  std::vector<unsigned int> indices;
+  std::vector<unsigned int> tiles;
+  std::vector<glm::ivec4> rects;
+
+  unsigned int visible; // total light-tile pairs of last cull
+};
+
+// GLSL helpers to iterate the lights of the current tile
+const char *shader_forward_plus = R"(
+uniform struct {
+  samplerBuffer lights;
+  usamplerBuffer indices;
+  usamplerBuffer tiles;
+  int tile;
+  int tiles_x;
+} grid;
+
+struct grid_light_t {
+  vec3 position;
+  float radius;
+  vec3 color;
+  float cutoff_outer;
+  vec3 direction;
+  float cutoff_inner;
+};
+
+// Offset and count of the lights of the tile of this fragment
+uvec2 forward_tile() {
+  ivec2 tile = ivec2(gl_FragCoord.xy) / grid.tile;
+  return texelFetch(grid.tiles, tile.y * grid.tiles_x + tile.x).rg;
+}
+
+grid_light_t forward_light(uint i) {
+  int base = int(texelFetch(grid.indices, int(i)).r) * 3;
+  vec4 a = texelFetch(grid.lights, base + 0);
+  vec4 b = texelFetch(grid.lights, base + 1);
+  vec4 c = texelFetch(grid.lights, base + 2);
+  return grid_light_t(a.xyz, a.w, b.rgb, b.a, c.xyz, c.w);
+}
+
+// Windowed inverse square falloff, reaches zero at the radius
+float forward_attenuation(grid_light_t light, vec3 P, vec3 L) {
+  float distance = length(light.position - P);
+  float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+  float cone = clamp((dot(L, normalize(-light.direction)) - light.cutoff_outer)
+    / (light.cutoff_inner - light.cutoff_outer), 0.0, 1.0);
+  return window * window * cone / (1.0 + distance * distance);
+}
+)";
+
+light_grid_t light_grid_create(int width, int height, int tile = 16,
+                               int capacity = 1024);
+void light_grid_destroy(light_grid_t &grid);
+
+// Bin the lights in the tiles they can touch and upload the lists
+void light_grid_cull(light_grid_t &grid, const std::vector<light_t> &lights,
+                     const glm::mat4 &view, const glm::mat4 &proj,
+                     float near = 0.1f);
+
+// Bind the three buffers starting from the slot and set the uniforms
+void light_grid_bind(const light_grid_t &grid, const program_t &program,
+                     int slot);
+
+#ifdef GLIB_FORWARD_IMPL
+#undef GLIB_FORWARD_IMPL
+
+light_t light_point(const glm::vec3 &position, const glm::vec3 &color,
+                    float radius) {
+  // Cone wider than any angle
+  return {.position = position,
+          .radius = radius,
+          .color = color,
+          .direction = glm::vec3(0.0f, -1.0f, 0.0f),
+          .cutoff_inner = -1.0f,
+          .cutoff_outer = -2.0f};
+}
+
+light_t light_spot(const glm::vec3 &position, const glm::vec3 &direction,
+                   const glm::vec3 &color, float radius, float inner_deg,
+                   float outer_deg) {
+  return {.position = position,
+          .radius = radius,
+          .color = color,
+          .direction = glm::normalize(direction),
+          .cutoff_inner = glm::cos(glm::radians(inner_deg)),
+          .cutoff_outer = glm::cos(glm::radians(outer_deg))};
+}
+
+static void grid_texture_buffer(unsigned int &buffer, unsigned int &texture,
+                                unsigned int format, size_t bytes) {
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+  gpu_memory_track(GPU_BUFFER, buffer, bytes, "light_grid");
+
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_BUFFER, texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+light_grid_t light_grid_create(int width, int height, int tile,
+                               int capacity) {
+  light_grid_t result = {};
+  result.width = width;
+  result.height = height;
+  result.tile = tile;
+  result.tiles_x = (width + tile - 1) / tile;
+  result.tiles_y = (height + tile - 1) / tile;
+  result.capacity = capacity;
+
+  // Start assuming an average of 32 lights per tile, grows on demand
+  int tiles = result.tiles_x * result.tiles_y;
+  result.index_capacity = tiles * 32;
+
+  grid_texture_buffer(result.light_buffer, result.light_texture, GL_RGBA32F,
+                      sizeof(float) * 12 * capacity);
+  grid_texture_buffer(result.index_buffer, result.index_texture, GL_R32UI,
+                      sizeof(unsigned int) * result.index_capacity);
+  grid_texture_buffer(result.tile_buffer, result.tile_texture, GL_RG32UI,
+                      sizeof(unsigned int) * 2 * tiles);
+
+  result.light_data.reserve(12 * capacity);
+  result.indices.reserve(result.index_capacity);
+  result.tiles.resize(2 * tiles);
+  result.rects.reserve(capacity);
+
+  printf("created light grid(%dx%d tiles of %dpx)\n", result.tiles_x,
+         result.tiles_y, tile);
+  return result;
+}
+
+void light_grid_destroy(light_grid_t &grid) {
+  unsigned int buffers[3] = {grid.light_buffer, grid.index_buffer,
+                             grid.tile_buffer};
+  unsigned int textures[3] = {grid.light_texture, grid.index_texture,
+                              grid.tile_texture};
+  for (unsigned int buffer : buffers)
+    gpu_memory_untrack(GPU_BUFFER, buffer);
+  glDeleteBuffers(3, buffers);
+  glDeleteTextures(3, textures);
+  grid = {};
+}
+
+// Conservative screen rectangle in tiles of a sphere in view space,
+// empty (x > z) when it is behind the near plane
+static glm::ivec4 grid_sphere_rect(const light_grid_t &grid,
+                                   const glm::vec3 &center, float radius,
+                                   const glm::mat4 &proj, float near) {
+  const glm::ivec4 empty(1, 1, 0, 0);
+  if (center.z - radius > -near)
+    return empty;
+
+  // Crossing the near plane, assume the full screen
+  glm::ivec4 full(0, 0, grid.tiles_x - 1, grid.tiles_y - 1);
+  if (center.z + radius > -near)
+    return full;
+
+  // Project the corners of the bounding box
+  glm::vec2 lo(1.0f), hi(-1.0f);
+  for (int i = 0; i < 8; ++i) {
+    glm::vec3 corner = center + radius * glm::vec3((i & 1) ? 1.0f : -1.0f,
+                                                   (i & 2) ? 1.0f : -1.0f,
+                                                   (i & 4) ? 1.0f : -1.0f);
+    glm::vec4 clip = proj * glm::vec4(corner, 1.0f);
+    glm::vec2 ndc = glm::vec2(clip) / clip.w;
+    lo = glm::min(lo, ndc);
+    hi = glm::max(hi, ndc);
+  }
+
+  if (lo.x > 1.0f || lo.y > 1.0f || hi.x < -1.0f || hi.y < -1.0f)
+    return empty;
+
+  lo = glm::clamp(lo, glm::vec2(-1.0f), glm::vec2(1.0f));
+  hi = glm::clamp(hi, glm::vec2(-1.0f), glm::vec2(1.0f));
+
+  glm::vec2 size((float)grid.width / grid.tile, (float)grid.height / grid.tile);
+  glm::ivec2 a = glm::ivec2((lo * 0.5f + 0.5f) * size);
+  glm::ivec2 b = glm::ivec2((hi * 0.5f + 0.5f) * size);
+  return glm::ivec4(std::max(a.x, 0), std::max(a.y, 0),
+                    std::min(b.x, grid.tiles_x - 1),
+                    std::min(b.y, grid.tiles_y - 1));
+}
+
+void light_grid_cull(light_grid_t &grid, const std::vector<light_t> &lights,
+                     const glm::mat4 &view, const glm::mat4 &proj,
+                     float near) {
+  GLIB_ZONE("light_grid_cull");
+  int count = std::min((int)lights.size(), grid.capacity);
+  int tiles = grid.tiles_x * grid.tiles_y;
+
+  grid.light_data.clear();
+  grid.rects.clear();
+  std::fill(grid.tiles.begin(), grid.tiles.end(), 0u);
+
+  // Pack lights and count how many touch each tile
+  for (int i = 0; i < count; ++i) {
+    const light_t &light = lights[i];
+    const float data[12] = {
+        light.position.x,  light.position.y,  light.position.z,
+        light.radius,      light.color.x,     light.color.y,
+        light.color.z,     light.cutoff_outer, light.direction.x,
+        light.direction.y, light.direction.z, light.cutoff_inner};
+    grid.light_data.insert(grid.light_data.end(), data, data + 12);
+
+    glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+    glm::ivec4 rect = grid_sphere_rect(grid, center, light.radius, proj, near);
+    grid.rects.push_back(rect);
+
+    for (int y = rect.y; y <= rect.w; ++y)
+      for (int x = rect.x; x <= rect.z; ++x)
+        grid.tiles[2 * (y * grid.tiles_x + x) + 1] += 1;
+  }
+
+  // Prefix sum of the counts gives the offsets
+  unsigned int offset = 0;
+  for (int t = 0; t < tiles; ++t) {
+    grid.tiles[2 * t] = offset;
+    offset += grid.tiles[2 * t + 1];
+    grid.tiles[2 * t + 1] = 0;
+  }
+  grid.visible = offset;
+
+  // Scatter the light indices
+  grid.indices.resize(offset);
+  for (int i = 0; i < count; ++i) {
+    const glm::ivec4 &rect = grid.rects[i];
+    for (int y = rect.y; y <= rect.w; ++y)
+      for (int x = rect.x; x <= rect.z; ++x) {
+        unsigned int *tile = &grid.tiles[2 * (y * grid.tiles_x + x)];
+        grid.indices[tile[0] + tile[1]++] = i;
+      }
+  }
+
+  // Upload, orphaning the previous storage
+  GLIB_GL(glBindBuffer(GL_TEXTURE_BUFFER, grid.light_buffer));
+  gl_buffer_data(GL_TEXTURE_BUFFER, sizeof(float) * 12 * grid.capacity, NULL,
+                 GL_STREAM_DRAW);
+  gl_buffer_sub_data(GL_TEXTURE_BUFFER, 0,
+                     sizeof(float) * grid.light_data.size(),
+                     grid.light_data.data());
+
+  if (offset > grid.index_capacity) {
+    grid.index_capacity = offset + offset / 2;
+    gpu_memory_track(GPU_BUFFER, grid.index_buffer,
+                     sizeof(unsigned int) * grid.index_capacity, "light_grid");
+  }
+  GLIB_GL(glBindBuffer(GL_TEXTURE_BUFFER, grid.index_buffer));
+  gl_buffer_data(GL_TEXTURE_BUFFER, sizeof(unsigned int) * grid.index_capacity,
+                 NULL, GL_STREAM_DRAW);
+  gl_buffer_sub_data(GL_TEXTURE_BUFFER, 0, sizeof(unsigned int) * offset,
+                     grid.indices.data());
+
+  GLIB_GL(glBindBuffer(GL_TEXTURE_BUFFER, grid.tile_buffer));
+  gl_buffer_data(GL_TEXTURE_BUFFER, sizeof(unsigned int) * grid.tiles.size(),
+                 grid.tiles.data(), GL_STREAM_DRAW);
+  GLIB_GL(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+}
+
+void light_grid_bind(const light_grid_t &grid, const program_t &program,
+                     int slot) {
+  GLIB_GL(glActiveTexture(GL_TEXTURE0 + slot));
+  gl_bind_texture(GL_TEXTURE_BUFFER, grid.light_texture);
+  GLIB_GL(glActiveTexture(GL_TEXTURE0 + slot + 1));
+  gl_bind_texture(GL_TEXTURE_BUFFER, grid.index_texture);
+  GLIB_GL(glActiveTexture(GL_TEXTURE0 + slot + 2));
+  gl_bind_texture(GL_TEXTURE_BUFFER, grid.tile_texture);
+
+  program_uniform_1i(program, "grid.lights", slot);
+  program_uniform_1i(program, "grid.indices", slot + 1);
+  program_uniform_1i(program, "grid.tiles", slot + 2);
+  program_uniform_1i(program, "grid.tile", grid.tile);
+  program_uniform_1i(program, "grid.tiles_x", grid.tiles_x);
+}
+
+#endif
+
+} // namespace glib
@@ -7,20 +7,26 @@ namespace glib {
 struct gbuffer_t {
   unsigned int id;
   texture_t position, normal, color;
+  texture_t velocity; // only when created with motion vectors
   texture_t depth;
 };
 
-gbuffer_t gbuffer_create();
-#define gbuffer_bind(buffer) glBindFramebuffer(GL_FRAMEBUFFER, buffer.id)
-#define gbuffer_unbind() glBindFramebuffer(GL_FRAMEBUFFER, 0)
+// Create the geometry buffer, optionally with a fourth attachment holding
+// screen-space motion (xy) and previous/current view depth (zw)
+gbuffer_t gbuffer_create(int width, int height, bool velocity = false);
+void gbuffer_destroy(gbuffer_t &gbuffer);
+#define gbuffer_bind(buffer)                                                   \
+  glib::gl_bind_framebuffer(GL_FRAMEBUFFER, buffer.id)
+#define gbuffer_unbind() framebuffer_default_bind()
 
 #ifdef GLIB_GBUFFER_IMPL
 #undef GLIB_GBUFFER_IMPL
 
-gbuffer_t gbuffer_create(int width, int height) {
+gbuffer_t gbuffer_create(int width, int height, bool velocity) {
 
   unsigned int gBuffer;
   unsigned int gPosition, gNormal, gColorSpec;
+  unsigned int gVelocity = 0;
   unsigned int rboDepth;
 
   glGenFramebuffers(1, &gBuffer);
@@ -53,6 +59,18 @@ gbuffer_t gbuffer_create(int width, int height) {
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     }
 
+    // Motion vectors for temporal reprojection
+    if (velocity) {
+      glGenTextures(1, &gVelocity);
+      glBindTexture(GL_TEXTURE_2D, gVelocity);
+      {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA,
+                     GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      }
+    }
+
     // Define all attachments
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
                            gPosition, 0);
@@ -60,11 +78,14 @@ gbuffer_t gbuffer_create(int width, int height) {
                            gNormal, 0);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D,
                            gColorSpec, 0);
+    if (velocity)
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3,
+                             GL_TEXTURE_2D, gVelocity, 0);
 
     // Where rendering will be done
-    unsigned int attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
-                                   GL_COLOR_ATTACHMENT2};
-    glDrawBuffers(3, attachments);
+    unsigned int attachments[4] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                                   GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+    glDrawBuffers(velocity ? 4 : 3, attachments);
 
     // Attach a depth buffer
     glGenRenderbuffers(1, &rboDepth);
@@ -80,15 +101,41 @@ gbuffer_t gbuffer_create(int width, int height) {
       exit(1);
     }
   }
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  framebuffer_default_bind();
+
+  // Render targets have no mipmaps
+  gpu_memory_scope_t scope("gbuffer");
+  size_t bytes16f = texture_bytes(GL_RGBA16F, width, height, false);
+  gpu_memory_track(GPU_TEXTURE, gPosition, bytes16f);
+  gpu_memory_track(GPU_TEXTURE, gNormal, bytes16f);
+  gpu_memory_track(GPU_TEXTURE, gColorSpec,
+                   texture_bytes(GL_RGBA8, width, height, false));
+  if (velocity)
+    gpu_memory_track(GPU_TEXTURE, gVelocity, bytes16f);
+  gpu_memory_track(GPU_RENDERBUFFER, rboDepth,
+                   texture_bytes(GL_DEPTH_COMPONENT, width, height, false));
 
   return {.id = gBuffer,
           .position = {.id = gPosition},
           .normal = {.id = gNormal},
           .color = {.id = gColorSpec},
+          .velocity = {.id = gVelocity},
           .depth = {.id = rboDepth}};
 }
 
+void gbuffer_destroy(gbuffer_t &gbuffer) {
+  texture_destroy(gbuffer.position);
+  texture_destroy(gbuffer.normal);
+  texture_destroy(gbuffer.color);
+  if (gbuffer.velocity.id != 0)
+    texture_destroy(gbuffer.velocity);
+
+  gpu_memory_untrack(GPU_RENDERBUFFER, gbuffer.depth.id);
+  glDeleteRenderbuffers(1, &gbuffer.depth.id);
+  glDeleteFramebuffers(1, &gbuffer.id);
+  gbuffer = {};
+}
+
 #endif
 
 } // namespace glib
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "graphics.hpp"
+
+// Pipeline statistics of ARB_pipeline_statistics_query, core in 4.6
+#ifndef GL_VERTICES_SUBMITTED
+#define GL_VERTICES_SUBMITTED 0x82EE
+#define GL_FRAGMENT_SHADER_INVOCATIONS 0x82F4
+#endif
+
+namespace glib {
+
+// Maximum passes per frame and frames between issue and readback
+#define GPU_TIMER_PASSES 16
+#define GPU_TIMER_LATENCY 4
+
+// Resolved measures of a pass, accumulated across frames
+struct gpu_pass_t {
+  const char *name;
+  double ms;       // last resolved frame
+  double total_ms; // sum over all resolved frames
+  unsigned long samples;
+  unsigned long dropped; // samples longer than their frame, left out
+
+  // Pipeline statistics of the last frame, zero if not supported
+  uint64_t vertices;
+  uint64_t fragments;
+};
+
+struct gpu_timer_t {
+  // Ring of query objects, one row per frame in flight
+  unsigned int elapsed[GPU_TIMER_LATENCY][GPU_TIMER_PASSES];
+  unsigned int statistics[GPU_TIMER_LATENCY][GPU_TIMER_PASSES][2];
+  unsigned int stamps[GPU_TIMER_LATENCY];
+  const char *names[GPU_TIMER_LATENCY][GPU_TIMER_PASSES];
+  int counts[GPU_TIMER_LATENCY];
+  bool issued[GPU_TIMER_LATENCY];
+  unsigned long started[GPU_TIMER_LATENCY]; // frame each slot was issued in
+
+  // Frames issued, slots issued before reset_frame are not measured
+  unsigned long issued_frames;
+  unsigned long reset_frame;
+
+  int slot;
+  bool open;
+  bool pipeline_statistics;
+
+  gpu_pass_t passes[GPU_TIMER_PASSES];
+  int pass_count;
+
+  // GPU time between the starts of two resolved frames
+  uint64_t last_stamp;
+  double frame_ms;
+  double frame_total_ms;
+  unsigned long frame_samples;
+
+  unsigned long frames;  // frames resolved
+  unsigned long dropped; // frames whose results were not ready in time
+};
+
+gpu_timer_t gpu_timer_create(bool statistics = true);
+void gpu_timer_destroy(gpu_timer_t &timer);
+
+// Start a new frame, reads back the results of GPU_TIMER_LATENCY frames ago
+void gpu_timer_frame(gpu_timer_t &timer);
+
+// Passes can not nest, the name must outlive the timer
+void gpu_timer_begin(gpu_timer_t &timer, const char *name);
+void gpu_timer_end(gpu_timer_t &timer);
+
+// Forget the accumulated measures, for example after a warmup. Frames still
+// in flight are not measured.
+void gpu_timer_reset(gpu_timer_t &timer);
+
+// Resolved measures of a pass, NULL if never timed
+const gpu_pass_t *gpu_timer_pass(const gpu_timer_t &timer, const char *name);
+
+// Times the enclosing scope
+struct gpu_zone_t {
+  gpu_timer_t &timer;
+  gpu_zone_t(gpu_timer_t &timer, const char *name) : timer(timer) {
+    gpu_timer_begin(timer, name);
+  }
+  ~gpu_zone_t() { gpu_timer_end(timer); }
+};
+
+#define GLIB_GPU_CONCAT_(a, b) a##b
+#define GLIB_GPU_CONCAT(a, b) GLIB_GPU_CONCAT_(a, b)
+#define GLIB_GPU_ZONE(timer, name)                                             \
+  glib::gpu_zone_t GLIB_GPU_CONCAT(gpu_zone_, __LINE__)(timer, name)
+
+#ifdef GLIB_GPU_TIMER_IMPL
+#undef GLIB_GPU_TIMER_IMPL
+
+static bool gpu_extension_supported(const char *name) {
+  int count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (int i = 0; i < count; ++i)
+    if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+      return true;
+  return false;
+}
+
+gpu_timer_t gpu_timer_create(bool statistics) {
+  gpu_timer_t result = {};
+  result.pipeline_statistics =
+      statistics &&
+      (GLAD_GL_VERSION_4_6 ||
+       gpu_extension_supported("GL_ARB_pipeline_statistics_query"));
+
+  glGenQueries(GPU_TIMER_LATENCY * GPU_TIMER_PASSES, &result.elapsed[0][0]);
+  glGenQueries(GPU_TIMER_LATENCY, result.stamps);
+  if (result.pipeline_statistics)
+    glGenQueries(GPU_TIMER_LATENCY * GPU_TIMER_PASSES * 2,
+                 &result.statistics[0][0][0]);
+
+  // First gpu_timer_frame moves to slot 0
+  result.slot = GPU_TIMER_LATENCY - 1;
+
+  printf("created gpu timer(statistics: %d)\n", result.pipeline_statistics);
+  return result;
+}
+
+void gpu_timer_destroy(gpu_timer_t &timer) {
+  assert(!timer.open && "Timer destroyed inside a gpu pass");
+  glDeleteQueries(GPU_TIMER_LATENCY * GPU_TIMER_PASSES, &timer.elapsed[0][0]);
+  glDeleteQueries(GPU_TIMER_LATENCY, timer.stamps);
+  if (timer.pipeline_statistics)
+    glDeleteQueries(GPU_TIMER_LATENCY * GPU_TIMER_PASSES * 2,
+                    &timer.statistics[0][0][0]);
+  timer = {};
+}
+
+static gpu_pass_t &gpu_timer_find(gpu_timer_t &timer, const char *name) {
+  for (int i = 0; i < timer.pass_count; ++i)
+    if (strcmp(timer.passes[i].name, name) == 0)
+      return timer.passes[i];
+
+  assert(timer.pass_count < GPU_TIMER_PASSES && "Too many gpu passes");
+  gpu_pass_t &pass = timer.passes[timer.pass_count++];
+  pass = {.name = name};
+  return pass;
+}
+
+// Read the results of a slot, false if they are not ready
+static bool gpu_timer_resolve(gpu_timer_t &timer, int slot) {
+  int available = 0;
+  glGetQueryObjectiv(timer.stamps[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+    return false;
+
+  // Passes ended before the stamp of the next frame, their statistics last
+  int count = timer.counts[slot];
+  if (count > 0) {
+    unsigned int last = timer.pipeline_statistics
+                            ? timer.statistics[slot][count - 1][1]
+                            : timer.elapsed[slot][count - 1];
+    glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      return false;
+  }
+
+  uint64_t stamp;
+  glGetQueryObjectui64v(timer.stamps[slot], GL_QUERY_RESULT, &stamp);
+  int64_t now = 0;
+  glGetInteger64v(GL_TIMESTAMP, &now);
+  if (timer.last_stamp != 0) {
+    timer.frame_ms = (stamp - timer.last_stamp) / 1e6;
+    timer.frame_total_ms += timer.frame_ms;
+    timer.frame_samples += 1;
+  }
+  timer.last_stamp = stamp;
+
+  for (int i = 0; i < count; ++i) {
+    gpu_pass_t &pass = gpu_timer_find(timer, timer.names[slot][i]);
+
+    uint64_t ns;
+    glGetQueryObjectui64v(timer.elapsed[slot][i], GL_QUERY_RESULT, &ns);
+
+    // Passes end before now, llvmpipe may return a timestamp instead of a
+    // duration for a query begun right after the frame stamp
+    if (ns > (uint64_t)now - stamp) {
+      pass.dropped += 1;
+      continue;
+    }
+    pass.ms = ns / 1e6;
+    pass.total_ms += pass.ms;
+    pass.samples += 1;
+
+    if (timer.pipeline_statistics) {
+      glGetQueryObjectui64v(timer.statistics[slot][i][0], GL_QUERY_RESULT,
+                            &pass.vertices);
+      glGetQueryObjectui64v(timer.statistics[slot][i][1], GL_QUERY_RESULT,
+                            &pass.fragments);
+    }
+  }
+
+  timer.frames += 1;
+  return true;
+}
+
+void gpu_timer_frame(gpu_timer_t &timer) {
+  assert(!timer.open && "Frame started inside a gpu pass");
+
+  // Oldest frame is about to be reused, never wait for it. Frames issued
+  // before a reset are dropped unread.
+  timer.slot = (timer.slot + 1) % GPU_TIMER_LATENCY;
+  if (timer.issued[timer.slot] &&
+      timer.started[timer.slot] >= timer.reset_frame &&
+      !gpu_timer_resolve(timer, timer.slot)) {
+    timer.dropped += 1;
+    timer.last_stamp = 0;
+  }
+
+  timer.counts[timer.slot] = 0;
+  timer.issued[timer.slot] = true;
+  timer.started[timer.slot] = ++timer.issued_frames;
+  glQueryCounter(timer.stamps[timer.slot], GL_TIMESTAMP);
+}
+
+void gpu_timer_begin(gpu_timer_t &timer, const char *name) {
+  assert(!timer.open && "Gpu passes can not nest");
+
+  int &count = timer.counts[timer.slot];
+  assert(count < GPU_TIMER_PASSES && "Too many gpu passes in a frame");
+
+  timer.names[timer.slot][count] = name;
+  glBeginQuery(GL_TIME_ELAPSED, timer.elapsed[timer.slot][count]);
+  if (timer.pipeline_statistics) {
+    glBeginQuery(GL_VERTICES_SUBMITTED, timer.statistics[timer.slot][count][0]);
+    glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS,
+                 timer.statistics[timer.slot][count][1]);
+  }
+  timer.open = true;
+}
+
+void gpu_timer_end(gpu_timer_t &timer) {
+  assert(timer.open && "No gpu pass to end");
+
+  glEndQuery(GL_TIME_ELAPSED);
+  if (timer.pipeline_statistics) {
+    glEndQuery(GL_VERTICES_SUBMITTED);
+    glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+  }
+
+  timer.counts[timer.slot] += 1;
+  timer.open = false;
+}
+
+void gpu_timer_reset(gpu_timer_t &timer) {
+  for (int i = 0; i < timer.pass_count; ++i) {
+    timer.passes[i].total_ms = 0.0;
+    timer.passes[i].samples = 0;
+    timer.passes[i].dropped = 0;
+  }
+  timer.frame_total_ms = 0.0;
+  timer.frame_samples = 0;
+  timer.frames = 0;
+  timer.dropped = 0;
+
+  // Frames in flight were issued before the reset
+  timer.reset_frame = timer.issued_frames + 1;
+  timer.last_stamp = 0;
+}
+
+const gpu_pass_t *gpu_timer_pass(const gpu_timer_t &timer, const char *name) {
+  for (int i = 0; i < timer.pass_count; ++i)
+    if (strcmp(timer.passes[i].name, name) == 0)
+      return &timer.passes[i];
+  return NULL;
+}
+
+#endif
+
+} // namespace glib
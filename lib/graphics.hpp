@@ -1,17 +1,50 @@
 #pragma once
 
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <cassert>
+#include <condition_variable>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image/stb_image.h>
 
+// Profiler, counters, memory and allocation tracking state lives with the
+// graphics implementation, so do the asset files, their encoders and cache
+// and the jobs loading them
+#ifdef GLIB_GRAPHICS_IMPL
+#define GLIB_PROFILE_IMPL
+#define GLIB_STATS_IMPL
+#define GLIB_MEMORY_IMPL
+#define GLIB_ALLOC_IMPL
+#define GLIB_BAKED_IMPL
+#define GLIB_BC_IMPL
+#define GLIB_DDS_IMPL
+#define GLIB_CACHE_IMPL
+#define GLIB_JOBS_IMPL
+#define GLIB_MIPMAP_IMPL
+#endif
+#include "allocations.hpp"
+#include "baked.hpp"
+#include "bc.hpp"
+#include "cache.hpp"
+#include "dds.hpp"
+#include "jobs.hpp"
+#include "memory.hpp"
+#include "mipmap.hpp"
+#include "profiler.hpp"
+#include "stats.hpp"
+
 namespace glib {
 
 using index_t = unsigned int;
@@ -33,75 +66,92 @@ struct texture_t {
   unsigned int id;
 };
 
+// Framebuffer standing for the window one, an offscreen FBO when headless
+extern unsigned int framebuffer_default;
+#define framebuffer_default_bind()                                             \
+  glib::gl_bind_framebuffer(GL_FRAMEBUFFER, glib::framebuffer_default)
+
 // Basic position layout
 std::function<void(void)> basic_layout = []() {
   // Position
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
+  GLIB_GL(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+                                (void *)0));
+  GLIB_GL(glEnableVertexAttribArray(0));
 };
 
 // Basic position + color layout
 std::function<void(void)> color_layout = []() {
   // Position
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
+  GLIB_GL(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                                (void *)0));
+  GLIB_GL(glEnableVertexAttribArray(0));
   // Color
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
+  GLIB_GL(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                                (void *)(3 * sizeof(float))));
+  GLIB_GL(glEnableVertexAttribArray(1));
 };
 
 // Position + Color + UV layout
 std::function<void(void)> texture_layout = []() {
   // Position
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
+  GLIB_GL(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
+                                (void *)0));
+  GLIB_GL(glEnableVertexAttribArray(0));
   // Color
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
+  GLIB_GL(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
+                                (void *)(3 * sizeof(float))));
+  GLIB_GL(glEnableVertexAttribArray(1));
   // UV
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
-                        (void *)(6 * sizeof(float)));
-  glEnableVertexAttribArray(2);
+  GLIB_GL(glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
+                                (void *)(6 * sizeof(float))));
+  GLIB_GL(glEnableVertexAttribArray(2));
 };
 
 // Position + Normal + Tangent + Coords
 std::function<void(void)> layout_3F3F3F2F = []() {
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
-                        (void *)0);
-  glEnableVertexAttribArray(0); // Position
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1); // Normal
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
-                        (void *)(6 * sizeof(float)));
-  glEnableVertexAttribArray(2); // Tangent
-  glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
-                        (void *)(9 * sizeof(float)));
-  glEnableVertexAttribArray(3);
+  GLIB_GL(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
+                                (void *)0));
+  GLIB_GL(glEnableVertexAttribArray(0)); // Position
+  GLIB_GL(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
+                                (void *)(3 * sizeof(float))));
+  GLIB_GL(glEnableVertexAttribArray(1)); // Normal
+  GLIB_GL(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
+                                (void *)(6 * sizeof(float))));
+  GLIB_GL(glEnableVertexAttribArray(2)); // Tangent
+  GLIB_GL(glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
+                                (void *)(9 * sizeof(float))));
+  GLIB_GL(glEnableVertexAttribArray(3));
 };
 
 std::function<void(void)> layout_3F2F = []() {
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0); // Position
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1); // UV
+  GLIB_GL(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
+                                (void *)0));
+  GLIB_GL(glEnableVertexAttribArray(0)); // Position
+  GLIB_GL(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
+                                (void *)(3 * sizeof(float))));
+  GLIB_GL(glEnableVertexAttribArray(1)); // UV
 };
 
 // Create a VAO using a VBO and a EBO, a lambda is used to determine the
 // attributes layout
 buffer_t buffer_create(std::vector<float> *data, std::vector<index_t> *indices,
                        std::function<void(void)> lambda = basic_layout);
-#define buffer_bind(buffer) glBindVertexArray(buffer.vao)
-#define buffer_unbind() glBindVertexArray(0)
+// Same from spans, a mapped file for example, indices may be NULL
+buffer_t buffer_create(const float *data, size_t floats,
+                       const index_t *indices, size_t index_count,
+                       std::function<void(void)> lambda = basic_layout);
+void buffer_destroy(buffer_t &buffer);
+#define buffer_bind(buffer) glib::gl_bind_vertex_array(buffer.vao)
+#define buffer_unbind() glib::gl_bind_vertex_array(0)
 
 // Create program from vertex and fragment source
 program_t program_create(const char *vertex, const char *fragment);
 program_t program_load(const char *filepath);
-#define program_bind(program) glUseProgram(program.id)
-#define program_unbind() glUseProgram(0)
+void program_destroy(program_t &program);
+// Insert code right after the #version line of a shader source
+std::string shader_insert(const char *source, const char *code);
+#define program_bind(program) glib::gl_use_program(program.id)
+#define program_unbind() glib::gl_use_program(0)
 
 void program_uniform_1i(const program_t &program, const char *name, int value);
 void program_uniform_1f(const program_t &program, const char *name,
@@ -112,11 +162,130 @@ void program_uniform_3f(const program_t &program, const char *name, float x,
                         float y, float z);
 void program_uniform_mf(const program_t &program, const char *name,
                         float *data);
+// Source a uniform block from a binding point, ignored if the block is unused
+void program_uniform_block(const program_t &program, const char *name,
+                           unsigned int binding);
 
+// What a texture holds, how its levels are filtered and the formats it is
+// stored in: uncompressed and as encoded by texture_encode
+enum texture_role_e {
+  TEXTURE_ALBEDO, // colours, RGB8 or RGBA8, BC1 or BC3 with alpha
+  TEXTURE_MASK,   // one channel like specular or occlusion, R8 or BC4
+  TEXTURE_NORMAL, // tangent space normals, X and Y in RG8 or BC5, Z is
+                  // rebuilt by the shaders
+};
+
+// Load an image, an up to date .dds next to it (see dds.hpp) is loaded
+// instead with the levels it holds, compressed ones included. Images are
+// decoded once with their mip chain (see mipmap.hpp), then mapped from the
+// import cache (see cache.hpp). The channels kept follow the role, alpha
+// only if the source has it; the format argument is not needed anymore.
+// Loads of the same image are shared by the texture manager below.
 texture_t texture_load(const char *path, unsigned int format,
-                       unsigned int wrapping);
+                       unsigned int wrapping,
+                       texture_role_e role = TEXTURE_ALBEDO);
+
+// Bytes of the textures the manager keeps by default
+#define TEXTURE_BUDGET (512 << 20)
+
+// The texture manager shares the textures of texture_load, texture_load_async
+// and texture_load_streamed, keyed by the interned absolute path, the
+// wrapping and the role. Every load holds a reference that texture_destroy
+// drops. Textures nobody references stay loaded while the manager fits its
+// budget, the least recently released are freed first.
+struct texture_manager_stats_t {
+  unsigned long hits, misses, evictions;
+  size_t textures, referenced; // count
+  size_t resident, budget;     // bytes, as of the last load or release
+};
+
+// The shared texture of a path, load creates it on a miss. Holds a reference.
+// On the GL thread only: two misses of the same key must not run at once.
+texture_t texture_acquire(const char *path, unsigned int wrapping,
+                          texture_role_e role,
+                          const std::function<texture_t()> &load);
+// Look a texture up without loading it, from any thread. Holds a reference
+// when found.
+bool texture_find(const char *path, unsigned int wrapping,
+                  texture_role_e role, texture_t &texture);
+// Another reference, for holders like the upload queue
+void texture_retain(const texture_t &texture);
+
+void texture_manager_configure(size_t budget);
+// Free the textures nobody references until the manager fits in bytes
+void texture_manager_trim(size_t bytes);
+texture_manager_stats_t texture_manager_stats();
+
+// Decode an image, build its mip chain and write it compressed as the .dds
+// texture_load prefers
+bool texture_encode(const char *source, const char *destination,
+                    texture_role_e role = TEXTURE_ALBEDO);
+
+// Levels of an image as texture_load uploads them, rows bottom to top in a
+// format of dds.hpp, mapped from an encoded file or decoded in memory
+struct texture_pixels_t {
+  unsigned int format;
+  bool opaque;
+  int width, height, level_count;
+  dds_level_t levels[DDS_MAX_LEVELS];
+  dds_file_t file;
+  dds_image_t image;
+};
+
+// CPU side of texture_load, any thread can call it. False if the image is
+// missing or unreadable. Without s3tc encoded BC1 and BC3 files are skipped
+// for the source image.
+bool texture_pixels_load(const char *path, texture_pixels_t &pixels,
+                         texture_role_e role = TEXTURE_ALBEDO,
+                         bool s3tc = true);
+void texture_pixels_free(texture_pixels_t &pixels);
+// Specify every level in the bound texture, from the pixel buffer bound to
+// GL_PIXEL_UNPACK_BUFFER when staged, the levels following each other in it.
+// Returns the bytes the texture takes.
+size_t texture_pixels_specify(const texture_pixels_t &pixels,
+                              bool staged = false);
+// Specify one level in the bound texture from memory, or empty it to free
+// its storage. Returns the bytes the level takes.
+size_t texture_pixels_specify_level(const texture_pixels_t &pixels, int level,
+                                    bool empty = false);
+
+// Decoding jobs of a loader returning textures before their image, like
+// texture_load_async and texture_load_streamed
+struct texture_decoder_t {
+  std::mutex mutex;
+  std::condition_variable decoded;
+  size_t decoding = 0;
+};
+
+// A texture holding its placeholder while a job decodes its image
+struct texture_pending_t {
+  texture_t texture;
+  std::string path;
+  texture_pixels_t pixels;
+  bool decoded, failed; // guarded by the decoder mutex
+};
+
+// texture_acquire for those loaders. On a miss the texture is created with
+// a 1x1 RGBA8 placeholder, mid grey if NULL, pending gives where its image
+// is decoded and the loader holds one more reference until it is done.
+texture_t texture_acquire_pending(
+    texture_decoder_t &decoder, const char *path, unsigned int wrapping,
+    const unsigned char *placeholder, texture_role_e role,
+    const std::function<texture_pending_t &(const texture_t &)> &pending);
+// True once the job is done, failed if the image could not be loaded
+bool texture_pending_decoded(texture_decoder_t &decoder,
+                             const texture_pending_t &pending, bool &failed);
+void texture_decoder_wait(texture_decoder_t &decoder);
+
+// Internal format of the levels of a format of dds.hpp, 0 if unknown.
+// Opaque RGBA is stored without alpha.
+unsigned int texture_internal_format(unsigned int format,
+                                     bool opaque = false);
+// On the GL thread, S3TC is an extension
+bool texture_format_supported(unsigned int format);
 void texture_bind(const texture_t &texture, int slot);
-#define texture_unbind() glBindTexture(GL_TEXTURE_2D, 0);
+void texture_destroy(texture_t &texture);
+#define texture_unbind() glib::gl_bind_texture(GL_TEXTURE_2D, 0);
 
 // Render a buffer with a program
 void render(const buffer_t &buffer, const program_t &program,
@@ -125,29 +294,42 @@ void render(const buffer_t &buffer, const program_t &program,
 #ifdef GLIB_GRAPHICS_IMPL
 #undef GLIB_GRAPHICS_IMPL
 
+unsigned int framebuffer_default = 0;
+
 buffer_t buffer_create(std::vector<float> *data, std::vector<index_t> *indices,
                        std::function<void(void)> lambda) {
   assert(data && "Data must be provided!");
+  return buffer_create(data->data(), data->size(),
+                       indices ? indices->data() : NULL,
+                       indices ? indices->size() : 0, lambda);
+}
+
+buffer_t buffer_create(const float *data, size_t floats,
+                       const index_t *indices, size_t index_count,
+                       std::function<void(void)> lambda) {
+  GLIB_ZONE("buffer_create");
+  assert(data && "Data must be provided!");
 
   buffer_t result = {};
-  result.v_count = data->size();
+  result.v_count = floats;
 
   // How to draw the element
   result.draw = GLIB_DRAW_ARRAYS;
   if (indices != NULL) {
-    result.e_count = indices->size();
+    result.e_count = index_count;
     result.draw = GLIB_DRAW_ELEMENTS;
   }
 
   glGenVertexArrays(1, &result.vao);
-  glBindVertexArray(result.vao);
+  gl_bind_vertex_array(result.vao);
   {
     glGenBuffers(1, &result.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, result.vbo);
+    GLIB_GL(glBindBuffer(GL_ARRAY_BUFFER, result.vbo));
     {
       // Set buffer data
-      glBufferData(GL_ARRAY_BUFFER, sizeof(float) * result.v_count,
-                   data->data(), GL_STATIC_DRAW);
+      gl_buffer_data(GL_ARRAY_BUFFER, sizeof(float) * result.v_count, data,
+                     GL_STATIC_DRAW);
+      gpu_memory_track(GPU_BUFFER, result.vbo, sizeof(float) * result.v_count);
       // Set buffer layout
       lambda();
 
@@ -160,21 +342,35 @@ buffer_t buffer_create(std::vector<float> *data, std::vector<index_t> *indices,
     // Add elements buffer
     if (indices != NULL) {
       glGenBuffers(1, &result.ebo);
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, result.ebo);
+      GLIB_GL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, result.ebo));
       {
         // Set buffer data
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_t) * result.e_count,
-                     indices->data(), GL_STATIC_DRAW);
+        gl_buffer_data(GL_ELEMENT_ARRAY_BUFFER,
+                       sizeof(index_t) * result.e_count, indices,
+                       GL_STATIC_DRAW);
+        gpu_memory_track(GPU_BUFFER, result.ebo,
+                         sizeof(index_t) * result.e_count);
       }
     }
   }
-  glBindVertexArray(0);
+  gl_bind_vertex_array(0);
 
   printf("created buffer(vao: %d, vbo: %d, ebo: %d)\n", result.vao, result.vbo,
          result.ebo);
   return result;
 }
 
+void buffer_destroy(buffer_t &buffer) {
+  gpu_memory_untrack(GPU_BUFFER, buffer.vbo);
+  glDeleteBuffers(1, &buffer.vbo);
+  if (buffer.ebo != 0) {
+    gpu_memory_untrack(GPU_BUFFER, buffer.ebo);
+    glDeleteBuffers(1, &buffer.ebo);
+  }
+  glDeleteVertexArrays(1, &buffer.vao);
+  buffer = {};
+}
+
 static inline bool check_shader_compilation(unsigned int id) {
 
   int success;
@@ -208,6 +404,7 @@ static inline bool check_shader_linking(unsigned int id) {
 }
 
 program_t program_create(const char *vertex, const char *fragment) {
+  GLIB_ZONE("program_create");
 
   unsigned int vid = glCreateShader(GL_VERTEX_SHADER);
   glShaderSource(vid, 1, &vertex, NULL);
@@ -237,17 +434,32 @@ program_t program_create(const char *vertex, const char *fragment) {
   return {.id = sid};
 }
 
+void program_destroy(program_t &program) {
+  glDeleteProgram(program.id);
+  program = {};
+}
+
+std::string shader_insert(const char *source, const char *code) {
+  std::string result{source};
+
+  size_t line = result.find("#version");
+  line = (line == std::string::npos) ? 0 : result.find('\n', line) + 1;
+  result.insert(line, std::string(code) + "\n");
+  return result;
+}
+
 void render(const buffer_t &buffer, const program_t &program,
             unsigned int mode) {
+  GLIB_ZONE("render");
   program_bind(program);
   buffer_bind(buffer);
 
   switch (buffer.draw) {
   case GLIB_DRAW_ARRAYS:
-    glDrawArrays(mode, 0, buffer.v_count);
+    gl_draw_arrays(mode, 0, buffer.v_count);
     break;
   case GLIB_DRAW_ELEMENTS:
-    glDrawElements(mode, buffer.e_count, GL_UNSIGNED_INT, 0);
+    gl_draw_elements(mode, buffer.e_count, GL_UNSIGNED_INT, 0);
     break;
   default:
     printf("Unknown draw mode!\n");
@@ -259,46 +471,318 @@ void render(const buffer_t &buffer, const program_t &program,
 }
 
 void program_uniform_1i(const program_t &program, const char *name, int value) {
+  GLIB_ZONE("program_uniform");
   program_bind(program);
-  glUniform1i(glGetUniformLocation(program.id, name), value);
+  int location = GLIB_GL(glGetUniformLocation(program.id, name));
+  GLIB_GL_UNIFORM(glUniform1i(location, value));
   program_unbind();
 }
 
 void program_uniform_1f(const program_t &program, const char *name,
                         float value) {
+  GLIB_ZONE("program_uniform");
   program_bind(program);
-  glUniform1f(glGetUniformLocation(program.id, name), value);
+  int location = GLIB_GL(glGetUniformLocation(program.id, name));
+  GLIB_GL_UNIFORM(glUniform1f(location, value));
   program_unbind();
 }
 
 void program_uniform_2f(const program_t &program, const char *name, float x,
                         float y) {
+  GLIB_ZONE("program_uniform");
   program_bind(program);
-  glUniform2f(glGetUniformLocation(program.id, name), x, y);
+  int location = GLIB_GL(glGetUniformLocation(program.id, name));
+  GLIB_GL_UNIFORM(glUniform2f(location, x, y));
   program_unbind();
 }
 
 void program_uniform_3f(const program_t &program, const char *name, float x,
                         float y, float z) {
+  GLIB_ZONE("program_uniform");
   program_bind(program);
-  glUniform3f(glGetUniformLocation(program.id, name), x, y, z);
+  int location = GLIB_GL(glGetUniformLocation(program.id, name));
+  GLIB_GL_UNIFORM(glUniform3f(location, x, y, z));
   program_unbind();
 }
 
 void program_uniform_mf(const program_t &program, const char *name,
                         float *data) {
+  GLIB_ZONE("program_uniform");
   program_bind(program);
-  glUniformMatrix4fv(glGetUniformLocation(program.id, name), 1, GL_FALSE, data);
+  int location = GLIB_GL(glGetUniformLocation(program.id, name));
+  GLIB_GL_UNIFORM(glUniformMatrix4fv(location, 1, GL_FALSE, data));
   program_unbind();
 }
 
-texture_t texture_load(const char *path, unsigned int format,
-                       unsigned int wrapping) {
-  stbi_set_flip_vertically_on_load(true);
+void program_uniform_block(const program_t &program, const char *name,
+                           unsigned int binding) {
+  unsigned int index = GLIB_GL(glGetUniformBlockIndex(program.id, name));
+  if (index != GL_INVALID_INDEX)
+    GLIB_GL(glUniformBlockBinding(program.id, index, binding));
+}
+
+// Bumped when texture_encode changes what it writes
+#define TEXTURE_CACHE_VERSION 3
 
-  int width, height, channels;
-  unsigned char *data = stbi_load(path, &width, &height, &channels, 0);
-  if (data == NULL) {
+// EXT_texture_compression_s3tc and EXT_texture_sRGB, glad only has the core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// Flipped like GL expects, the flag is set only for this thread. Decoded to
+// one channel or to RGBA, opaque if the source has no alpha.
+static bool texture_decode(const char *path, dds_image_t &image,
+                           int channels = 4) {
+  GLIB_ZONE("texture_decode");
+  stbi_set_flip_vertically_on_load_thread(true);
+  int width, height, source;
+  unsigned char *data = stbi_load(path, &width, &height, &source, channels);
+  if (data == NULL)
+    return false;
+
+  image = {.format = channels == 1 ? DDS_R8 : DDS_RGBA8,
+           .opaque = source == 1 || source == 3,
+           .width = width,
+           .height = height};
+  image.levels.emplace_back(data, data + (size_t)width * height * channels);
+  stbi_image_free(data);
+  return true;
+}
+
+// Every level of an RGBA image to RG
+static void texture_pack_rg(dds_image_t &image) {
+  for (std::vector<unsigned char> &level : image.levels) {
+    size_t count = level.size() / 4;
+    for (size_t i = 0; i < count; ++i) {
+      level[i * 2] = level[i * 4];
+      level[i * 2 + 1] = level[i * 4 + 1];
+    }
+    level.resize(count * 2);
+  }
+  image.format = DDS_RG8;
+}
+
+// Colours are filtered as light, normals stay unit vectors
+static unsigned int texture_mip_flags(texture_role_e role) {
+  return role == TEXTURE_ALBEDO ? MIP_SRGB
+         : role == TEXTURE_NORMAL ? MIP_NORMALS
+                                  : 0;
+}
+
+static void texture_pixels_mapped(texture_pixels_t &pixels) {
+  pixels.format = pixels.file.format;
+  pixels.opaque = pixels.file.opaque;
+  pixels.width = pixels.file.width;
+  pixels.height = pixels.file.height;
+  pixels.level_count = pixels.file.level_count;
+  std::copy(pixels.file.levels, pixels.file.levels + pixels.level_count,
+            pixels.levels);
+}
+
+static void texture_pixels_decoded(texture_pixels_t &pixels) {
+  pixels.format = pixels.image.format;
+  pixels.opaque = pixels.image.opaque;
+  pixels.width = pixels.image.width;
+  pixels.height = pixels.image.height;
+  pixels.level_count = pixels.image.levels.size();
+  int width = pixels.width, height = pixels.height;
+  for (int i = 0; i < pixels.level_count; ++i) {
+    const std::vector<unsigned char> &level = pixels.image.levels[i];
+    pixels.levels[i] = {width, height, level.data(), level.size()};
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+}
+
+// Files of other tools carry no role, their format has to hold the channels
+// the role needs
+static bool texture_encoded_for(const dds_file_t &file, texture_role_e role) {
+  if (file.role != 0)
+    return file.role == (unsigned int)role + 1;
+  switch (file.format) {
+  case DDS_R8:
+  case DDS_BC4:
+    return role == TEXTURE_MASK;
+  case DDS_RG8:
+  case DDS_BC5:
+    return role != TEXTURE_ALBEDO;
+  }
+  return true;
+}
+
+bool texture_pixels_load(const char *path, texture_pixels_t &pixels,
+                         texture_role_e role, bool s3tc) {
+  GLIB_ZONE("texture_pixels_load");
+  pixels = {};
+
+  // Encoded by glib_bake, used while it is up to date and for the same role
+  namespace fs = std::filesystem;
+  std::error_code error;
+  fs::path encoded = fs::path(path).replace_extension(".dds");
+  if (fs::exists(encoded, error) &&
+      fs::last_write_time(encoded, error) >= fs::last_write_time(path, error) &&
+      dds_open(encoded.c_str(), pixels.file)) {
+    unsigned int format = pixels.file.format;
+    if ((s3tc || (format != DDS_BC1 && format != DDS_BC1_SRGB &&
+                  format != DDS_BC3 && format != DDS_BC3_SRGB)) &&
+        texture_encoded_for(pixels.file, role)) {
+      texture_pixels_mapped(pixels);
+      return true;
+    }
+    dds_close(pixels.file);
+  }
+
+  // Encoded in the cache on a miss, a corrupt entry is encoded again. The
+  // levels are filtered for the role, it is part of the key.
+  uint64_t key =
+      cache_enabled() ? cache_key(path, role, TEXTURE_CACHE_VERSION) : 0;
+  std::string entry = key != 0 ? cache_path(key, ".dds") : "";
+  if (key != 0 && fs::exists(entry, error)) {
+    if (dds_open(entry.c_str(), pixels.file, true)) {
+      cache_touch(entry);
+      texture_pixels_mapped(pixels);
+      return true;
+    }
+    cache_remove(entry);
+  }
+
+  // Normals are filtered with their Z, then only X and Y are kept
+  if (!texture_decode(path, pixels.image, role == TEXTURE_MASK ? 1 : 4))
+    return false;
+  mip_generate(pixels.image, texture_mip_flags(role));
+  if (role == TEXTURE_NORMAL)
+    texture_pack_rg(pixels.image);
+  pixels.image.role = role + 1;
+  if (key != 0 && dds_write(entry.c_str(), pixels.image))
+    cache_insert(entry);
+  texture_pixels_decoded(pixels);
+  return true;
+}
+
+void texture_pixels_free(texture_pixels_t &pixels) {
+  dds_close(pixels.file);
+  pixels = {};
+}
+
+// A level from data, a pixel buffer offset when staged
+static void texture_specify_level(const texture_pixels_t &pixels, int level,
+                                  int width, int height, size_t size,
+                                  const void *data) {
+  unsigned int internal = texture_internal_format(pixels.format, pixels.opaque);
+  unsigned int channels = pixels.format == DDS_R8    ? GL_RED
+                          : pixels.format == DDS_RG8 ? GL_RG
+                                                     : GL_RGBA;
+  if (dds_block_size(pixels.format) != 0)
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, internal, width, height, 0,
+                           size, data);
+  else
+    glTexImage2D(GL_TEXTURE_2D, level, internal, width, height, 0, channels,
+                 GL_UNSIGNED_BYTE, data);
+}
+
+size_t texture_pixels_specify(const texture_pixels_t &pixels, bool staged) {
+  unsigned int internal = texture_internal_format(pixels.format, pixels.opaque);
+  bool compressed = dds_block_size(pixels.format) != 0;
+  size_t offset = 0;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int i = 0; i < pixels.level_count; ++i) {
+    const dds_level_t &level = pixels.levels[i];
+    texture_specify_level(pixels, i, level.width, level.height, level.size,
+                          staged ? (const void *)offset : level.data);
+    offset += level.size;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  // Levels as encoded, generated if there is only one, blocks can not be
+  if (pixels.level_count > 1 || compressed) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    pixels.level_count - 1);
+    return compressed ? offset
+                      : texture_bytes(internal, pixels.width, pixels.height,
+                                      true);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  return texture_bytes(internal, pixels.width, pixels.height, true);
+}
+
+size_t texture_pixels_specify_level(const texture_pixels_t &pixels, int level,
+                                    bool empty) {
+  const dds_level_t &source = pixels.levels[level];
+  if (empty) {
+    texture_specify_level(pixels, level, 0, 0, 0, NULL);
+    return 0;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  texture_specify_level(pixels, level, source.width, source.height,
+                        source.size, source.data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  if (dds_block_size(pixels.format) != 0)
+    return source.size;
+  return texture_bytes(texture_internal_format(pixels.format, pixels.opaque),
+                       source.width, source.height, false);
+}
+
+unsigned int texture_internal_format(unsigned int format, bool opaque) {
+  switch (format) {
+  case DDS_RGBA8:
+    return opaque ? GL_RGB8 : GL_RGBA8;
+  case DDS_RGBA8_SRGB:
+    return opaque ? GL_SRGB8 : GL_SRGB8_ALPHA8;
+  case DDS_RG8:
+    return GL_RG8;
+  case DDS_R8:
+    return GL_R8;
+  case DDS_BC1:
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  case DDS_BC1_SRGB:
+    return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+  case DDS_BC3:
+    return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  case DDS_BC3_SRGB:
+    return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+  case DDS_BC4:
+    return GL_COMPRESSED_RED_RGTC1;
+  case DDS_BC5:
+    return GL_COMPRESSED_RG_RGTC2;
+  }
+  return 0;
+}
+
+bool texture_format_supported(unsigned int format) {
+  unsigned int internal = texture_internal_format(format);
+  if (internal == 0)
+    return false;
+  bool s3tc = format == DDS_BC1 || format == DDS_BC1_SRGB ||
+              format == DDS_BC3 || format == DDS_BC3_SRGB;
+  if (!s3tc)
+    return true;
+
+  // Looked up once, -1 until then
+  static int supported = -1;
+  if (supported < 0) {
+    int count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    supported = 0;
+    for (int i = 0; i < count; ++i)
+      if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i),
+                 "GL_EXT_texture_compression_s3tc") == 0)
+        supported = 1;
+  }
+  return supported == 1;
+}
+
+// What texture_load creates on a miss of the manager
+static texture_t texture_create(const char *path, unsigned int wrapping,
+                                texture_role_e role) {
+  texture_pixels_t pixels;
+  if (!texture_pixels_load(path, pixels, role,
+                           texture_format_supported(DDS_BC1))) {
     std::cout << "ERROR::TEXTURE: Unable to load " << path << "\n";
     exit(1);
   }
@@ -313,21 +797,313 @@ texture_t texture_load(const char *path, unsigned int format,
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
                     GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, format,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
   }
+  size_t bytes = texture_pixels_specify(pixels);
   glBindTexture(GL_TEXTURE_2D, 0);
+  gpu_memory_track(GPU_TEXTURE, tid, bytes, NULL, path);
 
-  stbi_image_free(data);
+  texture_pixels_free(pixels);
   printf("loaded texture(id: %d)\n", tid);
   return {.id = tid};
 }
 
+texture_t texture_load(const char *path, unsigned int, unsigned int wrapping,
+                       texture_role_e role) {
+  GLIB_ZONE("texture_load");
+  return texture_acquire(path, wrapping, role, [&] {
+    return texture_create(path, wrapping, role);
+  });
+}
+
+bool texture_encode(const char *source, const char *destination,
+                    texture_role_e role) {
+  GLIB_ZONE("texture_encode");
+  dds_image_t image;
+  if (!texture_decode(source, image)) {
+    std::cout << "ERROR::TEXTURE: Unable to load " << source << "\n";
+    return false;
+  }
+  mip_generate(image, texture_mip_flags(role));
+  image.role = role + 1;
+
+  // Colours keep their alpha only if some pixel needs it
+  unsigned int format = DDS_BC1;
+  if (role == TEXTURE_MASK)
+    format = DDS_BC4;
+  else if (role == TEXTURE_NORMAL)
+    format = DDS_BC5;
+  else
+    for (size_t i = 3; i < image.levels[0].size() && format == DDS_BC1; i += 4)
+      if (image.levels[0][i] != 255)
+        format = DDS_BC3;
+
+  dds_image_t blocks;
+  bc_compress(image, format, blocks);
+  if (!dds_write(destination, blocks))
+    return false;
+  int bc = format == DDS_BC1   ? 1
+           : format == DDS_BC3 ? 3
+           : format == DDS_BC4 ? 4
+                               : 5;
+  printf("encoded %s to %s (BC%d, %zu levels)\n", source, destination, bc,
+         blocks.levels.size());
+  return true;
+}
+
 void texture_bind(const texture_t &texture, int slot) {
-  glActiveTexture(GL_TEXTURE0 + slot);
-  glBindTexture(GL_TEXTURE_2D, texture.id);
+  GLIB_GL(glActiveTexture(GL_TEXTURE0 + slot));
+  gl_bind_texture(GL_TEXTURE_2D, texture.id);
+}
+
+// A path is stored once, keys compare the pointers
+struct texture_key_t {
+  const std::string *path;
+  unsigned int wrapping;
+  texture_role_e role;
+  bool operator==(const texture_key_t &other) const {
+    return path == other.path && wrapping == other.wrapping &&
+           role == other.role;
+  }
+};
+
+struct texture_key_hash_t {
+  size_t operator()(const texture_key_t &key) const {
+    return std::hash<const void *>()(key.path) ^
+           (size_t)key.wrapping * 31 ^ (size_t)key.role * 131;
+  }
+};
+
+struct texture_entry_t {
+  texture_key_t key;
+  unsigned int references;
+  unsigned long released; // tick of the last release, the order of eviction
+  size_t bytes;           // as tracked when last looked at
+};
+
+struct texture_manager_t {
+  std::mutex mutex; // lookups come from any thread
+  // Paths of the loaded textures, with the entries using each
+  std::unordered_map<std::string, unsigned int> paths;
+  std::unordered_map<texture_key_t, unsigned int, texture_key_hash_t> ids;
+  std::unordered_map<unsigned int, texture_entry_t> entries; // by id
+  size_t budget = TEXTURE_BUDGET;
+  unsigned long tick = 0;
+  texture_manager_stats_t stats = {};
+};
+static texture_manager_t texture_manager;
+
+// Relative spellings of the same file share the key
+static std::string texture_normal_path(const char *path) {
+  std::error_code error;
+  return std::filesystem::absolute(path, error).lexically_normal().string();
+}
+
+// Texture of a normal path, 0 if not loaded. With the manager locked,
+// nothing is interned for paths never loaded.
+static unsigned int texture_manager_find(const std::string &path,
+                                         unsigned int wrapping,
+                                         texture_role_e role) {
+  auto interned = texture_manager.paths.find(path);
+  if (interned == texture_manager.paths.end())
+    return 0;
+  auto found = texture_manager.ids.find({&interned->first, wrapping, role});
+  return found != texture_manager.ids.end() ? found->second : 0;
+}
+
+// With the manager locked, on the GL thread. The textures of the async and
+// streamed loaders change size when uploaded.
+static void texture_manager_evict(size_t bytes) {
+  texture_manager_t &manager = texture_manager;
+  size_t resident = 0;
+  std::vector<std::pair<unsigned long, unsigned int>> released;
+  for (auto &[id, entry] : manager.entries) {
+    entry.bytes = gpu_memory_bytes(GPU_TEXTURE, id);
+    resident += entry.bytes;
+    if (entry.references == 0)
+      released.push_back({entry.released, id});
+  }
+
+  std::sort(released.begin(), released.end());
+  for (auto [tick, id] : released) {
+    if (resident <= bytes)
+      break;
+    texture_entry_t &entry = manager.entries[id];
+    resident -= entry.bytes;
+    manager.ids.erase(entry.key);
+    auto interned = manager.paths.find(*entry.key.path);
+    if (--interned->second == 0)
+      manager.paths.erase(interned);
+    manager.entries.erase(id);
+    gpu_memory_untrack(GPU_TEXTURE, id);
+    glDeleteTextures(1, &id);
+    manager.stats.evictions += 1;
+    printf("evicted texture(id: %d)\n", id);
+  }
+}
+
+texture_t texture_acquire(const char *path, unsigned int wrapping,
+                          texture_role_e role,
+                          const std::function<texture_t()> &load) {
+  texture_manager_t &manager = texture_manager;
+  std::string normal = texture_normal_path(path);
+  {
+    std::lock_guard<std::mutex> lock(manager.mutex);
+    unsigned int id = texture_manager_find(normal, wrapping, role);
+    if (id != 0) {
+      manager.entries[id].references += 1;
+      manager.stats.hits += 1;
+      return {.id = id};
+    }
+    manager.stats.misses += 1;
+  }
+
+  // Only the GL thread loads, a miss can not race another one
+  texture_t result = load();
+  std::lock_guard<std::mutex> lock(manager.mutex);
+  auto interned = manager.paths.try_emplace(normal, 0).first;
+  interned->second += 1;
+  texture_key_t key = {&interned->first, wrapping, role};
+  manager.ids[key] = result.id;
+  manager.entries[result.id] = {
+      .key = key,
+      .references = 1,
+      .released = 0,
+      .bytes = gpu_memory_bytes(GPU_TEXTURE, result.id)};
+  texture_manager_evict(manager.budget);
+  return result;
+}
+
+bool texture_find(const char *path, unsigned int wrapping,
+                  texture_role_e role, texture_t &texture) {
+  std::string normal = texture_normal_path(path);
+  std::lock_guard<std::mutex> lock(texture_manager.mutex);
+  unsigned int id = texture_manager_find(normal, wrapping, role);
+  if (id == 0)
+    return false;
+  texture_manager.entries[id].references += 1;
+  texture = {.id = id};
+  return true;
+}
+
+void texture_retain(const texture_t &texture) {
+  std::lock_guard<std::mutex> lock(texture_manager.mutex);
+  auto found = texture_manager.entries.find(texture.id);
+  if (found != texture_manager.entries.end())
+    found->second.references += 1;
+}
+
+void texture_manager_configure(size_t budget) {
+  std::lock_guard<std::mutex> lock(texture_manager.mutex);
+  texture_manager.budget = budget;
+  texture_manager_evict(budget);
+}
+
+void texture_manager_trim(size_t bytes) {
+  std::lock_guard<std::mutex> lock(texture_manager.mutex);
+  texture_manager_evict(bytes);
+}
+
+texture_manager_stats_t texture_manager_stats() {
+  std::lock_guard<std::mutex> lock(texture_manager.mutex);
+  texture_manager_stats_t result = texture_manager.stats;
+  result.budget = texture_manager.budget;
+  for (auto &[id, entry] : texture_manager.entries) {
+    result.textures += 1;
+    result.referenced += entry.references > 0;
+    result.resident += entry.bytes;
+  }
+  return result;
+}
+
+// The placeholder is the only level until the image is specified
+static unsigned int texture_placeholder(const char *path,
+                                        unsigned int wrapping,
+                                        const unsigned char *placeholder) {
+  static const unsigned char grey[4] = {128, 128, 128, 255};
+
+  unsigned int tid;
+  glGenTextures(1, &tid);
+  glBindTexture(GL_TEXTURE_2D, tid);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapping);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapping);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               placeholder != NULL ? placeholder : grey);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  gpu_memory_track(GPU_TEXTURE, tid, texture_bytes(GL_RGB, 1, 1, false), NULL,
+                   path);
+  return tid;
+}
+
+texture_t texture_acquire_pending(
+    texture_decoder_t &decoder, const char *path, unsigned int wrapping,
+    const unsigned char *placeholder, texture_role_e role,
+    const std::function<texture_pending_t &(const texture_t &)> &pending) {
+  bool created = false;
+  texture_t result = texture_acquire(path, wrapping, role, [&] {
+    texture_t texture = {.id = texture_placeholder(path, wrapping,
+                                                   placeholder)};
+    texture_pending_t *target = &pending(texture);
+    target->texture = texture;
+    target->path = path;
+
+    bool s3tc = texture_format_supported(DDS_BC1);
+    {
+      std::lock_guard<std::mutex> lock(decoder.mutex);
+      decoder.decoding += 1;
+    }
+    jobs_submit(jobs_shared(), [&decoder, target, role, s3tc] {
+      bool loaded = texture_pixels_load(target->path.c_str(), target->pixels,
+                                        role, s3tc);
+      std::lock_guard<std::mutex> lock(decoder.mutex);
+      target->decoded = true;
+      target->failed = !loaded;
+      decoder.decoding -= 1;
+      decoder.decoded.notify_all();
+    });
+
+    created = true;
+    printf("requested texture(id: %d)\n", texture.id);
+    return texture;
+  });
+  if (created)
+    texture_retain(result);
+  return result;
+}
+
+bool texture_pending_decoded(texture_decoder_t &decoder,
+                             const texture_pending_t &pending, bool &failed) {
+  std::lock_guard<std::mutex> lock(decoder.mutex);
+  failed = pending.failed;
+  return pending.decoded;
+}
+
+void texture_decoder_wait(texture_decoder_t &decoder) {
+  std::unique_lock<std::mutex> lock(decoder.mutex);
+  decoder.decoded.wait(lock, [&] { return decoder.decoding == 0; });
+}
+
+// A texture of the manager is only released, freed when evicted
+void texture_destroy(texture_t &texture) {
+  {
+    std::lock_guard<std::mutex> lock(texture_manager.mutex);
+    auto found = texture_manager.entries.find(texture.id);
+    if (found != texture_manager.entries.end()) {
+      texture_entry_t &entry = found->second;
+      if (entry.references > 0 && --entry.references == 0) {
+        entry.released = ++texture_manager.tick;
+        texture_manager_evict(texture_manager.budget);
+      }
+      texture = {};
+      return;
+    }
+  }
+  gpu_memory_untrack(GPU_TEXTURE, texture.id);
+  glDeleteTextures(1, &texture.id);
+  texture = {};
 }
 
 #endif
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "graphics.hpp"
+
+namespace glib {
+
+// 8 bit image, rows top to bottom
+struct image_t {
+  int width, height, channels;
+  std::vector<unsigned char> pixels;
+};
+
+// Read the RGB of a framebuffer attachment (GL_COLOR_ATTACHMENTi or GL_BACK).
+// Values are stored as clamp(value * scale + bias), so signed or unbounded
+// attachments like positions and normals fit in 8 bits.
+image_t image_read(unsigned int fbo, unsigned int attachment, int width,
+                   int height, float scale = 1.0f, float bias = 0.0f);
+
+// Load any format of stb_image, false if it is missing or unreadable
+bool image_load(const char *path, image_t &image);
+bool image_write_png(const char *path, const image_t &image);
+
+// PNG file of an image in memory, the encoder of image_write_png
+std::vector<unsigned char> image_encode_png(const image_t &image);
+
+struct image_diff_t {
+  double psnr;    // dB over all channels, infinite when identical
+  double bad;     // ratio of pixels above the perceptual tolerance
+  double max;     // largest perceptual error, in [0, 1]
+  image_t errors; // heat map of the perceptual error
+};
+
+// Compare two RGB images of the same size. The perceptual error is a cheap
+// FLIP-like measure: a YCoCg distance weighting luma over chroma, taken as
+// the best match in the 3x3 neighbourhood of the reference so edges moved
+// by one pixel are not reported.
+image_diff_t image_compare(const image_t &image, const image_t &reference,
+                           float tolerance);
+
+#ifdef GLIB_IMAGE_IMPL
+#undef GLIB_IMAGE_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+namespace glib {
+
+image_t image_read(unsigned int fbo, unsigned int attachment, int width,
+                   int height, float scale, float bias) {
+  std::vector<float> data((size_t)width * height * 3);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+  glReadBuffer(attachment);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, data.data());
+
+  image_t result = {.width = width, .height = height, .channels = 3};
+  result.pixels.resize(data.size());
+
+  // GL rows go bottom to top
+  size_t row = (size_t)width * 3;
+  for (int y = 0; y < height; ++y) {
+    const float *src = &data[(height - 1 - y) * row];
+    unsigned char *dst = &result.pixels[y * row];
+    for (size_t i = 0; i < row; ++i) {
+      float value = std::clamp(src[i] * scale + bias, 0.0f, 1.0f);
+      dst[i] = (unsigned char)(value * 255.0f + 0.5f);
+    }
+  }
+  return result;
+}
+
+bool image_load(const char *path, image_t &image) {
+  int width, height, channels;
+  unsigned char *data = stbi_load(path, &width, &height, &channels, 0);
+  if (data == NULL)
+    return false;
+
+  image.width = width;
+  image.height = height;
+  image.channels = channels;
+  image.pixels.assign(data, data + (size_t)width * height * channels);
+  stbi_image_free(data);
+  return true;
+}
+
+// =============================================================================
+// PNG encoding, deflate with the fixed Huffman codes and greedy matching
+
+struct png_bits_t {
+  std::vector<unsigned char> &out;
+  uint32_t buffer;
+  int count;
+};
+
+static void png_put_bits(png_bits_t &bits, uint32_t value, int count) {
+  bits.buffer |= value << bits.count;
+  bits.count += count;
+  while (bits.count >= 8) {
+    bits.out.push_back(bits.buffer & 0xFF);
+    bits.buffer >>= 8;
+    bits.count -= 8;
+  }
+}
+
+// Huffman codes go most significant bit first
+static void png_put_code(png_bits_t &bits, uint32_t code, int count) {
+  uint32_t reversed = 0;
+  for (int i = 0; i < count; ++i)
+    reversed |= ((code >> i) & 1) << (count - 1 - i);
+  png_put_bits(bits, reversed, count);
+}
+
+static void png_put_symbol(png_bits_t &bits, int symbol) {
+  if (symbol < 144)
+    png_put_code(bits, 0x30 + symbol, 8);
+  else if (symbol < 256)
+    png_put_code(bits, 0x190 + symbol - 144, 9);
+  else if (symbol < 280)
+    png_put_code(bits, symbol - 256, 7);
+  else
+    png_put_code(bits, 0xC0 + symbol - 280, 8);
+}
+
+static const int png_length_base[] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                      11, 13, 15, 17,  19,  23,  27,  31,
+                                      35, 43, 51, 59,  67,  83,  99,  115,
+                                      131, 163, 195, 227, 258};
+static const int png_length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                       1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                       4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int png_distance_base[] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,    25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513,   769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+static const int png_distance_extra[] = {0, 0, 0,  0,  1,  1,  2,  2,
+                                         3, 3, 4,  4,  5,  5,  6,  6,
+                                         7, 7, 8,  8,  9,  9,  10, 10,
+                                         11, 11, 12, 12, 13, 13};
+
+static void png_put_match(png_bits_t &bits, int length, int distance) {
+  int l = 28;
+  while (png_length_base[l] > length)
+    --l;
+  png_put_symbol(bits, 257 + l);
+  png_put_bits(bits, length - png_length_base[l], png_length_extra[l]);
+
+  int d = 29;
+  while (png_distance_base[d] > distance)
+    --d;
+  png_put_code(bits, d, 5);
+  png_put_bits(bits, distance - png_distance_base[d], png_distance_extra[d]);
+}
+
+#define PNG_WINDOW 32768
+#define PNG_HASH_BITS 15
+
+static std::vector<unsigned char>
+png_zlib(const std::vector<unsigned char> &in) {
+  std::vector<unsigned char> out = {0x78, 0x01};
+  png_bits_t bits = {out, 0, 0};
+
+  // A single final block with the fixed codes
+  png_put_bits(bits, 1, 1);
+  png_put_bits(bits, 1, 2);
+
+  // Last position of each 3 byte sequence
+  std::vector<int> head(1 << PNG_HASH_BITS, -1);
+  size_t size = in.size();
+  size_t i = 0;
+  while (i < size) {
+    int length = 0, distance = 0;
+    if (i + 3 <= size) {
+      uint32_t hash = (in[i] << 16 | in[i + 1] << 8 | in[i + 2]);
+      hash = (hash * 2654435761u) >> (32 - PNG_HASH_BITS);
+      int candidate = head[hash];
+      head[hash] = (int)i;
+
+      if (candidate >= 0 && i - candidate <= PNG_WINDOW) {
+        size_t limit = std::min(size - i, (size_t)258);
+        size_t n = 0;
+        while (n < limit && in[candidate + n] == in[i + n])
+          ++n;
+        if (n >= 3) {
+          length = (int)n;
+          distance = (int)(i - candidate);
+        }
+      }
+    }
+
+    if (length > 0) {
+      png_put_match(bits, length, distance);
+      i += length;
+    } else {
+      png_put_symbol(bits, in[i]);
+      i += 1;
+    }
+  }
+  png_put_symbol(bits, 256);
+  png_put_bits(bits, 0, 7); // flush the last byte
+
+  uint32_t a = 1, b = 0;
+  for (unsigned char byte : in) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  uint32_t adler = (b << 16) | a;
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back((adler >> shift) & 0xFF);
+  return out;
+}
+
+static uint32_t png_crc(const unsigned char *data, size_t size,
+                        uint32_t crc = 0) {
+  static uint32_t table[256];
+  if (table[1] == 0)
+    for (uint32_t n = 0; n < 256; ++n) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; ++k)
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void png_put_u32(std::vector<unsigned char> &out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back((value >> shift) & 0xFF);
+}
+
+static void png_chunk(std::vector<unsigned char> &out, const char *type,
+                      const std::vector<unsigned char> &data) {
+  png_put_u32(out, data.size());
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  png_put_u32(out, png_crc(&out[start], out.size() - start));
+}
+
+static inline unsigned char png_paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+std::vector<unsigned char> image_encode_png(const image_t &image) {
+  const unsigned char color_types[] = {0, 0, 4, 2, 6};
+  size_t row = (size_t)image.width * image.channels;
+  int bpp = image.channels;
+
+  // Each row takes the filter with the smallest sum of residuals
+  std::vector<unsigned char> filtered;
+  filtered.reserve((row + 1) * image.height);
+  std::vector<unsigned char> zero(row, 0), best(row), candidate(row);
+  for (int y = 0; y < image.height; ++y) {
+    const unsigned char *cur = &image.pixels[y * row];
+    const unsigned char *up = y > 0 ? cur - row : zero.data();
+
+    unsigned long best_sum = ~0ul;
+    int best_filter = 0;
+    for (int filter = 0; filter < 5; ++filter) {
+      unsigned long sum = 0;
+      for (size_t x = 0; x < row; ++x) {
+        int left = x >= (size_t)bpp ? cur[x - bpp] : 0;
+        int corner = x >= (size_t)bpp ? up[x - bpp] : 0;
+        int predicted = 0;
+        switch (filter) {
+        case 1: predicted = left; break;
+        case 2: predicted = up[x]; break;
+        case 3: predicted = (left + up[x]) / 2; break;
+        case 4: predicted = png_paeth(left, up[x], corner); break;
+        }
+        candidate[x] = cur[x] - predicted;
+        sum += abs((signed char)candidate[x]);
+      }
+      if (sum < best_sum) {
+        best_sum = sum;
+        best_filter = filter;
+        best.swap(candidate);
+      }
+    }
+    filtered.push_back(best_filter);
+    filtered.insert(filtered.end(), best.begin(), best.end());
+  }
+
+  std::vector<unsigned char> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A,
+                                    '\n'};
+  std::vector<unsigned char> header;
+  png_put_u32(header, image.width);
+  png_put_u32(header, image.height);
+  header.insert(header.end(), {8, color_types[image.channels], 0, 0, 0});
+  png_chunk(out, "IHDR", header);
+  png_chunk(out, "IDAT", png_zlib(filtered));
+  png_chunk(out, "IEND", {});
+  return out;
+}
+
+bool image_write_png(const char *path, const image_t &image) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    printf("ERROR::IMAGE: Unable to write %s\n", path);
+    return false;
+  }
+  std::vector<unsigned char> png = image_encode_png(image);
+  fwrite(png.data(), 1, png.size(), file);
+  fclose(file);
+  return true;
+}
+
+// =============================================================================
+// Comparison
+
+// Luma weighs more than chroma, like the eye
+static inline void image_ycocg(const unsigned char *rgb, float out[3]) {
+  float r = rgb[0] / 255.0f, g = rgb[1] / 255.0f, b = rgb[2] / 255.0f;
+  out[0] = 0.25f * r + 0.5f * g + 0.25f * b;
+  out[1] = 0.5f * r - 0.5f * b;
+  out[2] = -0.25f * r + 0.5f * g - 0.25f * b;
+}
+
+static inline float image_distance(const float a[3], const float b[3]) {
+  float y = a[0] - b[0], co = a[1] - b[1], cg = a[2] - b[2];
+  return sqrtf(y * y + 0.25f * (co * co + cg * cg));
+}
+
+image_diff_t image_compare(const image_t &image, const image_t &reference,
+                           float tolerance) {
+  int width = image.width, height = image.height;
+  int channels = image.channels;
+  image_diff_t result = {};
+  result.errors = {.width = width, .height = height, .channels = 3};
+  result.errors.pixels.resize((size_t)width * height * 3);
+
+  double squared = 0.0;
+  size_t bad = 0;
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      size_t index = (size_t)y * width + x;
+      const unsigned char *pixel = &image.pixels[index * channels];
+      for (int c = 0; c < channels; ++c) {
+        double d = pixel[c] - reference.pixels[index * channels + c];
+        squared += d * d;
+      }
+
+      float a[3], b[3];
+      image_ycocg(pixel, a);
+      float error = std::numeric_limits<float>::max();
+      for (int dy = -1; dy <= 1; ++dy)
+        for (int dx = -1; dx <= 1; ++dx) {
+          int nx = std::clamp(x + dx, 0, width - 1);
+          int ny = std::clamp(y + dy, 0, height - 1);
+          image_ycocg(&reference.pixels[((size_t)ny * width + nx) * channels],
+                      b);
+          error = std::min(error, image_distance(a, b));
+        }
+
+      result.max = std::max(result.max, (double)error);
+      if (error > tolerance)
+        bad += 1;
+
+      // Bad pixels in red, the others as a dimmed grey of the error
+      unsigned char *heat = &result.errors.pixels[index * 3];
+      unsigned char level = std::min(error * 4.0f, 1.0f) * 255.0f;
+      heat[0] = error > tolerance ? 255 : level;
+      heat[1] = error > tolerance ? 0 : level;
+      heat[2] = error > tolerance ? 0 : level;
+    }
+
+  double mse = squared / ((double)width * height * channels);
+  result.psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse)
+                          : std::numeric_limits<double>::infinity();
+  result.bad = (double)bad / ((double)width * height);
+  return result;
+}
+
+#undef PNG_WINDOW
+#undef PNG_HASH_BITS
+
+#endif
+
+} // namespace glib
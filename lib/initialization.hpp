@@ -3,22 +3,181 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Counters and memory tracking are used here too, their state is emitted with
+// the graphics implementation
+#include "memory.hpp"
+#include "stats.hpp"
+
+#ifdef GLIB_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 namespace glib {
 
-// Create new window
-GLFWwindow* initialize(int width, int height, const char* name);
+// Framebuffer that stands for the window one, an offscreen FBO when headless
+extern unsigned int framebuffer_default;
+
+// Set when running without a display
+extern bool headless;
+
+// Create new window. With GLIB_HEADLESS=osmesa|egl or --headless[=egl] the
+// context is offscreen, --frames N or GLIB_FRAMES limits the frames rendered.
+GLFWwindow* initialize(int width, int height, const char* name,
+                       int argc = 0, char **argv = NULL);
+
+// True until the window is closed or the frame limit is reached
+bool window_running(GLFWwindow *window);
+// Swap buffers and poll events, counts the frames
+void window_present(GLFWwindow *window);
+
+// Release the offscreen framebuffer, report leaked GPU memory and terminate
+// GLFW. Returns the number of leaked allocations.
+unsigned int terminate();
 
 #ifdef GLIB_INIT_IMPL
 #undef GLIB_INIT_IMPL
 
-GLFWwindow* initialize(int width, int height, const char* name) {
+bool headless = false;
+
+// Frames rendered and frames to render, 0 for no limit
+static unsigned long frame_count = 0;
+static unsigned long frame_limit = 0;
+
+// Color and depth of the headless default framebuffer
+static unsigned int offscreen_color, offscreen_depth;
+
+#ifdef GLIB_EGL
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+
+// Surfaceless context, rendering goes only to framebuffer objects
+static bool initialize_egl() {
+  auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+      eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (get_platform_display != NULL)
+    egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                       EGL_DEFAULT_DISPLAY, NULL);
+  if (egl_display == EGL_NO_DISPLAY)
+    egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint major, minor;
+  if (!eglInitialize(egl_display, &major, &minor)) {
+    std::cout << "Couldn't initialize EGL\n";
+    return false;
+  }
+  eglBindAPI(EGL_OPENGL_API);
+
+  const EGLint config_attributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                                      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                      EGL_NONE};
+  EGLConfig config;
+  EGLint configs = 0;
+  eglChooseConfig(egl_display, config_attributes, &config, 1, &configs);
+
+  const EGLint context_attributes[] = {
+      EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE};
+  egl_context = eglCreateContext(egl_display, configs ? config : NULL,
+                                 EGL_NO_CONTEXT, context_attributes);
+  if (egl_context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                      egl_context)) {
+    std::cout << "Couldn't create surfaceless EGL context\n";
+    return false;
+  }
+
+  printf("created EGL %d.%d surfaceless context\n", major, minor);
+  return gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+}
+#endif
+
+// Offscreen framebuffer used in place of the window one
+static void initialize_offscreen(int width, int height) {
+  glGenRenderbuffers(1, &offscreen_color);
+  glBindRenderbuffer(GL_RENDERBUFFER, offscreen_color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  gpu_memory_track(GPU_RENDERBUFFER, offscreen_color,
+                   texture_bytes(GL_RGBA8, width, height, false), "offscreen");
+
+  glGenRenderbuffers(1, &offscreen_depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, offscreen_depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  gpu_memory_track(GPU_RENDERBUFFER, offscreen_depth,
+                   texture_bytes(GL_DEPTH24_STENCIL8, width, height, false),
+                   "offscreen");
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &framebuffer_default);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_default);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, offscreen_color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, offscreen_depth);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "Offscreen framebuffer is not complete!\n";
+    exit(1);
+  }
+  printf("created offscreen framebuffer(id: %d, %dx%d)\n",
+         framebuffer_default, width, height);
+}
+
+GLFWwindow* initialize(int width, int height, const char* name,
+                       int argc, char **argv) {
+
+  // Environment first, arguments override it
+  const char *mode = getenv("GLIB_HEADLESS");
+  if (mode != NULL && strcmp(mode, "") != 0 && strcmp(mode, "0") != 0)
+    headless = true;
+  if (getenv("GLIB_FRAMES") != NULL)
+    frame_limit = strtoul(getenv("GLIB_FRAMES"), NULL, 10);
+
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--headless", 10) == 0) {
+      headless = true;
+      mode = (argv[i][10] == '=') ? argv[i] + 11 : "osmesa";
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frame_limit = strtoul(argv[++i], NULL, 10);
+    }
+  }
+
+  // Offscreen runs always end
+  if (headless && frame_limit == 0)
+    frame_limit = 100;
+
+  bool egl = headless && strcmp(mode, "egl") == 0;
+  if (headless) {
+#if GLFW_VERSION_MAJOR > 3 || GLFW_VERSION_MINOR >= 4
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+    std::cout << "Headless mode needs GLFW 3.4, using a hidden window\n";
+#endif
+  }
+
   if (!glfwInit())
     return NULL;
-  
+
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+  if (headless) {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#if GLFW_VERSION_MAJOR > 3 || GLFW_VERSION_MINOR >= 4
+    // The window only provides input and time, EGL owns the context
+    if (egl)
+      glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    else
+      glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+  }
+
   GLFWwindow* window = glfwCreateWindow(width, height, name, NULL, NULL);
   if (window == NULL) {
     std::cout << "Couldn't create window\n";
@@ -26,16 +185,64 @@ GLFWwindow* initialize(int width, int height, const char* name) {
     return NULL;
   }
 
-  glfwMakeContextCurrent(window);
-  if (!gladLoadGLLoader(((GLADloadproc)glfwGetProcAddress))) {
+  bool loaded = false;
+  if (egl) {
+#ifdef GLIB_EGL
+    loaded = initialize_egl();
+#else
+    std::cout << "Built without EGL support (GLIB_EGL)\n";
+#endif
+  } else {
+    glfwMakeContextCurrent(window);
+    loaded = gladLoadGLLoader(((GLADloadproc)glfwGetProcAddress));
+  }
+
+  if (!loaded) {
     std::cout << "Couldn't load opengl\n";
     glfwTerminate();
     return NULL;
   }
 
+  if (headless)
+    initialize_offscreen(width, height);
+
+  printf("using %s (%s)\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
   return window;
 }
 
+bool window_running(GLFWwindow *window) {
+  if (frame_limit != 0 && frame_count >= frame_limit)
+    return false;
+  return !glfwWindowShouldClose(window);
+}
+
+void window_present(GLFWwindow *window) {
+  frame_count += 1;
+  frame_stats_end();
+
+  // Nothing to show, just submit the frame
+  if (headless)
+    glFlush();
+  else
+    glfwSwapBuffers(window);
+  glfwPollEvents();
+}
+
+unsigned int terminate() {
+  if (headless) {
+    gpu_memory_untrack(GPU_RENDERBUFFER, offscreen_color);
+    gpu_memory_untrack(GPU_RENDERBUFFER, offscreen_depth);
+    glDeleteFramebuffers(1, &framebuffer_default);
+    glDeleteRenderbuffers(1, &offscreen_color);
+    glDeleteRenderbuffers(1, &offscreen_depth);
+    framebuffer_default = 0;
+  }
+
+  unsigned int leaks = gpu_memory_leaks();
+  glfwTerminate();
+  return leaks;
+}
+
 #endif
 
 } // namespace glib
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace glib {
+
+struct jobs_queue_t;
+
+// Pool of worker threads running jobs in submission order. Jobs may submit
+// other jobs, a thread waiting on the pool runs queued jobs meanwhile.
+struct jobs_t {
+  int threads;
+  jobs_queue_t *queue;
+};
+
+// Start the workers, 0 uses every hardware thread
+jobs_t jobs_create(int threads = 0);
+// Waits for the jobs left
+void jobs_destroy(jobs_t &jobs);
+
+void jobs_submit(jobs_t &jobs, std::function<void()> job);
+// Wait until the pool is idle, not to be called from a job
+void jobs_wait(jobs_t &jobs);
+
+// Run job(i) for i in [0, count) on the pool and wait for all of them, jobs
+// can call it too
+void jobs_for(jobs_t &jobs, size_t count,
+              const std::function<void(size_t)> &job);
+
+// Pool of the loaders of glib, started on first use with GLIB_JOBS threads
+// or every hardware thread, stopped at exit
+jobs_t &jobs_shared();
+
+#ifdef GLIB_JOBS_IMPL
+#undef GLIB_JOBS_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace glib {
+
+struct jobs_queue_t {
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::deque<std::function<void()>> jobs;
+  size_t pending = 0; // queued or running
+  bool stop = false;
+};
+
+// Run one queued job, the lock is held on entry and on return
+static bool jobs_run_one(jobs_queue_t &queue,
+                         std::unique_lock<std::mutex> &lock) {
+  if (queue.jobs.empty())
+    return false;
+  std::function<void()> job = std::move(queue.jobs.front());
+  queue.jobs.pop_front();
+  lock.unlock();
+  job();
+  lock.lock();
+  queue.pending -= 1;
+  queue.done.notify_all();
+  return true;
+}
+
+static void jobs_worker(jobs_queue_t *queue) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  while (true) {
+    queue->wake.wait(lock, [&] { return queue->stop || !queue->jobs.empty(); });
+    if (queue->jobs.empty())
+      return;
+    jobs_run_one(*queue, lock);
+  }
+}
+
+jobs_t jobs_create(int threads) {
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  jobs_t result = {.threads = threads, .queue = new jobs_queue_t()};
+  for (int i = 0; i < threads; ++i)
+    result.queue->threads.emplace_back(jobs_worker, result.queue);
+  printf("created job pool(threads: %d)\n", threads);
+  return result;
+}
+
+void jobs_destroy(jobs_t &jobs) {
+  if (jobs.queue == NULL)
+    return;
+  jobs_wait(jobs);
+  {
+    std::lock_guard<std::mutex> lock(jobs.queue->mutex);
+    jobs.queue->stop = true;
+  }
+  jobs.queue->wake.notify_all();
+  for (std::thread &thread : jobs.queue->threads)
+    thread.join();
+  delete jobs.queue;
+  jobs = {};
+}
+
+void jobs_submit(jobs_t &jobs, std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(jobs.queue->mutex);
+    jobs.queue->jobs.push_back(std::move(job));
+    jobs.queue->pending += 1;
+  }
+  jobs.queue->wake.notify_one();
+}
+
+void jobs_wait(jobs_t &jobs) {
+  jobs_queue_t &queue = *jobs.queue;
+  std::unique_lock<std::mutex> lock(queue.mutex);
+  while (queue.pending > 0)
+    if (!jobs_run_one(queue, lock))
+      queue.done.wait(lock);
+}
+
+void jobs_for(jobs_t &jobs, size_t count,
+              const std::function<void(size_t)> &job) {
+  jobs_queue_t &queue = *jobs.queue;
+  size_t left = count; // guarded by the queue mutex
+  for (size_t i = 0; i < count; ++i)
+    jobs_submit(jobs, [&, i] {
+      job(i);
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      left -= 1;
+    });
+
+  std::unique_lock<std::mutex> lock(queue.mutex);
+  while (left > 0)
+    if (!jobs_run_one(queue, lock))
+      queue.done.wait(lock);
+}
+
+jobs_t &jobs_shared() {
+  static struct shared_t {
+    jobs_t jobs;
+    shared_t() {
+      const char *threads = getenv("GLIB_JOBS");
+      jobs = jobs_create(threads != NULL ? atoi(threads) : 0);
+    }
+    ~shared_t() { jobs_destroy(jobs); }
+  } shared;
+  return shared.jobs;
+}
+
+#endif
+
+} // namespace glib
@@ -0,0 +1,218 @@
+#ifndef GLIB_MEMORY_HPP
+#define GLIB_MEMORY_HPP
+
+#include <GLFW/glfw3.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace glib {
+
+enum gpu_resource_e { GPU_BUFFER, GPU_TEXTURE, GPU_RENDERBUFFER };
+
+// A live GL allocation
+struct gpu_allocation_t {
+  gpu_resource_e kind;
+  unsigned int id;
+  size_t bytes;
+  const char *subsystem;
+  std::string path; // asset the allocation comes from, may be empty
+};
+
+// Totals of a subsystem, or of everything under the name "total"
+struct gpu_memory_usage_t {
+  const char *subsystem;
+  size_t live, peak;
+  unsigned int count;
+};
+
+// Bytes of a texel of an uncompressed internal format, 0 if unknown
+size_t format_texel_bytes(unsigned int internal_format);
+// Bytes of a 2D texture, with the whole mip chain when mipmapped
+size_t texture_bytes(unsigned int internal_format, int width, int height,
+                     bool mipmapped);
+
+// Record an allocation, tracking the same object again replaces its size.
+// Without an explicit tag the one of the innermost gpu_memory_scope_t is used.
+void gpu_memory_track(gpu_resource_e kind, unsigned int id, size_t bytes,
+                      const char *subsystem = NULL, const char *path = NULL);
+void gpu_memory_untrack(gpu_resource_e kind, unsigned int id);
+// Bytes recorded for an object, 0 if it is not tracked
+size_t gpu_memory_bytes(gpu_resource_e kind, unsigned int id);
+
+// Live and peak bytes, the total first and then each subsystem
+std::vector<gpu_memory_usage_t> gpu_memory_usage();
+// Print the allocations still alive and return how many there are
+unsigned int gpu_memory_leaks();
+
+// Tags the allocations made while it is alive
+struct gpu_memory_scope_t {
+  const char *prev_subsystem, *prev_path;
+  gpu_memory_scope_t(const char *subsystem, const char *path = NULL);
+  ~gpu_memory_scope_t();
+};
+
+} // namespace glib
+
+#endif
+
+// Outside of the include guard, graphics.hpp emits the state even when
+// initialization.hpp included the declarations first
+#ifdef GLIB_MEMORY_IMPL
+#undef GLIB_MEMORY_IMPL
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+namespace glib {
+
+static std::unordered_map<uint64_t, gpu_allocation_t> gpu_allocations;
+static std::vector<gpu_memory_usage_t> gpu_usages = {{"total", 0, 0, 0}};
+
+// Innermost scope
+static const char *gpu_scope_subsystem = "untagged";
+static const char *gpu_scope_path = NULL;
+
+size_t format_texel_bytes(unsigned int internal_format) {
+  switch (internal_format) {
+  case GL_R8:
+    return 1;
+  case GL_RG8:
+  case GL_R16F:
+    return 2;
+  case GL_RGB:
+  case GL_RGB8:
+  case GL_SRGB8:
+    return 3;
+  case GL_RGBA:
+  case GL_RGBA8:
+  case GL_SRGB8_ALPHA8:
+  case GL_RG16F:
+  case GL_R32F:
+  case GL_R32UI:
+  case GL_DEPTH_COMPONENT:
+  case GL_DEPTH_COMPONENT24:
+  case GL_DEPTH_COMPONENT32F:
+  case GL_DEPTH24_STENCIL8:
+    return 4;
+  case GL_RGB16F:
+    return 6;
+  case GL_RGBA16F:
+  case GL_RG32F:
+  case GL_RG32UI:
+    return 8;
+  case GL_RGB32F:
+    return 12;
+  case GL_RGBA32F:
+    return 16;
+  default:
+    return 0;
+  }
+}
+
+size_t texture_bytes(unsigned int internal_format, int width, int height,
+                     bool mipmapped) {
+  size_t texel = format_texel_bytes(internal_format);
+  size_t result = (size_t)width * height * texel;
+  while (mipmapped && (width > 1 || height > 1)) {
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+    result += (size_t)width * height * texel;
+  }
+  return result;
+}
+
+static inline uint64_t gpu_allocation_key(gpu_resource_e kind,
+                                          unsigned int id) {
+  return ((uint64_t)kind << 32) | id;
+}
+
+static gpu_memory_usage_t &gpu_usage(const char *subsystem) {
+  for (gpu_memory_usage_t &usage : gpu_usages)
+    if (strcmp(usage.subsystem, subsystem) == 0)
+      return usage;
+  gpu_usages.push_back({subsystem, 0, 0, 0});
+  return gpu_usages.back();
+}
+
+// Subsystem first, adding it may move the total
+static void gpu_usage_add(const char *subsystem, size_t bytes) {
+  gpu_memory_usage_t *owner = &gpu_usage(subsystem);
+  for (gpu_memory_usage_t *usage : {&gpu_usages[0], owner}) {
+    usage->live += bytes;
+    usage->count += 1;
+    usage->peak = std::max(usage->peak, usage->live);
+  }
+}
+
+static void gpu_usage_remove(const char *subsystem, size_t bytes) {
+  gpu_memory_usage_t *owner = &gpu_usage(subsystem);
+  for (gpu_memory_usage_t *usage : {&gpu_usages[0], owner}) {
+    usage->live -= bytes;
+    usage->count -= 1;
+  }
+}
+
+void gpu_memory_track(gpu_resource_e kind, unsigned int id, size_t bytes,
+                      const char *subsystem, const char *path) {
+  if (subsystem == NULL) {
+    subsystem = gpu_scope_subsystem;
+    path = path ? path : gpu_scope_path;
+  }
+
+  gpu_memory_untrack(kind, id);
+  gpu_allocations[gpu_allocation_key(kind, id)] = {
+      .kind = kind,
+      .id = id,
+      .bytes = bytes,
+      .subsystem = subsystem,
+      .path = path ? path : ""};
+  gpu_usage_add(subsystem, bytes);
+}
+
+void gpu_memory_untrack(gpu_resource_e kind, unsigned int id) {
+  auto it = gpu_allocations.find(gpu_allocation_key(kind, id));
+  if (it == gpu_allocations.end())
+    return;
+  gpu_usage_remove(it->second.subsystem, it->second.bytes);
+  gpu_allocations.erase(it);
+}
+
+size_t gpu_memory_bytes(gpu_resource_e kind, unsigned int id) {
+  auto it = gpu_allocations.find(gpu_allocation_key(kind, id));
+  return it == gpu_allocations.end() ? 0 : it->second.bytes;
+}
+
+std::vector<gpu_memory_usage_t> gpu_memory_usage() { return gpu_usages; }
+
+unsigned int gpu_memory_leaks() {
+  const char *kinds[] = {"buffer", "texture", "renderbuffer"};
+  for (auto &[key, allocation] : gpu_allocations)
+    printf("leaked %s(id: %d, %zu bytes, %s%s%s)\n", kinds[allocation.kind],
+           allocation.id, allocation.bytes, allocation.subsystem,
+           allocation.path.empty() ? "" : ": ", allocation.path.c_str());
+
+  if (!gpu_allocations.empty())
+    printf("leaked %zu gpu allocations, %zu bytes\n", gpu_allocations.size(),
+           gpu_usages[0].live);
+  return gpu_allocations.size();
+}
+
+gpu_memory_scope_t::gpu_memory_scope_t(const char *subsystem, const char *path)
+    : prev_subsystem(gpu_scope_subsystem), prev_path(gpu_scope_path) {
+  gpu_scope_subsystem = subsystem;
+  gpu_scope_path = path;
+}
+
+gpu_memory_scope_t::~gpu_memory_scope_t() {
+  gpu_scope_subsystem = prev_subsystem;
+  gpu_scope_path = prev_path;
+}
+
+} // namespace glib
+
+#endif
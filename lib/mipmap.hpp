@@ -0,0 +1,233 @@
+#pragma once
+
+#include "dds.hpp"
+
+// Mip chains built on the CPU, what glib_bake and the texture cache store so
+// loads upload every level as is. Each level is filtered from the previous
+// one, kept in floats, by a separable windowed sinc reaching MIP_RADIUS
+// texels of the smaller level on each side. Edges are clamped.
+
+namespace glib {
+
+#define MIP_RADIUS 3.0f
+
+enum mip_filter_e {
+  MIP_KAISER,  // sinc in a Kaiser window, alpha 4
+  MIP_LANCZOS, // sinc in a sinc window
+};
+
+// What the channels of an image hold
+enum mip_flags_e {
+  MIP_SRGB = 1 << 0,    // colours are averaged as linear light
+  MIP_NORMALS = 1 << 1, // tangent space normals of RGBA, renormalised
+};
+
+// Levels of an R8, RG8 or RGBA8 image after its first one down to 1x1, the
+// rows of each level are filtered by the shared jobs (see jobs.hpp)
+void mip_generate(dds_image_t &image, unsigned int flags,
+                  mip_filter_e filter = MIP_KAISER);
+
+#ifdef GLIB_MIPMAP_IMPL
+#undef GLIB_MIPMAP_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "jobs.hpp"
+#include "profiler.hpp"
+
+namespace glib {
+
+// Taps of the texels of a level filtered into each texel of the next
+struct mip_taps_t {
+  int count;                  // per texel
+  std::vector<int> first;     // texel of the first tap, may be outside
+  std::vector<float> weights; // count per texel, summing to 1
+};
+
+static float mip_sinc(float x) {
+  x *= (float)M_PI;
+  return fabsf(x) < 1e-5f ? 1.0f : sinf(x) / x;
+}
+
+// Modified Bessel function of the first kind, the Kaiser window
+static float mip_bessel0(float x) {
+  float sum = 1.0f, term = 1.0f;
+  for (int k = 1; k < 32 && term > sum * 1e-7f; ++k) {
+    term *= (x * 0.5f / k) * (x * 0.5f / k);
+    sum += term;
+  }
+  return sum;
+}
+
+// Distance in texels of the smaller level
+static float mip_kernel(mip_filter_e filter, float x) {
+  if (fabsf(x) >= MIP_RADIUS)
+    return 0.0f;
+  if (filter == MIP_LANCZOS)
+    return mip_sinc(x) * mip_sinc(x / MIP_RADIUS);
+  const float alpha = 4.0f;
+  float r = x / MIP_RADIUS;
+  return mip_sinc(x) * mip_bessel0(alpha * sqrtf(1.0f - r * r)) /
+         mip_bessel0(alpha);
+}
+
+static mip_taps_t mip_taps(int source, int destination, mip_filter_e filter) {
+  float scale = (float)destination / source;
+  mip_taps_t result;
+  result.count = (int)ceilf(2.0f * MIP_RADIUS / scale) + 1;
+  result.first.resize(destination);
+  result.weights.resize((size_t)destination * result.count);
+  for (int d = 0; d < destination; ++d) {
+    float center = (d + 0.5f) / scale - 0.5f;
+    int first = (int)floorf(center - MIP_RADIUS / scale) + 1;
+    float *weights = &result.weights[(size_t)d * result.count];
+    float sum = 0.0f;
+    for (int t = 0; t < result.count; ++t) {
+      weights[t] = mip_kernel(filter, (first + t - center) * scale);
+      sum += weights[t];
+    }
+    for (int t = 0; t < result.count; ++t)
+      weights[t] /= sum;
+    result.first[d] = first;
+  }
+  return result;
+}
+
+// out += weight * in over count floats
+static inline void mip_accumulate(float *out, const float *in, float weight,
+                                  int count) {
+  int i = 0;
+#ifdef __SSE2__
+  __m128 w = _mm_set1_ps(weight);
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i),
+                                      _mm_mul_ps(_mm_loadu_ps(in + i), w)));
+#endif
+  for (; i < count; ++i)
+    out[i] += in[i] * weight;
+}
+
+static float mip_linear(float c) {
+  return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float mip_srgb(float c) {
+  return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// Bytes to the floats that are filtered, back to bytes with a table of 4096
+// steps of linear light
+struct mip_tables_t {
+  float decode[256];
+  unsigned char encode[4096];
+  mip_tables_t(bool srgb) {
+    for (int i = 0; i < 256; ++i)
+      decode[i] = srgb ? mip_linear(i / 255.0f) : i / 255.0f;
+    for (int i = 0; i < 4096; ++i) {
+      float c = (i + 0.5f) / 4096.0f;
+      encode[i] = (unsigned char)lrintf((srgb ? mip_srgb(c) : c) * 255.0f);
+    }
+  }
+};
+
+static void mip_normalize(float *texel) {
+  float length = sqrtf(texel[0] * texel[0] + texel[1] * texel[1] +
+                       texel[2] * texel[2]);
+  float scale = length > 1e-6f ? 1.0f / length : 0.0f;
+  for (int c = 0; c < 3; ++c)
+    texel[c] *= scale;
+  if (length <= 1e-6f)
+    texel[2] = 1.0f;
+}
+
+void mip_generate(dds_image_t &image, unsigned int flags,
+                  mip_filter_e filter) {
+  GLIB_ZONE("mip_generate");
+  int channels = (int)dds_level_size(image.format, 1, 1);
+  if (image.levels.empty() || dds_block_size(image.format) != 0 ||
+      channels == 0)
+    return;
+  image.levels.resize(1);
+  static const mip_tables_t srgb_tables(true), linear_tables(false);
+  const mip_tables_t &tables =
+      (flags & MIP_SRGB) != 0 ? srgb_tables : linear_tables;
+  bool normals = (flags & MIP_NORMALS) != 0 && channels == 4;
+
+  // Colours as linear light, alpha always linear, normals in [-1, 1]
+  int width = image.width, height = image.height;
+  std::vector<float> level((size_t)width * height * channels);
+  const unsigned char *bytes = image.levels[0].data();
+  for (size_t i = 0; i < level.size(); ++i) {
+    bool alpha = channels == 4 && i % 4 == 3;
+    level[i] = normals && !alpha ? bytes[i] * (2.0f / 255.0f) - 1.0f
+               : alpha           ? bytes[i] / 255.0f
+                                 : tables.decode[bytes[i]];
+  }
+
+  std::vector<float> rows, next;
+  while ((width > 1 || height > 1) && image.levels.size() < DDS_MAX_LEVELS) {
+    int next_width = std::max(width / 2, 1);
+    int next_height = std::max(height / 2, 1);
+    mip_taps_t columns = mip_taps(width, next_width, filter);
+    mip_taps_t lines = mip_taps(height, next_height, filter);
+
+    // Across the rows, then down the columns
+    size_t row = (size_t)next_width * channels;
+    rows.assign(height * row, 0.0f);
+    jobs_for(jobs_shared(), height, [&](size_t y) {
+      const float *source = &level[y * width * channels];
+      float *out = &rows[y * row];
+      for (int x = 0; x < next_width; ++x)
+        for (int t = 0; t < columns.count; ++t) {
+          int column = std::clamp(columns.first[x] + t, 0, width - 1);
+          mip_accumulate(out + x * channels, source + column * channels,
+                         columns.weights[(size_t)x * columns.count + t],
+                         channels);
+        }
+    });
+    next.assign(next_height * row, 0.0f);
+    jobs_for(jobs_shared(), next_height, [&](size_t y) {
+      for (int t = 0; t < lines.count; ++t) {
+        int line = std::clamp(lines.first[y] + t, 0, height - 1);
+        mip_accumulate(&next[y * row], &rows[line * row],
+                       lines.weights[y * lines.count + t], row);
+      }
+    });
+
+    // Back to bytes, the lobes of the filter clamped
+    std::vector<unsigned char> encoded(next.size());
+    jobs_for(jobs_shared(), next_height, [&](size_t y) {
+      for (size_t i = y * next_width; i < (y + 1) * next_width; ++i) {
+        float *texel = &next[i * channels];
+        if (normals)
+          mip_normalize(texel);
+        for (int c = 0; c < channels; ++c) {
+          float value = texel[c];
+          if (normals && c < 3)
+            value = value * 0.5f + 0.5f;
+          value = std::clamp(value, 0.0f, 1.0f);
+          encoded[i * channels + c] =
+              (channels == 4 && c == 3) || normals
+                  ? (unsigned char)lrintf(value * 255.0f)
+                  : tables.encode[std::min((int)(value * 4096.0f), 4095)];
+        }
+      }
+    });
+
+    image.levels.push_back(std::move(encoded));
+    level.swap(next);
+    width = next_width;
+    height = next_height;
+  }
+}
+
+#endif
+
+} // namespace glib
@@ -6,13 +6,30 @@
 
 #include <vector>
 #include <cstdlib>
-#include <unordered_map>
 
+#include <glm/glm.hpp>
+
+// Textures loaded asynchronously or streamed are implemented with the models
+#ifdef GLIB_MODEL_IMPL
+#define GLIB_UPLOAD_IMPL
+#define GLIB_STREAM_IMPL
+#endif
+#include <baked.hpp>
 #include <graphics.hpp>
 #include <mesh.hpp>
+#include <stream.hpp>
+#include <upload.hpp>
 
 namespace glib {
 
+// Levels of detail of a mesh, ranges of its element buffer
+#define MESH_MAX_LODS 8
+
+struct mesh_lod_t {
+  unsigned int first, count; // indices
+  float error;
+};
+
 struct mesh_t 
 {  
   buffer_t  buffer;
@@ -20,6 +37,11 @@ struct mesh_t
   texture_t albedo;
   texture_t specular;
   texture_t normal;
+
+  mesh_lod_t lods[MESH_MAX_LODS];
+  unsigned int lod_count; // 0 draws the whole buffer
+  float bounds_min[3], bounds_max[3];
+  float uv_density; // texture coordinates per unit of the model, on average
 };
 
 struct model_t 
@@ -27,14 +49,66 @@ struct model_t
   std::vector<mesh_t> meshes;
 };
 
-// Load model from file
-model_t model_load(const char *filepath);
-void model_render(const model_t &model, const program_t &program);
+// Load model from file, either a baked model (see baked.hpp) mapped from
+// disk or any format of assimp. An up to date .glbm next to the file is
+// loaded instead of it, else what assimp imported is baked in the import
+// cache (see cache.hpp) and mapped from there by the next loads. With an
+// upload queue the textures are loaded asynchronously through it, with a
+// streamer their finer levels are streamed as model_stream asks for them.
+model_t model_load(const char *filepath, upload_queue_t *uploads = NULL,
+                   stream_t *streamer = NULL);
+// Draw a level of detail, the coarsest one if the mesh has fewer
+void model_render(const model_t &model, const program_t &program,
+                  unsigned int lod = 0);
+
+// Ask the streamer for the levels the textures of a model drawn with a
+// transform need, seen from the camera. projection_scale is the pixels one
+// unit spans at a distance of one, the viewport height over 2 tan(fov / 2).
+void model_stream(const model_t &model, stream_t &streamer,
+                  const glm::mat4 &transform, const glm::vec3 &camera,
+                  float projection_scale);
+
+// Import with assimp only, texture paths stay relative to the model folder.
+// False if assimp fails or a material misses one of its textures.
+bool model_import(const char *filepath, model_data_t &data);
+// GL buffers and textures of imported data
+model_t model_upload(const model_data_t &data, const std::string &folder,
+                     upload_queue_t *uploads = NULL,
+                     stream_t *streamer = NULL);
+
+// Import a model and write it baked, textures are referenced relative to the
+// destination. process runs on the imported data first, with the texture
+// paths still relative to the source.
+bool model_bake(const char *source, const char *destination,
+                const std::function<void(model_data_t &)> &process = nullptr);
+
+// Free the buffers of the model and release its textures, shared between
+// models through the texture manager (see texture_acquire) and freed when
+// evicted or by model_textures_release
+void model_destroy(model_t &model);
+// Free the textures no model references anymore
+void model_textures_release();
 
 #ifdef GLIB_MODEL_IMPL
 #undef GLIB_MODEL_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+
+namespace glib {
+
+static_assert(sizeof(index_t) == sizeof(uint32_t), "baked indices are 32 bit");
 
-void model_render(const model_t &model, const program_t &program) {
+#define MODEL_IMPORT_FLAGS                                                     \
+  (aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace)
+// Bumped when model_import changes what it produces
+#define MODEL_CACHE_VERSION 1
+
+void model_render(const model_t &model, const program_t &program,
+                  unsigned int lod) {
+  GLIB_ZONE("model_render");
   for (int i = 0; i < model.meshes.size(); ++i) {
     const mesh_t& mesh = model.meshes[i];
 
@@ -43,140 +117,435 @@ void model_render(const model_t &model, const program_t &program) {
     glib::texture_bind(mesh.specular, 1); // specular
     glib::texture_bind(mesh.normal,   2); // normal
 
-    glib::render(mesh.buffer, program);
+    if (mesh.lod_count == 0) {
+      glib::render(mesh.buffer, program);
+      continue;
+    }
+
+    const mesh_lod_t &level = mesh.lods[std::min(lod, mesh.lod_count - 1)];
+    program_bind(program);
+    buffer_bind(mesh.buffer);
+    gl_draw_elements(GL_TRIANGLES, level.count, GL_UNSIGNED_INT,
+                     (void *)(level.first * sizeof(index_t)));
+    buffer_unbind();
+    program_unbind();
+  }
+}
+
+void model_stream(const model_t &model, stream_t &streamer,
+                  const glm::mat4 &transform, const glm::vec3 &camera,
+                  float projection_scale) {
+  GLIB_ZONE("model_stream");
+  float scale = std::max({glm::length(glm::vec3(transform[0])),
+                          glm::length(glm::vec3(transform[1])),
+                          glm::length(glm::vec3(transform[2]))});
+  if (scale <= 0.0f || projection_scale <= 0.0f)
+    return;
+
+  for (const mesh_t &mesh : model.meshes) {
+    if (mesh.uv_density <= 0.0f)
+      continue;
+
+    // Nearest point of the bounding sphere, inside it the finest level
+    glm::vec3 low(mesh.bounds_min[0], mesh.bounds_min[1], mesh.bounds_min[2]);
+    glm::vec3 high(mesh.bounds_max[0], mesh.bounds_max[1], mesh.bounds_max[2]);
+    glm::vec3 center = glm::vec3(transform * glm::vec4((low + high) * 0.5f, 1));
+    float radius = glm::length(high - low) * 0.5f * scale;
+    float distance = glm::length(center - camera) - radius;
+
+    float uv_per_pixel = distance <= 0.0f
+                             ? 0.0f
+                             : mesh.uv_density / scale * distance /
+                                   projection_scale;
+    stream_request(streamer, mesh.albedo, uv_per_pixel);
+    stream_request(streamer, mesh.specular, uv_per_pixel);
+    stream_request(streamer, mesh.normal, uv_per_pixel);
   }
 }
 
+// Shared between the meshes and models using it by the texture manager,
+// each mesh holds a reference
+static texture_t model_texture(const std::string &path,
+                               upload_queue_t *uploads, stream_t *streamer,
+                               const unsigned char *placeholder,
+                               texture_role_e role) {
+  std::cout << "loading texture at " << path << "\n";
+  return streamer != NULL ? texture_load_streamed(*streamer, path.c_str(),
+                                                  GL_REPEAT, placeholder, role)
+         : uploads != NULL
+             ? texture_load_async(*uploads, path.c_str(), GL_REPEAT,
+                                  placeholder, role)
+             : texture_load(path.c_str(), GL_RGB, GL_REPEAT, role);
+}
+
 // Load only the first one
-static texture_t process_material_texture(aiMaterial *material, aiTextureType type, const std::string &folder) {
+static bool process_material_texture(std::string &result, aiMaterial *material,
+                                     aiTextureType type) {
   if (material->GetTextureCount(type) == 0) {
     std::cout << "ERROR::ASSIMP::" << "No texture for " << type << " type" << std::endl;
-    exit(1);
+    return false;
   }
 
   aiString str;
   material->GetTexture(type, 0, &str);
-  std::string path = folder + "/" + str.C_Str();
-  
-  // Contains all previous loaded textures
-  static std::unordered_map<std::string, texture_t> loaded_textures;
-  if (loaded_textures.find(path) == loaded_textures.end()) {
-
-    std::cout << "loading texture at " << path << "\n";
-    std::string ext = path.substr(path.find_last_of('.'), path.size());
-
-    int format = GL_RGB;
-    if (ext == ".png")
-      format = GL_RGBA;
-
-    texture_t texture = texture_load(path.c_str(), GL_RGB, GL_REPEAT);
-    loaded_textures.insert({{path, texture}});
-  }
-
-  return loaded_textures.find(path)->second;
+  result = str.C_Str();
+  return true;
 }
 
-static void process_mesh(model_t &model, aiMesh *mesh, const aiScene *scene, const std::string &folder) {
-  
-  // Position - Normals - UVs
-  std::vector<float> vertices;
-  std::vector<index_t> indices;
+// Fills the vertices and indices of a mesh, allocated once. Meshes run as
+// jobs, each one writing only its own mesh_data_t.
+static void process_mesh(mesh_data_t &result, const aiMesh *mesh) {
+  GLIB_ZONE("process_mesh");
+
+  // Position - Normals - Tangents - UVs
+  std::vector<float> &vertices = result.vertices;
+  std::vector<uint32_t> &indices = result.lods.emplace_back().indices;
+  result.lods[0].error = 0.0f;
+  vertices.resize((size_t)mesh->mNumVertices * BAKED_VERTEX_FLOATS);
 
   // Load all mesh data
-  for (int i = 0; i < mesh->mNumVertices; ++i) 
-  {
+  for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
+    float *vertex = &vertices[(size_t)i * BAKED_VERTEX_FLOATS];
+
     // Position
-    float x = mesh->mVertices[i].x;
-    float y = mesh->mVertices[i].y;
-    float z = mesh->mVertices[i].z;
-   
-    vertices.push_back(x);
-    vertices.push_back(y);
-    vertices.push_back(z);
+    vertex[0] = mesh->mVertices[i].x;
+    vertex[1] = mesh->mVertices[i].y;
+    vertex[2] = mesh->mVertices[i].z;
 
     // Normal
-    float nx = mesh->mNormals[i].x; 
-    float ny = mesh->mNormals[i].y; 
-    float nz = mesh->mNormals[i].z; 
-
-    vertices.push_back(nx);
-    vertices.push_back(ny);
-    vertices.push_back(nz);
+    vertex[3] = mesh->mNormals[i].x;
+    vertex[4] = mesh->mNormals[i].y;
+    vertex[5] = mesh->mNormals[i].z;
 
     // Tangent
-    float tx = mesh->mTangents[i].x;
-    float ty = mesh->mTangents[i].y;
-    float tz = mesh->mTangents[i].z;
-
-    vertices.push_back(tx);
-    vertices.push_back(ty);
-    vertices.push_back(tz);
+    vertex[6] = mesh->mTangents[i].x;
+    vertex[7] = mesh->mTangents[i].y;
+    vertex[8] = mesh->mTangents[i].z;
 
     // UVs
-    float u = 0.0f, v = 0.0f;
+    vertex[9] = vertex[10] = 0.0f;
     if (mesh->mTextureCoords[0]) {
-      u = mesh->mTextureCoords[0][i].x;
-      v = mesh->mTextureCoords[0][i].y;
+      vertex[9] = mesh->mTextureCoords[0][i].x;
+      vertex[10] = mesh->mTextureCoords[0][i].y;
     }
-
-    vertices.push_back(u);
-    vertices.push_back(v);
   }
 
-  // Process indices
-  for (int i = 0; i < mesh->mNumFaces; ++i) {
-    aiFace face = mesh->mFaces[i];
-    for (int j = 0; j < face.mNumIndices; ++j)
-      indices.push_back(face.mIndices[j]);
-  }
-
-  mesh_t result = {
-    .buffer = buffer_create(&vertices, &indices, glib::layout_3F3F3F2F)
-  };
-
-  // Process material
-  if (mesh->mMaterialIndex > 0) {
-    aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-    result.albedo   = process_material_texture(material, aiTextureType_DIFFUSE, folder);
-    result.specular = process_material_texture(material, aiTextureType_SPECULAR, folder);
-    result.normal   = process_material_texture(material, aiTextureType_NORMALS, folder);
+  // Process indices, faces are triangles but for points and lines
+  size_t count = 0;
+  for (unsigned int i = 0; i < mesh->mNumFaces; ++i)
+    count += mesh->mFaces[i].mNumIndices;
+  indices.resize(count);
+  uint32_t *index = indices.data();
+  for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
+    const aiFace &face = mesh->mFaces[i];
+    index = std::copy(face.mIndices, face.mIndices + face.mNumIndices, index);
   }
+  mesh_data_bounds(result);
+}
 
-  model.meshes.push_back(result);
+// Process material
+static bool process_material(mesh_data_t &result, const aiMesh *mesh,
+                             const aiScene *scene) {
+  if (mesh->mMaterialIndex == 0)
+    return true;
+  aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+  return process_material_texture(result.textures[0], material,
+                                  aiTextureType_DIFFUSE) &&
+         process_material_texture(result.textures[1], material,
+                                  aiTextureType_SPECULAR) &&
+         process_material_texture(result.textures[2], material,
+                                  aiTextureType_NORMALS);
 }
 
-static void process_node(model_t &model, aiNode *node, const aiScene *scene, const std::string& folder) {
-  
+// Meshes in the order of the tree, the geometry is left to the jobs
+static bool process_node(model_data_t &model, std::vector<const aiMesh *> &jobs,
+                         aiNode *node, const aiScene *scene) {
+
   // Process all meshes
-  for (int i = 0; i < node->mNumMeshes; ++i) {
+  for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
     std::cout << "processing mesh of node\n";
     aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-    process_mesh(model, mesh, scene, folder);
+    if (!process_material(model.meshes.emplace_back(), mesh, scene))
+      return false;
+    jobs.push_back(mesh);
   }
 
   // Continue traversal of node tree
-  for (int i = 0; i < node->mNumChildren; ++i) {
+  for (unsigned int i = 0; i < node->mNumChildren; ++i) {
     printf("processing child node (%d/%d)\n", i + 1, node->mNumChildren);
-    process_node(model, node->mChildren[i], scene, folder);
+    if (!process_node(model, jobs, node->mChildren[i], scene))
+      return false;
   }
+  return true;
 }
 
-model_t model_load(const char* filepath) {
-  model_t result;
-
+bool model_import(const char *filepath, model_data_t &data) {
+  GLIB_ZONE("model_import");
   Assimp::Importer importer;
-  const aiScene *scene = importer.ReadFile(filepath, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+  const aiScene *scene;
+  {
+    GLIB_ZONE("assimp_read");
+    scene = importer.ReadFile(filepath, MODEL_IMPORT_FLAGS);
+  }
   if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
     std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
-    exit(1);
+    return false;
   }
 
+  data.meshes.clear();
+  std::vector<const aiMesh *> jobs;
+  if (!process_node(data, jobs, scene->mRootNode, scene))
+    return false;
+
+  // Meshes do not share anything, one job each
+  jobs_for(jobs_shared(), jobs.size(),
+           [&](size_t i) { process_mesh(data.meshes[i], jobs[i]); });
+  return true;
+}
+
+// Buffers from spans, the levels of detail follow each other
+static mesh_t model_mesh_create(const float *vertices, size_t floats,
+                                const uint32_t *indices, size_t count) {
+  mesh_t result = {};
+  result.buffer = buffer_create(vertices, floats, indices, count,
+                                glib::layout_3F3F3F2F);
+  return result;
+}
+
+// Square root of the area the triangles cover in texture space over the
+// area they cover in the model, how many texels of a texture of size 1 fall
+// on one unit
+static float model_uv_density(const float *vertices, const uint32_t *indices,
+                              size_t count) {
+  double area = 0.0, uv_area = 0.0;
+  for (size_t i = 0; i + 2 < count; i += 3) {
+    const float *a = vertices + (size_t)indices[i] * BAKED_VERTEX_FLOATS;
+    const float *b = vertices + (size_t)indices[i + 1] * BAKED_VERTEX_FLOATS;
+    const float *c = vertices + (size_t)indices[i + 2] * BAKED_VERTEX_FLOATS;
+    glm::vec3 ab(b[0] - a[0], b[1] - a[1], b[2] - a[2]);
+    glm::vec3 ac(c[0] - a[0], c[1] - a[1], c[2] - a[2]);
+    area += glm::length(glm::cross(ab, ac));
+    uv_area += fabsf((b[9] - a[9]) * (c[10] - a[10]) -
+                     (c[9] - a[9]) * (b[10] - a[10]));
+  }
+  return area > 0.0 ? (float)sqrt(uv_area / area) : 0.0f;
+}
+
+// Until they are uploaded the textures of a mesh look flat and grey
+static void model_mesh_textures(mesh_t &mesh, const char *const paths[3],
+                                const std::string &folder,
+                                upload_queue_t *uploads, stream_t *streamer) {
+  static const unsigned char grey[4] = {128, 128, 128, 255};
+  static const unsigned char flat[4] = {128, 128, 255, 255};
+  if (paths[0] != NULL)
+    mesh.albedo = model_texture(folder + "/" + paths[0], uploads, streamer,
+                                grey, TEXTURE_ALBEDO);
+  if (paths[1] != NULL)
+    mesh.specular = model_texture(folder + "/" + paths[1], uploads, streamer,
+                                  grey, TEXTURE_MASK);
+  if (paths[2] != NULL)
+    mesh.normal = model_texture(folder + "/" + paths[2], uploads, streamer,
+                                flat, TEXTURE_NORMAL);
+}
+
+model_t model_upload(const model_data_t &data, const std::string &folder,
+                     upload_queue_t *uploads, stream_t *streamer) {
+  GLIB_ZONE("model_upload");
+  model_t result;
+  std::vector<uint32_t> indices;
+  for (const mesh_data_t &source : data.meshes) {
+    indices.clear();
+    for (const mesh_lod_data_t &level : source.lods)
+      indices.insert(indices.end(), level.indices.begin(),
+                     level.indices.end());
+
+    mesh_t mesh = model_mesh_create(source.vertices.data(),
+                                    source.vertices.size(), indices.data(),
+                                    indices.size());
+    unsigned int first = 0;
+    for (const mesh_lod_data_t &level : source.lods) {
+      if (mesh.lod_count == MESH_MAX_LODS)
+        break;
+      mesh.lods[mesh.lod_count++] = {first, (unsigned int)level.indices.size(),
+                                     level.error};
+      first += level.indices.size();
+    }
+    std::copy(source.bounds_min, source.bounds_min + 3, mesh.bounds_min);
+    std::copy(source.bounds_max, source.bounds_max + 3, mesh.bounds_max);
+    const std::vector<uint32_t> &first_lod = source.lods[0].indices;
+    mesh.uv_density = model_uv_density(source.vertices.data(),
+                                       first_lod.data(), first_lod.size());
+
+    const char *paths[3];
+    for (int t = 0; t < 3; ++t)
+      paths[t] = source.textures[t].empty() ? NULL : source.textures[t].c_str();
+    model_mesh_textures(mesh, paths, folder, uploads, streamer);
+    result.meshes.push_back(mesh);
+  }
+  return result;
+}
+
+// The mapped streams go straight to the GL buffers
+static model_t model_load_baked(const baked_file_t &file,
+                                const std::string &folder,
+                                upload_queue_t *uploads, stream_t *streamer) {
+  GLIB_ZONE("model_load_baked");
+  model_t result;
+  result.meshes.reserve(file.header->mesh_count);
+  for (uint32_t i = 0; i < file.header->mesh_count; ++i) {
+    const baked_mesh_t &source = file.meshes[i];
+    const baked_lod_t *lods = file.lods + source.lod_first;
+    const baked_lod_t &last = lods[source.lod_count - 1];
+    size_t count = (last.index_offset - lods[0].index_offset) / 4 +
+                   last.index_count;
+
+    mesh_t mesh = model_mesh_create(
+        baked_vertices(file, source),
+        (size_t)source.vertex_count * BAKED_VERTEX_FLOATS,
+        baked_indices(file, lods[0]), count);
+    for (uint32_t l = 0; l < source.lod_count && l < MESH_MAX_LODS; ++l) {
+      unsigned int first = (lods[l].index_offset - lods[0].index_offset) / 4;
+      mesh.lods[mesh.lod_count++] = {first, lods[l].index_count,
+                                     lods[l].error};
+    }
+    std::copy(source.bounds_min, source.bounds_min + 3, mesh.bounds_min);
+    std::copy(source.bounds_max, source.bounds_max + 3, mesh.bounds_max);
+    mesh.uv_density = model_uv_density(baked_vertices(file, source),
+                                       baked_indices(file, lods[0]),
+                                       lods[0].index_count);
+
+    const char *paths[3];
+    for (int t = 0; t < 3; ++t)
+      paths[t] = baked_string(file, source.textures[t]);
+    model_mesh_textures(mesh, paths, folder, uploads, streamer);
+    result.meshes.push_back(mesh);
+  }
+  return result;
+}
+
+// The source and the files next to it sharing its stem, like the .mtl of an
+// .obj, 0 if the source can not be read
+static uint64_t model_cache_key(const char *filepath) {
+  namespace fs = std::filesystem;
+  uint32_t version = BAKED_VERSION << 16 | MODEL_CACHE_VERSION;
+  uint64_t key = cache_key(filepath, MODEL_IMPORT_FLAGS, version);
+  if (key == 0)
+    return 0;
+
+  fs::path source = filepath;
+  std::vector<fs::path> siblings;
+  std::error_code error;
+  for (const fs::directory_entry &entry :
+       fs::directory_iterator(source.parent_path(), error))
+    if (entry.path().stem() == source.stem() &&
+        entry.path().filename() != source.filename() &&
+        entry.path().extension() != ".glbm")
+      siblings.push_back(entry.path());
+  std::sort(siblings.begin(), siblings.end());
+  for (const fs::path &sibling : siblings) {
+    uint64_t sibling_key = cache_key(sibling.c_str(), 0, 0);
+    key = baked_hash(&sibling_key, sizeof(sibling_key), key);
+  }
+  return key;
+}
+
+model_t model_load(const char *filepath, upload_queue_t *uploads,
+                   stream_t *streamer) {
+  GLIB_ZONE("model_load");
+  gpu_memory_scope_t scope("model", filepath);
+  double start = glfwGetTime();
+
   std::string folder{filepath};
   folder = folder.substr(0, folder.find_last_of("/"));
-  process_node(result, scene->mRootNode, scene, folder);
+
+  // A baked file next to the source is used while it is up to date
+  namespace fs = std::filesystem;
+  std::error_code error;
+  fs::path path = filepath;
+  fs::path sibling = fs::path(filepath).replace_extension(".glbm");
+  if (path.extension() != ".glbm" && fs::exists(sibling, error) &&
+      fs::last_write_time(sibling, error) >= fs::last_write_time(path, error))
+    path = sibling;
+
+  model_t result;
+  baked_file_t file;
+  if (baked_is(path.c_str())) {
+    if (baked_open(path.c_str(), file)) {
+      result = model_load_baked(file, folder, uploads, streamer);
+      baked_close(file);
+      printf("loaded model %s in %.2fms (baked)\n", path.c_str(),
+             (glfwGetTime() - start) * 1000.0);
+      return result;
+    }
+    std::cout << "ERROR::MODEL: Unable to load " << path << std::endl;
+
+    // A stale or corrupt sibling, the source is imported instead
+    if (path == filepath)
+      exit(1);
+  }
+
+  // Verified when mapped from the cache, a corrupt entry is imported again
+  uint64_t key = cache_enabled() ? model_cache_key(filepath) : 0;
+  std::string entry = key != 0 ? cache_path(key, ".glbm") : "";
+  if (key != 0 && fs::exists(entry, error)) {
+    if (baked_open(entry.c_str(), file, true)) {
+      cache_touch(entry);
+      result = model_load_baked(file, folder, uploads, streamer);
+      baked_close(file);
+      printf("loaded model %s in %.2fms (cache)\n", filepath,
+             (glfwGetTime() - start) * 1000.0);
+      return result;
+    }
+    cache_remove(entry);
+  }
+
+  model_data_t data;
+  if (!model_import(filepath, data))
+    exit(1);
+  result = model_upload(data, folder, uploads, streamer);
+  if (key != 0 && baked_write(entry.c_str(), data))
+    cache_insert(entry);
+  printf("loaded model %s in %.2fms (assimp)\n", filepath,
+         (glfwGetTime() - start) * 1000.0);
   return result;
 }
 
+bool model_bake(const char *source, const char *destination,
+                const std::function<void(model_data_t &)> &process) {
+  GLIB_ZONE("model_bake");
+  model_data_t data;
+  if (!model_import(source, data))
+    return false;
+  if (process)
+    process(data);
+
+  // Textures stay where they are, found from the baked file
+  namespace fs = std::filesystem;
+  fs::path from = fs::absolute(source).parent_path();
+  fs::path to = fs::absolute(destination).parent_path();
+  for (mesh_data_t &mesh : data.meshes)
+    for (std::string &texture : mesh.textures)
+      if (!texture.empty())
+        texture = (from / texture).lexically_normal().lexically_relative(to);
+
+  if (!baked_write(destination, data))
+    return false;
+  printf("baked %s to %s\n", source, destination);
+  return true;
+}
+
+void model_destroy(model_t &model) {
+  for (mesh_t &mesh : model.meshes) {
+    buffer_destroy(mesh.buffer);
+    for (texture_t *texture : {&mesh.albedo, &mesh.specular, &mesh.normal})
+      if (texture->id != 0)
+        texture_destroy(*texture);
+  }
+  model.meshes.clear();
+}
+
+void model_textures_release() { texture_manager_trim(0); }
+
 #endif
 
 }
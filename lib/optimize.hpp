@@ -0,0 +1,335 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "baked.hpp"
+
+// Offline passes over imported meshes, run by glib_bake before writing them
+// baked. Every pass keeps the layout of mesh_data_t and its levels of detail.
+
+namespace glib {
+
+// Entries of the post transform cache the passes optimise for
+#define OPTIMIZE_CACHE_SIZE 32
+
+// Merge vertices with identical attributes, returns the vertices removed
+size_t mesh_weld(mesh_data_t &mesh);
+
+// Reorder triangles so vertices are reused while still in the post transform
+// cache (Forsyth, "Linear-speed vertex cache optimisation")
+void mesh_optimize_cache(std::vector<uint32_t> &indices, size_t vertex_count);
+
+// Reorder vertices in the order the levels first use them, unused vertices
+// are dropped
+void mesh_optimize_fetch(mesh_data_t &mesh);
+
+// Append coarser levels of detail by vertex clustering, each about half the
+// triangles of the previous one, until max_lods or too few triangles are left.
+// Clusters snap to one of their vertices, so the levels index the vertex
+// buffer of the source.
+void mesh_build_lods(mesh_data_t &mesh, int max_lods);
+
+// Average cache miss ratio, transformed vertices per triangle, of a FIFO cache
+float mesh_acmr(const std::vector<uint32_t> &indices, size_t vertex_count,
+                int cache_size = 16);
+
+#ifdef GLIB_OPTIMIZE_IMPL
+#undef GLIB_OPTIMIZE_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace glib {
+
+// Hashed by bits, -0.0 and 0.0 stay apart like any other difference
+struct optimize_vertex_key_t {
+  const float *vertex;
+  bool operator==(const optimize_vertex_key_t &other) const {
+    return memcmp(vertex, other.vertex,
+                  BAKED_VERTEX_FLOATS * sizeof(float)) == 0;
+  }
+};
+
+struct optimize_vertex_hash_t {
+  size_t operator()(const optimize_vertex_key_t &key) const {
+    return baked_hash(key.vertex, BAKED_VERTEX_FLOATS * sizeof(float));
+  }
+};
+
+static void mesh_remap(mesh_data_t &mesh, const std::vector<uint32_t> &remap,
+                       size_t vertex_count) {
+  std::vector<float> vertices(vertex_count * BAKED_VERTEX_FLOATS);
+  for (size_t v = 0; v < remap.size(); ++v)
+    if (remap[v] != BAKED_NONE)
+      memcpy(&vertices[remap[v] * BAKED_VERTEX_FLOATS],
+             &mesh.vertices[v * BAKED_VERTEX_FLOATS],
+             BAKED_VERTEX_FLOATS * sizeof(float));
+  mesh.vertices.swap(vertices);
+  for (mesh_lod_data_t &lod : mesh.lods)
+    for (uint32_t &index : lod.indices)
+      index = remap[index];
+}
+
+size_t mesh_weld(mesh_data_t &mesh) {
+  size_t count = mesh.vertices.size() / BAKED_VERTEX_FLOATS;
+  std::unordered_map<optimize_vertex_key_t, uint32_t, optimize_vertex_hash_t>
+      unique;
+  unique.reserve(count);
+
+  std::vector<uint32_t> remap(count);
+  for (size_t v = 0; v < count; ++v) {
+    optimize_vertex_key_t key = {&mesh.vertices[v * BAKED_VERTEX_FLOATS]};
+    remap[v] = unique.emplace(key, (uint32_t)unique.size()).first->second;
+  }
+
+  size_t welded = unique.size();
+  if (welded != count)
+    mesh_remap(mesh, remap, welded);
+  return count - welded;
+}
+
+// Scores of "Linear-speed vertex cache optimisation", the cache holds a few
+// more entries while the vertices of the emitted triangle are pushed
+static float mesh_vertex_score(int position, uint32_t triangles) {
+  if (triangles == 0)
+    return -1.0f;
+
+  float score = 0.0f;
+  if (position >= 3)
+    score = powf(1.0f - (position - 3) / (float)(OPTIMIZE_CACHE_SIZE - 3),
+                 1.5f);
+  else if (position >= 0)
+    score = 0.75f; // the last triangle, reusing it is not worth more
+  return score + 2.0f / sqrtf((float)triangles);
+}
+
+void mesh_optimize_cache(std::vector<uint32_t> &indices, size_t vertex_count) {
+  size_t triangle_count = indices.size() / 3;
+  if (triangle_count == 0)
+    return;
+
+  // Triangles of each vertex, the live ones first
+  std::vector<uint32_t> live(vertex_count, 0), first(vertex_count + 1, 0);
+  for (uint32_t index : indices)
+    live[index] += 1;
+  for (size_t v = 0; v < vertex_count; ++v)
+    first[v + 1] = first[v] + live[v];
+  std::vector<uint32_t> adjacency(indices.size()), fill(first);
+  for (size_t i = 0; i < indices.size(); ++i)
+    adjacency[fill[indices[i]]++] = i / 3;
+
+  std::vector<int> position(vertex_count, -1);
+  std::vector<float> score(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v)
+    score[v] = mesh_vertex_score(-1, live[v]);
+
+  std::vector<float> triangle_score(triangle_count);
+  std::vector<bool> emitted(triangle_count, false);
+  for (size_t t = 0; t < triangle_count; ++t)
+    triangle_score[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] +
+                        score[indices[t * 3 + 2]];
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  std::vector<uint32_t> cache, next;
+  cache.reserve(OPTIMIZE_CACHE_SIZE + 3);
+  next.reserve(OPTIMIZE_CACHE_SIZE + 3);
+
+  size_t best = std::max_element(triangle_score.begin(),
+                                 triangle_score.end()) -
+                triangle_score.begin();
+  size_t cursor = 0; // no triangle before it is left
+  while (best != SIZE_MAX) {
+    const uint32_t *corners = &indices[best * 3];
+    emitted[best] = true;
+    result.insert(result.end(), corners, corners + 3);
+
+    // Drop the triangle from its vertices
+    for (int c = 0; c < 3; ++c) {
+      uint32_t v = corners[c];
+      uint32_t *begin = &adjacency[first[v]], *end = begin + live[v];
+      std::swap(*std::find(begin, end, (uint32_t)best), end[-1]);
+      live[v] -= 1;
+    }
+
+    // Its vertices go to the front, the others keep their order
+    next.assign(corners, corners + 3);
+    for (uint32_t v : cache)
+      if (v != corners[0] && v != corners[1] && v != corners[2])
+        next.push_back(v);
+    cache.swap(next);
+
+    for (size_t i = 0; i < cache.size(); ++i) {
+      uint32_t v = cache[i];
+      position[v] = i < OPTIMIZE_CACHE_SIZE ? (int)i : -1;
+      score[v] = mesh_vertex_score(position[v], live[v]);
+    }
+
+    // Only triangles of cached vertices changed score
+    best = SIZE_MAX;
+    float best_score = -1.0f;
+    for (uint32_t v : cache)
+      for (uint32_t i = 0; i < live[v]; ++i) {
+        uint32_t t = adjacency[first[v] + i];
+        const uint32_t *triangle = &indices[t * 3];
+        triangle_score[t] =
+            score[triangle[0]] + score[triangle[1]] + score[triangle[2]];
+        if (triangle_score[t] > best_score) {
+          best_score = triangle_score[t];
+          best = t;
+        }
+      }
+    if (cache.size() > OPTIMIZE_CACHE_SIZE)
+      cache.resize(OPTIMIZE_CACHE_SIZE);
+
+    // Nothing connected is left, take the next triangle not emitted
+    if (best == SIZE_MAX) {
+      while (cursor < triangle_count && emitted[cursor])
+        cursor += 1;
+      if (cursor < triangle_count)
+        best = cursor;
+    }
+  }
+  indices.swap(result);
+}
+
+void mesh_optimize_fetch(mesh_data_t &mesh) {
+  size_t count = mesh.vertices.size() / BAKED_VERTEX_FLOATS;
+  std::vector<uint32_t> remap(count, BAKED_NONE);
+  uint32_t next = 0;
+  for (const mesh_lod_data_t &lod : mesh.lods)
+    for (uint32_t index : lod.indices)
+      if (remap[index] == BAKED_NONE)
+        remap[index] = next++;
+  mesh_remap(mesh, remap, next);
+}
+
+// Indices of the source with every vertex moved to its cluster, the
+// triangles collapsed or repeated by it are dropped
+static std::vector<uint32_t> mesh_cluster(const mesh_data_t &mesh,
+                                          int grid, float extent) {
+  size_t count = mesh.vertices.size() / BAKED_VERTEX_FLOATS;
+  const std::vector<uint32_t> &source = mesh.lods[0].indices;
+  float scale = grid / extent;
+
+  // Cells of the grid, the cluster keeps the sum of its positions
+  struct cluster_t {
+    float sum[3];
+    uint32_t count, vertex;
+    float distance;
+  };
+  std::unordered_map<uint64_t, uint32_t> cells;
+  std::vector<cluster_t> clusters;
+  std::vector<uint32_t> cluster(count, BAKED_NONE);
+  for (uint32_t index : source) {
+    if (cluster[index] != BAKED_NONE)
+      continue;
+    const float *p = &mesh.vertices[index * BAKED_VERTEX_FLOATS];
+    uint64_t key = 0;
+    for (int c = 0; c < 3; ++c) {
+      float cell = (p[c] - mesh.bounds_min[c]) * scale;
+      key = key << 21 | (uint64_t)std::clamp((int)cell, 0, grid - 1);
+    }
+    auto [it, created] = cells.emplace(key, (uint32_t)clusters.size());
+    if (created)
+      clusters.push_back({{0.0f, 0.0f, 0.0f}, 0, index, INFINITY});
+    cluster_t &target = clusters[it->second];
+    for (int c = 0; c < 3; ++c)
+      target.sum[c] += p[c];
+    target.count += 1;
+    cluster[index] = it->second;
+  }
+
+  // The vertex closest to the mean stands for the cluster
+  for (size_t v = 0; v < count; ++v) {
+    if (cluster[v] == BAKED_NONE)
+      continue;
+    cluster_t &target = clusters[cluster[v]];
+    const float *p = &mesh.vertices[v * BAKED_VERTEX_FLOATS];
+    float distance = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+      float d = p[c] - target.sum[c] / target.count;
+      distance += d * d;
+    }
+    if (distance < target.distance) {
+      target.distance = distance;
+      target.vertex = v;
+    }
+  }
+
+  std::vector<uint32_t> result;
+  std::unordered_set<uint64_t> seen;
+  bool unique = clusters.size() < (1u << 21); // fits the key
+  for (size_t i = 0; i + 2 < source.size(); i += 3) {
+    uint32_t a = cluster[source[i]], b = cluster[source[i + 1]],
+             c = cluster[source[i + 2]];
+    if (a == b || b == c || a == c)
+      continue;
+
+    // Same triangle with the same winding, starting from its lowest cluster
+    uint32_t rotated[3] = {a, b, c};
+    std::rotate(rotated, std::min_element(rotated, rotated + 3), rotated + 3);
+    uint64_t key = (uint64_t)rotated[0] << 42 | (uint64_t)rotated[1] << 21 |
+                   rotated[2];
+    if (unique && !seen.insert(key).second)
+      continue;
+    result.push_back(clusters[a].vertex);
+    result.push_back(clusters[b].vertex);
+    result.push_back(clusters[c].vertex);
+  }
+  return result;
+}
+
+void mesh_build_lods(mesh_data_t &mesh, int max_lods) {
+  float extent = 0.0f;
+  for (int c = 0; c < 3; ++c)
+    extent = std::max(extent, mesh.bounds_max[c] - mesh.bounds_min[c]);
+  if (mesh.lods.empty() || extent <= 0.0f)
+    return;
+
+  // Roughly one cell per vertex of a closed surface to start with
+  size_t count = mesh.vertices.size() / BAKED_VERTEX_FLOATS;
+  int grid = std::clamp((int)sqrtf((float)count), 2, 1 << 20);
+  size_t triangles = mesh.lods[0].indices.size() / 3;
+
+  while ((int)mesh.lods.size() < max_lods && triangles > 64 && grid >= 2) {
+    std::vector<uint32_t> indices = mesh_cluster(mesh, grid, extent);
+    if (indices.size() / 3 > triangles / 2) {
+      grid /= 2;
+      continue;
+    }
+    if (indices.empty())
+      break;
+
+    triangles = indices.size() / 3;
+    mesh_optimize_cache(indices, count);
+    mesh.lods.push_back({std::move(indices), sqrtf(3.0f) / grid});
+  }
+}
+
+float mesh_acmr(const std::vector<uint32_t> &indices, size_t vertex_count,
+                int cache_size) {
+  if (indices.empty())
+    return 0.0f;
+
+  // Time each vertex entered the cache, it is in while fewer entered since
+  std::vector<size_t> entered(vertex_count, 0);
+  size_t misses = 0;
+  for (uint32_t index : indices) {
+    if (entered[index] == 0 || misses - entered[index] >= (size_t)cache_size) {
+      misses += 1;
+      entered[index] = misses;
+    }
+  }
+  return (float)misses / (indices.size() / 3);
+}
+
+#endif
+
+} // namespace glib
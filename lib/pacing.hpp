@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+
+#include "graphics.hpp"
+
+namespace glib {
+
+// Frames the GPU may queue behind the CPU, at most
+#define PACING_MAX_FRAMES 3
+
+// Limits the frames in flight with a fence at the end of each frame, so input
+// sampled after pacing_begin reaches the screen within N frames and CPU
+// timings are not absorbed by the driver queue. The slot of a frame is reused
+// only after its fence signaled, per frame resources can be indexed by it.
+struct frame_pacer_t {
+  int frames_in_flight;
+  int slot; // of the current frame, in [0, frames_in_flight)
+  unsigned long frame;
+
+  GLsync fences[PACING_MAX_FRAMES];
+  double input_time[PACING_MAX_FRAMES]; // seconds, when pacing_begin returned
+
+  // Milliseconds, the input to present latency is measured up to the signal
+  // of the fence of the frame, noticed when polling at the next pacing call
+  double wait_ms; // CPU blocked in the last pacing_begin
+  double wait_total_ms;
+  double latency_ms; // of the last retired frame
+  double latency_total_ms, latency_max_ms;
+  unsigned long samples; // frames retired
+};
+
+// Between 1 and PACING_MAX_FRAMES, 0 reads GLIB_FRAMES_IN_FLIGHT or uses 2
+frame_pacer_t pacing_create(int frames_in_flight = 0);
+void pacing_destroy(frame_pacer_t &pacer);
+
+// Start of a frame, before sampling input: waits for the frame that used the
+// slot to complete on the GPU
+void pacing_begin(frame_pacer_t &pacer);
+// End of a frame, after window_present
+void pacing_end(frame_pacer_t &pacer);
+
+// Forget the accumulated measures, for example after a warmup
+void pacing_reset(frame_pacer_t &pacer);
+
+#ifdef GLIB_PACING_IMPL
+#undef GLIB_PACING_IMPL
+
+frame_pacer_t pacing_create(int frames_in_flight) {
+  if (frames_in_flight == 0) {
+    const char *env = getenv("GLIB_FRAMES_IN_FLIGHT");
+    frames_in_flight = env ? atoi(env) : 2;
+  }
+  if (frames_in_flight < 1 || frames_in_flight > PACING_MAX_FRAMES) {
+    printf("clamping frames in flight %d to [1, %d]\n", frames_in_flight,
+           PACING_MAX_FRAMES);
+    frames_in_flight = std::clamp(frames_in_flight, 1, PACING_MAX_FRAMES);
+  }
+
+  frame_pacer_t result = {};
+  result.frames_in_flight = frames_in_flight;
+  printf("created frame pacer(frames in flight: %d)\n", frames_in_flight);
+  return result;
+}
+
+// Record the latency of a frame whose fence signaled
+static void pacing_retire(frame_pacer_t &pacer, int slot, double now) {
+  glDeleteSync(pacer.fences[slot]);
+  pacer.fences[slot] = NULL;
+
+  pacer.latency_ms = (now - pacer.input_time[slot]) * 1000.0;
+  pacer.latency_total_ms += pacer.latency_ms;
+  pacer.latency_max_ms = std::max(pacer.latency_max_ms, pacer.latency_ms);
+  pacer.samples += 1;
+}
+
+// Retire every frame already complete without waiting
+static void pacing_poll(frame_pacer_t &pacer) {
+  double now = glfwGetTime();
+  for (int i = 0; i < pacer.frames_in_flight; ++i) {
+    if (pacer.fences[i] == NULL)
+      continue;
+    unsigned int status = glClientWaitSync(pacer.fences[i], 0, 0);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+      pacing_retire(pacer, i, now);
+  }
+}
+
+void pacing_begin(frame_pacer_t &pacer) {
+  GLIB_ZONE("pacing_begin");
+  double start = glfwGetTime();
+  pacing_poll(pacer);
+
+  // Flush once so the fence can signal, then block
+  GLsync fence = pacer.fences[pacer.slot];
+  unsigned int flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+  while (fence != NULL) {
+    unsigned int status = glClientWaitSync(fence, flags, 1000000);
+    if (status == GL_WAIT_FAILED) {
+      std::cout << "ERROR::PACING: Waiting on the frame fence failed\n";
+      exit(1);
+    }
+    if (status != GL_TIMEOUT_EXPIRED) {
+      pacing_retire(pacer, pacer.slot, glfwGetTime());
+      break;
+    }
+    flags = 0;
+  }
+
+  double now = glfwGetTime();
+  pacer.wait_ms = (now - start) * 1000.0;
+  pacer.wait_total_ms += pacer.wait_ms;
+  pacer.input_time[pacer.slot] = now;
+}
+
+void pacing_end(frame_pacer_t &pacer) {
+  pacer.fences[pacer.slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  pacer.slot = (pacer.slot + 1) % pacer.frames_in_flight;
+  pacer.frame += 1;
+  pacing_poll(pacer);
+}
+
+void pacing_reset(frame_pacer_t &pacer) {
+  pacer.wait_total_ms = 0.0;
+  pacer.latency_total_ms = 0.0;
+  pacer.latency_max_ms = 0.0;
+  pacer.samples = 0;
+}
+
+void pacing_destroy(frame_pacer_t &pacer) {
+  for (int i = 0; i < PACING_MAX_FRAMES; ++i)
+    if (pacer.fences[i] != NULL)
+      glDeleteSync(pacer.fences[i]);
+  pacer = {};
+}
+
+#endif
+
+} // namespace glib
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "graphics.hpp"
+
+namespace glib {
+
+// A preprocessor define injected in both stages of a program variant
+struct define_t {
+  std::string name;
+  std::string value;
+};
+
+using defines_t = std::vector<define_t>;
+
+// Compile the variant of a program specialised with the defines, variants are
+// compiled once and cached by a hash of the sources and the defines. Shaders
+// must guard their defaults with #ifndef to be overridable.
+program_t program_variant(const char *vertex, const char *fragment,
+                          const defines_t &defines);
+
+// Delete all cached variants
+void program_variant_clear();
+unsigned int program_variant_count();
+
+#ifdef GLIB_PERMUTATION_IMPL
+#undef GLIB_PERMUTATION_IMPL
+
+// All compiled variants by hash
+static std::unordered_map<uint64_t, program_t> program_variants;
+
+// FNV-1a
+static inline uint64_t variant_hash(uint64_t hash, const char *data) {
+  for (; *data; ++data) {
+    hash ^= (unsigned char)*data;
+    hash *= 0x100000001b3ull;
+  }
+  // Separator so that "ab" + "c" differs from "a" + "bc"
+  hash ^= 0xff;
+  hash *= 0x100000001b3ull;
+  return hash;
+}
+
+program_t program_variant(const char *vertex, const char *fragment,
+                          const defines_t &defines) {
+  GLIB_ZONE("program_variant");
+
+  // Order of the defines must not matter
+  defines_t sorted = defines;
+  std::sort(sorted.begin(), sorted.end(),
+            [](const define_t &a, const define_t &b) { return a.name < b.name; });
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  hash = variant_hash(hash, vertex);
+  hash = variant_hash(hash, fragment);
+
+  std::string header;
+  for (const define_t &define : sorted) {
+    hash = variant_hash(hash, define.name.c_str());
+    hash = variant_hash(hash, define.value.c_str());
+    header += "#define " + define.name + " " + define.value + "\n";
+  }
+
+  auto it = program_variants.find(hash);
+  if (it != program_variants.end())
+    return it->second;
+
+  std::string vs = shader_insert(vertex, header.c_str());
+  std::string fs = shader_insert(fragment, header.c_str());
+  program_t program = program_create(vs.c_str(), fs.c_str());
+
+  printf("created program variant(id: %d, hash: %016llx)\n", program.id,
+         (unsigned long long)hash);
+  program_variants.insert({hash, program});
+  return program;
+}
+
+void program_variant_clear() {
+  for (auto &[hash, program] : program_variants)
+    glDeleteProgram(program.id);
+  program_variants.clear();
+}
+
+unsigned int program_variant_count() { return program_variants.size(); }
+
+#endif
+
+} // namespace glib
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Zones are compiled only with GLIB_PROFILE, otherwise GLIB_ZONE is empty and
+// the functions below do nothing
+#ifdef GLIB_PROFILE
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+#endif
+
+namespace glib {
+
+// Zone aggregated over a frame
+struct profile_stat_t {
+  const char *name;
+  unsigned int calls;
+  double ms;
+};
+
+// Mark the end of a frame, its zones become available to profile_frame_stats
+void profile_frame();
+// Zones of the last completed frame, slowest first
+std::vector<profile_stat_t> profile_frame_stats();
+// Write all recorded zones as Chrome trace JSON (chrome://tracing, Perfetto)
+bool profile_export_chrome(const char *path);
+
+#ifdef GLIB_PROFILE
+
+// Zones kept per thread, the oldest are overwritten
+#define PROFILE_RING_CAPACITY (1 << 16)
+
+struct profile_event_t {
+  const char *name;
+  uint64_t begin, end;
+};
+
+// Written only by the owning thread, the head is published with release so
+// readers see complete events
+struct profile_ring_t {
+  profile_event_t events[PROFILE_RING_CAPACITY];
+  std::atomic<uint64_t> head;
+  int thread;
+};
+
+extern thread_local profile_ring_t *profile_ring;
+profile_ring_t *profile_register_thread();
+
+// Innermost open zone of the thread
+extern thread_local const char *profile_zone_active;
+inline const char *profile_zone_current() { return profile_zone_active; }
+
+// Raw ticks, converted to time only when exporting
+inline uint64_t profile_now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+inline void profile_record(const char *name, uint64_t begin, uint64_t end) {
+  profile_ring_t *ring = profile_ring;
+  if (ring == NULL)
+    ring = profile_register_thread();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  ring->events[head % PROFILE_RING_CAPACITY] = {name, begin, end};
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+// Records the enclosing scope, the name must be a string literal
+struct profile_zone_t {
+  const char *name, *parent;
+  uint64_t begin;
+  profile_zone_t(const char *name)
+      : name(name), parent(profile_zone_active), begin(profile_now()) {
+    profile_zone_active = name;
+  }
+  ~profile_zone_t() {
+    profile_record(name, begin, profile_now());
+    profile_zone_active = parent;
+  }
+};
+
+#define GLIB_PROFILE_CONCAT_(a, b) a##b
+#define GLIB_PROFILE_CONCAT(a, b) GLIB_PROFILE_CONCAT_(a, b)
+#define GLIB_ZONE(name)                                                        \
+  glib::profile_zone_t GLIB_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+
+#else
+#define GLIB_ZONE(name) ((void)0)
+inline const char *profile_zone_current() { return NULL; }
+#endif
+
+#ifdef GLIB_PROFILE_IMPL
+#undef GLIB_PROFILE_IMPL
+
+#ifdef GLIB_PROFILE
+} // namespace glib
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+namespace glib {
+
+thread_local profile_ring_t *profile_ring = NULL;
+thread_local const char *profile_zone_active = NULL;
+
+// Rings outlive their threads so they can still be exported
+static std::mutex profile_mutex;
+static std::vector<profile_ring_t *> profile_rings;
+
+// Tick and clock at startup, used to convert ticks to microseconds
+static uint64_t profile_start_ticks = profile_now();
+static std::chrono::steady_clock::time_point profile_start_clock =
+    std::chrono::steady_clock::now();
+
+// Bounds of the last completed frame in ticks
+static uint64_t profile_frame_begin, profile_frame_end = profile_start_ticks;
+
+profile_ring_t *profile_register_thread() {
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  profile_ring = new profile_ring_t();
+  profile_ring->thread = profile_rings.size();
+  profile_rings.push_back(profile_ring);
+  return profile_ring;
+}
+
+static double profile_ticks_per_us() {
+  uint64_t ticks = profile_now() - profile_start_ticks;
+  double us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - profile_start_clock)
+                  .count();
+  return (us > 0.0 && ticks > 0) ? ticks / us : 1.0;
+}
+
+void profile_frame() {
+  if (profile_ring == NULL)
+    profile_register_thread();
+
+  uint64_t now = profile_now();
+  profile_frame_begin = profile_frame_end;
+  profile_frame_end = now;
+  profile_record("frame", profile_frame_begin, profile_frame_end);
+}
+
+std::vector<profile_stat_t> profile_frame_stats() {
+  std::vector<profile_stat_t> result;
+  double ticks_per_ms = profile_ticks_per_us() * 1000.0;
+
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  for (profile_ring_t *ring : profile_rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t tail =
+        head > PROFILE_RING_CAPACITY ? head - PROFILE_RING_CAPACITY : 0;
+
+    // Events are ordered by end time, walk back until the frame start
+    for (uint64_t i = head; i > tail; --i) {
+      const profile_event_t &event =
+          ring->events[(i - 1) % PROFILE_RING_CAPACITY];
+      if (event.end <= profile_frame_begin)
+        break;
+      if (event.end > profile_frame_end || strcmp(event.name, "frame") == 0)
+        continue;
+
+      auto stat = std::find_if(result.begin(), result.end(),
+                               [&](const profile_stat_t &s) {
+                                 return strcmp(s.name, event.name) == 0;
+                               });
+      if (stat == result.end())
+        stat = result.insert(result.end(), {event.name, 0, 0.0});
+      stat->calls += 1;
+      stat->ms += (event.end - event.begin) / ticks_per_ms;
+    }
+  }
+
+  std::sort(result.begin(), result.end(),
+            [](const profile_stat_t &a, const profile_stat_t &b) {
+              return a.ms > b.ms;
+            });
+  return result;
+}
+
+bool profile_export_chrome(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    printf("ERROR::PROFILE: Unable to write %s\n", path);
+    return false;
+  }
+
+  double ticks_per_us = profile_ticks_per_us();
+  size_t count = 0;
+
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (profile_ring_t *ring : profile_rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t tail =
+        head > PROFILE_RING_CAPACITY ? head - PROFILE_RING_CAPACITY : 0;
+
+    for (uint64_t i = tail; i < head; ++i) {
+      const profile_event_t &event = ring->events[i % PROFILE_RING_CAPACITY];
+      double ts = (event.begin - profile_start_ticks) / ticks_per_us;
+      double dur = (event.end - event.begin) / ticks_per_us;
+      fprintf(file,
+              "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f}\n",
+              count++ ? "," : "", event.name, ring->thread, ts, dur);
+    }
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+
+  printf("written trace %s (%zu zones)\n", path, count);
+  return true;
+}
+
+#else
+} // namespace glib
+
+#include <cstdio>
+
+namespace glib {
+
+void profile_frame() {}
+std::vector<profile_stat_t> profile_frame_stats() { return {}; }
+bool profile_export_chrome(const char *path) {
+  printf("ERROR::PROFILE: Built without GLIB_PROFILE, %s not written\n", path);
+  return false;
+}
+
+#endif
+#endif
+
+} // namespace glib
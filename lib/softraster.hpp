@@ -0,0 +1,881 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "profiler.hpp"
+
+// Software rasteriser mirroring buffer_t/program_t/render on the CPU, for
+// deterministic tests, machines without a GPU and CPU throughput benchmarks.
+// Triangles are binned into tiles and the tiles are rasterised by a pool of
+// worker threads, coverage and depth are tested 4 pixels at a time with SSE2
+// when available. Framebuffers follow GL: row 0 is the bottom one and depth
+// is in [0, 1] with a GL_LESS test.
+
+namespace glib {
+
+#define SOFT_TILE_SIZE 64
+#define SOFT_MAX_TARGETS 4
+#define SOFT_MAX_VARYINGS 32
+
+enum soft_primitive_e { SOFT_TRIANGLES, SOFT_TRIANGLE_STRIP };
+
+// Interleaved vertices of stride floats, the CPU side of buffer_t
+struct soft_buffer_t {
+  std::vector<float> vertices;
+  std::vector<unsigned int> indices; // empty to draw the vertices in order
+  int stride;
+  unsigned int v_count, e_count;
+};
+
+// Vertex shader: reads a vertex, writes the varyings and returns gl_Position
+using soft_vertex_fn =
+    std::function<glm::vec4(const float *vertex, float *varyings)>;
+// Fragment shader: reads the interpolated varyings, writes every target
+using soft_fragment_fn =
+    std::function<void(const float *varyings, glm::vec4 *colors)>;
+
+struct soft_program_t {
+  int varyings;
+  soft_vertex_fn vertex;
+  soft_fragment_fn fragment;
+};
+
+// Linear RGBA texels, sampled bilinearly with repeat
+struct soft_texture_t {
+  int width, height;
+  std::vector<glm::vec4> texels;
+};
+
+struct soft_framebuffer_t {
+  int width, height;
+  int targets;
+  std::vector<glm::vec4> colors[SOFT_MAX_TARGETS];
+  std::vector<float> depth;
+};
+
+// Work of the last soft_render
+struct soft_stats_t {
+  unsigned long triangles; // after clipping
+  unsigned long culled;    // outside the frustum or degenerate
+  unsigned long fragments; // covered pixels
+  unsigned long shaded;    // fragments that passed the depth test
+};
+
+// Start the worker threads, 0 uses every hardware thread. soft_render starts
+// them on first use otherwise.
+void soft_initialize(int threads = 0);
+void soft_terminate();
+// Threads rendering, the caller included
+int soft_threads();
+
+soft_buffer_t soft_buffer_create(const std::vector<float> *data,
+                                 const std::vector<unsigned int> *indices,
+                                 int stride);
+
+// From 8 bit data with 1 to 4 channels, rows bottom to top like glTexImage2D
+soft_texture_t soft_texture_create(int width, int height, int channels,
+                                   const unsigned char *data);
+glm::vec4 soft_texture_sample(const soft_texture_t &texture, glm::vec2 uv);
+
+soft_framebuffer_t soft_framebuffer_create(int width, int height,
+                                           int targets = 1);
+void soft_clear(soft_framebuffer_t &framebuffer, glm::vec4 color,
+                float depth = 1.0f);
+// RGB of a target as clamp(value * scale + bias), rows top to bottom
+void soft_framebuffer_rgb8(const soft_framebuffer_t &framebuffer, int target,
+                           std::vector<unsigned char> &rgb, float scale = 1.0f,
+                           float bias = 0.0f);
+
+void soft_render(soft_framebuffer_t &framebuffer, const soft_buffer_t &buffer,
+                 const soft_program_t &program,
+                 soft_primitive_e primitive = SOFT_TRIANGLES);
+const soft_stats_t &soft_stats();
+
+// =============================================================================
+// Shaders of the demos, the uniforms are read when drawing so they can change
+// between draws like glUniform
+
+// Position only with a constant color (layout 3F)
+struct soft_basic_uniforms_t {
+  glm::mat4 model, view, proj;
+  glm::vec4 color;
+};
+soft_program_t soft_program_basic(const soft_basic_uniforms_t &uniforms);
+
+// Position and uv (layout_3F2F)
+struct soft_textured_uniforms_t {
+  glm::mat4 model, view, proj;
+  const soft_texture_t *texture;
+};
+soft_program_t soft_program_textured(const soft_textured_uniforms_t &uniforms);
+
+// Tangent space lighting of final/shaders.hpp (layout_3F3F3F2F)
+struct soft_lit_uniforms_t {
+  glm::mat4 model, view, proj;
+  glm::vec3 camera_pos, sun_dir, light_pos;
+  const soft_texture_t *diffuse, *specular, *normal;
+  bool torch;
+};
+soft_program_t soft_program_lit(const soft_lit_uniforms_t &uniforms);
+
+// Geometry pass of gbuffer/shaders.hpp (layout_3F3F3F2F), writes position,
+// normal, color and specular, and velocity to 4 targets
+struct soft_gbuffer_uniforms_t {
+  glm::mat4 model, view, proj;
+  glm::mat4 prev_model, prev_view_proj;
+  const soft_texture_t *diffuse, *specular, *normal;
+};
+soft_program_t soft_program_gbuffer(const soft_gbuffer_uniforms_t &uniforms);
+
+#ifdef GLIB_SOFTRASTER_IMPL
+#undef GLIB_SOFTRASTER_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace glib {
+
+// =============================================================================
+// Worker pool, the calling thread takes part as worker 0
+
+struct soft_pool_t {
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+
+  // Job of the current generation, a callable behind a plain pointer so
+  // starting it does not allocate
+  void (*run)(void *context, int worker);
+  void *context;
+  unsigned long generation;
+  int pending;
+  bool started, quit;
+};
+
+static soft_pool_t soft_pool;
+
+int soft_threads() { return soft_pool.threads.size() + 1; }
+
+static void soft_worker(int worker, unsigned long seen) {
+  while (true) {
+    std::unique_lock<std::mutex> lock(soft_pool.mutex);
+    soft_pool.wake.wait(lock, [&]() {
+      return soft_pool.quit || soft_pool.generation != seen;
+    });
+    if (soft_pool.quit)
+      return;
+    seen = soft_pool.generation;
+    lock.unlock();
+
+    soft_pool.run(soft_pool.context, worker);
+
+    lock.lock();
+    if (--soft_pool.pending == 0)
+      soft_pool.done.notify_one();
+  }
+}
+
+// Run the job once on every worker and wait for all of them
+template <typename F> static void soft_parallel(F &job) {
+  {
+    std::lock_guard<std::mutex> lock(soft_pool.mutex);
+    soft_pool.run = [](void *context, int worker) { (*(F *)context)(worker); };
+    soft_pool.context = &job;
+    soft_pool.pending = soft_pool.threads.size();
+    soft_pool.generation += 1;
+  }
+  soft_pool.wake.notify_all();
+  job(0);
+
+  std::unique_lock<std::mutex> lock(soft_pool.mutex);
+  soft_pool.done.wait(lock, [&]() { return soft_pool.pending == 0; });
+}
+
+void soft_initialize(int threads) {
+  soft_terminate();
+  if (threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  soft_pool.quit = false;
+  soft_pool.started = true;
+  for (int i = 1; i < threads; ++i)
+    soft_pool.threads.emplace_back(soft_worker, i, soft_pool.generation);
+  printf("created software rasteriser(threads: %d)\n", threads);
+}
+
+void soft_terminate() {
+  {
+    std::lock_guard<std::mutex> lock(soft_pool.mutex);
+    soft_pool.quit = true;
+  }
+  soft_pool.wake.notify_all();
+  for (std::thread &thread : soft_pool.threads)
+    thread.join();
+  soft_pool.threads.clear();
+  soft_pool.started = false;
+}
+
+// =============================================================================
+// Resources
+
+soft_buffer_t soft_buffer_create(const std::vector<float> *data,
+                                 const std::vector<unsigned int> *indices,
+                                 int stride) {
+  soft_buffer_t result = {.vertices = *data, .stride = stride};
+  result.v_count = data->size() / stride;
+  if (indices != NULL) {
+    result.indices = *indices;
+    result.e_count = indices->size();
+  }
+  return result;
+}
+
+soft_texture_t soft_texture_create(int width, int height, int channels,
+                                   const unsigned char *data) {
+  soft_texture_t result = {.width = width, .height = height};
+  result.texels.resize((size_t)width * height);
+  for (size_t i = 0; i < result.texels.size(); ++i) {
+    const unsigned char *texel = &data[i * channels];
+    glm::vec4 &out = result.texels[i];
+    out = glm::vec4(texel[0], texel[0], texel[0], 255.0f) / 255.0f;
+    if (channels >= 3)
+      out.g = texel[1] / 255.0f, out.b = texel[2] / 255.0f;
+    if (channels == 2 || channels == 4)
+      out.a = texel[channels - 1] / 255.0f;
+  }
+  return result;
+}
+
+glm::vec4 soft_texture_sample(const soft_texture_t &texture, glm::vec2 uv) {
+  // Texel centers at half integers like GL
+  float x = uv.x * texture.width - 0.5f;
+  float y = uv.y * texture.height - 0.5f;
+  float fx = floorf(x), fy = floorf(y);
+  float tx = x - fx, ty = y - fy;
+
+  auto wrap = [](int value, int size) {
+    value %= size;
+    return value < 0 ? value + size : value;
+  };
+  int x0 = wrap((int)fx, texture.width), x1 = wrap(x0 + 1, texture.width);
+  int y0 = wrap((int)fy, texture.height), y1 = wrap(y0 + 1, texture.height);
+
+  const glm::vec4 *texels = texture.texels.data();
+  glm::vec4 bottom = glm::mix(texels[y0 * texture.width + x0],
+                              texels[y0 * texture.width + x1], tx);
+  glm::vec4 top = glm::mix(texels[y1 * texture.width + x0],
+                           texels[y1 * texture.width + x1], tx);
+  return glm::mix(bottom, top, ty);
+}
+
+soft_framebuffer_t soft_framebuffer_create(int width, int height,
+                                           int targets) {
+  soft_framebuffer_t result = {
+      .width = width, .height = height, .targets = targets};
+  for (int i = 0; i < targets; ++i)
+    result.colors[i].resize((size_t)width * height);
+
+  // Padded so the last pixels can be loaded 4 at a time
+  result.depth.resize((size_t)width * height + 4, 1.0f);
+  return result;
+}
+
+void soft_clear(soft_framebuffer_t &framebuffer, glm::vec4 color,
+                float depth) {
+  for (int i = 0; i < framebuffer.targets; ++i)
+    std::fill(framebuffer.colors[i].begin(), framebuffer.colors[i].end(),
+              color);
+  std::fill(framebuffer.depth.begin(), framebuffer.depth.end(), depth);
+}
+
+void soft_framebuffer_rgb8(const soft_framebuffer_t &framebuffer, int target,
+                           std::vector<unsigned char> &rgb, float scale,
+                           float bias) {
+  int width = framebuffer.width, height = framebuffer.height;
+  rgb.resize((size_t)width * height * 3);
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      const glm::vec4 &color =
+          framebuffer.colors[target][(size_t)(height - 1 - y) * width + x];
+      for (int c = 0; c < 3; ++c) {
+        float value = std::clamp(color[c] * scale + bias, 0.0f, 1.0f);
+        rgb[((size_t)y * width + x) * 3 + c] = value * 255.0f + 0.5f;
+      }
+    }
+}
+
+// =============================================================================
+// Pipeline
+
+// Vertex after the vertex shader, varyings in a separate array
+struct soft_vertex_t {
+  glm::vec4 clip;
+  const float *varyings;
+};
+
+// Triangle in screen space ready to rasterise
+struct soft_triangle_t {
+  float x[3], y[3], z[3], inv_w[3];
+  const float *varyings[3];
+  float inv_area;
+  bool top_left[3]; // edge i goes from vertex i+1 to vertex i+2
+  int min_x, min_y, max_x, max_y;
+};
+
+// Per worker output of the setup, binned in primitive order
+struct soft_bin_t {
+  std::vector<soft_triangle_t> triangles;
+  std::vector<std::vector<unsigned int>> tiles;
+  std::vector<float> clipped; // varyings of the vertices made by clipping
+  soft_stats_t stats;
+};
+
+// Buffers kept across draws so the steady state does not allocate
+static struct {
+  std::vector<glm::vec4> clip;
+  std::vector<float> varyings;
+  std::vector<soft_bin_t> bins;
+  soft_stats_t stats;
+} soft_state;
+
+const soft_stats_t &soft_stats() { return soft_state.stats; }
+
+// Vertices of primitive i in the draw order
+static inline void soft_primitive_indices(const soft_buffer_t &buffer,
+                                          soft_primitive_e primitive, size_t i,
+                                          unsigned int out[3]) {
+  size_t first = primitive == SOFT_TRIANGLES ? i * 3 : i;
+  for (int v = 0; v < 3; ++v)
+    out[v] = first + v;
+
+  // Odd triangles of a strip keep the winding of the even ones
+  if (primitive == SOFT_TRIANGLE_STRIP && (i & 1))
+    std::swap(out[0], out[1]);
+
+  if (!buffer.indices.empty())
+    for (int v = 0; v < 3; ++v)
+      out[v] = buffer.indices[out[v]];
+}
+
+static void soft_setup(soft_bin_t &bin, const soft_framebuffer_t &framebuffer,
+                       const soft_vertex_t vertices[3]) {
+  float x[3], y[3], z[3], inv_w[3];
+  for (int v = 0; v < 3; ++v) {
+    const glm::vec4 &clip = vertices[v].clip;
+    inv_w[v] = 1.0f / clip.w;
+    x[v] = (clip.x * inv_w[v] * 0.5f + 0.5f) * framebuffer.width;
+    y[v] = (clip.y * inv_w[v] * 0.5f + 0.5f) * framebuffer.height;
+    z[v] = clip.z * inv_w[v] * 0.5f + 0.5f;
+  }
+
+  // Counter clockwise triangles have a positive area, both are drawn
+  float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (!(fabsf(area) > 0.0f)) {
+    bin.stats.culled += 1;
+    return;
+  }
+  int order[3] = {0, 1, 2};
+  if (area < 0.0f) {
+    std::swap(order[1], order[2]);
+    area = -area;
+  }
+
+  soft_triangle_t triangle;
+  for (int v = 0; v < 3; ++v) {
+    triangle.x[v] = x[order[v]];
+    triangle.y[v] = y[order[v]];
+    triangle.z[v] = z[order[v]];
+    triangle.inv_w[v] = inv_w[order[v]];
+    triangle.varyings[v] = vertices[order[v]].varyings;
+  }
+  triangle.inv_area = 1.0f / area;
+
+  // Shared edges are walked in opposite directions, exactly one owns them
+  for (int e = 0; e < 3; ++e) {
+    int a = (e + 1) % 3, b = (e + 2) % 3;
+    float dx = triangle.x[b] - triangle.x[a];
+    float dy = triangle.y[b] - triangle.y[a];
+    triangle.top_left[e] = dy > 0.0f || (dy == 0.0f && dx < 0.0f);
+  }
+
+  // Clamped before converting, vertices close to w = 0 are far off screen
+  float width = framebuffer.width, height = framebuffer.height;
+  float min_x = std::min({triangle.x[0], triangle.x[1], triangle.x[2]});
+  float max_x = std::max({triangle.x[0], triangle.x[1], triangle.x[2]});
+  float min_y = std::min({triangle.y[0], triangle.y[1], triangle.y[2]});
+  float max_y = std::max({triangle.y[0], triangle.y[1], triangle.y[2]});
+  triangle.min_x = floorf(std::clamp(min_x, 0.0f, width - 1.0f));
+  triangle.min_y = floorf(std::clamp(min_y, 0.0f, height - 1.0f));
+  triangle.max_x = ceilf(std::clamp(max_x, 0.0f, width - 1.0f));
+  triangle.max_y = ceilf(std::clamp(max_y, 0.0f, height - 1.0f));
+  if (min_x > width || max_x < 0.0f || min_y > height || max_y < 0.0f) {
+    bin.stats.culled += 1;
+    return;
+  }
+
+  unsigned int index = bin.triangles.size();
+  bin.triangles.push_back(triangle);
+  bin.stats.triangles += 1;
+
+  int tiles_x = (framebuffer.width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+  for (int ty = triangle.min_y / SOFT_TILE_SIZE;
+       ty <= triangle.max_y / SOFT_TILE_SIZE; ++ty)
+    for (int tx = triangle.min_x / SOFT_TILE_SIZE;
+         tx <= triangle.max_x / SOFT_TILE_SIZE; ++tx)
+      bin.tiles[ty * tiles_x + tx].push_back(index);
+}
+
+// Clip against the near plane z = -w, the only one that needs it: the others
+// are handled by the bounding box and the depth test
+static void soft_assemble(soft_bin_t &bin,
+                          const soft_framebuffer_t &framebuffer, int varyings,
+                          const soft_vertex_t input[3]) {
+  // Outside the same frustum plane
+  for (int axis = 0; axis < 3; ++axis) {
+    int below = 0, above = 0;
+    for (int v = 0; v < 3; ++v) {
+      below += input[v].clip[axis] < -input[v].clip.w;
+      above += input[v].clip[axis] > input[v].clip.w;
+    }
+    if (below == 3 || above == 3) {
+      bin.stats.culled += 1;
+      return;
+    }
+  }
+
+  float distance[3];
+  int inside = 0;
+  for (int v = 0; v < 3; ++v) {
+    distance[v] = input[v].clip.z + input[v].clip.w;
+    inside += distance[v] >= 0.0f;
+  }
+  if (inside == 3) {
+    soft_setup(bin, framebuffer, input);
+    return;
+  }
+
+  // Sutherland-Hodgman, the clipped array is reserved for the worst case so
+  // the varyings of the new vertices never move
+  soft_vertex_t polygon[4];
+  int count = 0;
+  for (int v = 0; v < 3; ++v) {
+    int next = (v + 1) % 3;
+    if (distance[v] >= 0.0f)
+      polygon[count++] = input[v];
+    if ((distance[v] >= 0.0f) == (distance[next] >= 0.0f))
+      continue;
+
+    float t = distance[v] / (distance[v] - distance[next]);
+    size_t offset = bin.clipped.size();
+    for (int i = 0; i < varyings; ++i)
+      bin.clipped.push_back(glm::mix(input[v].varyings[i],
+                                     input[next].varyings[i], t));
+    polygon[count++] = {glm::mix(input[v].clip, input[next].clip, t),
+                        bin.clipped.data() + offset};
+  }
+
+  for (int i = 1; i + 1 < count; ++i) {
+    soft_vertex_t triangle[3] = {polygon[0], polygon[i], polygon[i + 1]};
+    soft_setup(bin, framebuffer, triangle);
+  }
+}
+
+// Coverage and depth test of 4 pixels of a row starting at x, returns the
+// mask of the pixels to shade and their depth
+static inline int soft_test4(const soft_triangle_t &triangle, const float w[3],
+                             const float step[3], const float *depth,
+                             int lanes, float z[4]) {
+#ifdef __SSE2__
+  const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 weights[3];
+  __m128 mask = _mm_castsi128_ps(_mm_cmplt_epi32(
+      _mm_setr_epi32(0, 1, 2, 3), _mm_set1_epi32(lanes)));
+  for (int e = 0; e < 3; ++e) {
+    weights[e] = _mm_add_ps(_mm_set1_ps(w[e]),
+                            _mm_mul_ps(offsets, _mm_set1_ps(step[e])));
+    __m128 inside = triangle.top_left[e] ? _mm_cmpge_ps(weights[e], zero)
+                                         : _mm_cmpgt_ps(weights[e], zero);
+    mask = _mm_and_ps(mask, inside);
+  }
+  if (_mm_movemask_ps(mask) == 0)
+    return 0;
+
+  // Screen space depth, linear in the barycentrics
+  __m128 inv_area = _mm_set1_ps(triangle.inv_area);
+  __m128 depths = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(weights[0], _mm_set1_ps(triangle.z[0])),
+                            _mm_mul_ps(weights[1], _mm_set1_ps(triangle.z[1]))),
+                 _mm_mul_ps(weights[2], _mm_set1_ps(triangle.z[2]))),
+      inv_area);
+  _mm_storeu_ps(z, depths);
+  int covered = _mm_movemask_ps(mask);
+  mask = _mm_and_ps(mask, _mm_cmplt_ps(depths, _mm_loadu_ps(depth)));
+  return covered << 4 | _mm_movemask_ps(mask);
+#else
+  int covered = 0, passed = 0;
+  for (int lane = 0; lane < lanes; ++lane) {
+    bool inside = true;
+    float weights[3];
+    for (int e = 0; e < 3; ++e) {
+      weights[e] = w[e] + lane * step[e];
+      inside &= triangle.top_left[e] ? weights[e] >= 0.0f : weights[e] > 0.0f;
+    }
+    if (!inside)
+      continue;
+
+    z[lane] = (weights[0] * triangle.z[0] + weights[1] * triangle.z[1] +
+               weights[2] * triangle.z[2]) *
+              triangle.inv_area;
+    covered |= 1 << lane;
+    if (z[lane] < depth[lane])
+      passed |= 1 << lane;
+  }
+  return covered << 4 | passed;
+#endif
+}
+
+static void soft_raster(soft_framebuffer_t &framebuffer,
+                        const soft_program_t &program,
+                        const soft_triangle_t &triangle, int tile_x0,
+                        int tile_y0, int tile_x1, int tile_y1,
+                        soft_stats_t &stats) {
+  int x0 = std::max(triangle.min_x, tile_x0) & ~3;
+  int x1 = std::min(triangle.max_x, tile_x1);
+  int y0 = std::max(triangle.min_y, tile_y0);
+  int y1 = std::min(triangle.max_y, tile_y1);
+
+  // Edge i is opposite to vertex i, its weight grows towards it
+  float step_x[3], step_y[3], origin[3];
+  for (int e = 0; e < 3; ++e) {
+    int a = (e + 1) % 3, b = (e + 2) % 3;
+    step_x[e] = triangle.y[a] - triangle.y[b];
+    step_y[e] = triangle.x[b] - triangle.x[a];
+    origin[e] = (triangle.x[b] - triangle.x[a]) * (y0 + 0.5f - triangle.y[a]) -
+                (triangle.y[b] - triangle.y[a]) * (x0 + 0.5f - triangle.x[a]);
+  }
+
+  float varyings[SOFT_MAX_VARYINGS];
+  glm::vec4 colors[SOFT_MAX_TARGETS];
+  for (int y = y0; y <= y1; ++y) {
+    float row[3];
+    for (int e = 0; e < 3; ++e)
+      row[e] = origin[e] + (y - y0) * step_y[e];
+
+    for (int x = x0; x <= x1; x += 4) {
+      float w[3], z[4];
+      for (int e = 0; e < 3; ++e)
+        w[e] = row[e] + (x - x0) * step_x[e];
+
+      size_t index = (size_t)y * framebuffer.width + x;
+      int lanes = std::min(4, x1 - x + 1);
+      int mask = soft_test4(triangle, w, step_x, &framebuffer.depth[index],
+                            lanes, z);
+      stats.fragments += __builtin_popcount(mask >> 4);
+      mask &= 0xF;
+
+      while (mask != 0) {
+        int lane = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        // Perspective correct barycentrics
+        float b[3], sum = 0.0f;
+        for (int e = 0; e < 3; ++e) {
+          b[e] = (w[e] + lane * step_x[e]) * triangle.inv_w[e];
+          sum += b[e];
+        }
+        for (int e = 0; e < 3; ++e)
+          b[e] /= sum;
+        for (int i = 0; i < program.varyings; ++i)
+          varyings[i] = b[0] * triangle.varyings[0][i] +
+                        b[1] * triangle.varyings[1][i] +
+                        b[2] * triangle.varyings[2][i];
+
+        program.fragment(varyings, colors);
+        for (int t = 0; t < framebuffer.targets; ++t)
+          framebuffer.colors[t][index + lane] = colors[t];
+        framebuffer.depth[index + lane] = z[lane];
+        stats.shaded += 1;
+      }
+    }
+  }
+}
+
+void soft_render(soft_framebuffer_t &framebuffer, const soft_buffer_t &buffer,
+                 const soft_program_t &program, soft_primitive_e primitive) {
+  GLIB_ZONE("soft_render");
+  assert(program.varyings <= SOFT_MAX_VARYINGS && "Too many varyings");
+  if (!soft_pool.started)
+    soft_initialize();
+
+  int workers = soft_threads();
+  int varyings = program.varyings;
+  size_t v_count = buffer.v_count;
+  size_t count = buffer.indices.empty() ? buffer.v_count : buffer.e_count;
+  size_t primitives = primitive == SOFT_TRIANGLES
+                          ? count / 3
+                          : (count >= 3 ? count - 2 : 0);
+
+  int tiles_x = (framebuffer.width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+  int tiles_y = (framebuffer.height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+  int tiles = tiles_x * tiles_y;
+
+  soft_state.clip.resize(v_count);
+  soft_state.varyings.resize(v_count * varyings);
+  soft_state.bins.resize(workers);
+
+  // Vertices in chunks taken by any worker
+  const size_t VERTEX_CHUNK = 256;
+  std::atomic<size_t> next_vertex(0);
+  auto vertex_stage = [&](int) {
+    GLIB_ZONE("soft_vertex");
+    size_t first;
+    while ((first = next_vertex.fetch_add(VERTEX_CHUNK)) < v_count) {
+      size_t last = std::min(first + VERTEX_CHUNK, v_count);
+      for (size_t v = first; v < last; ++v)
+        soft_state.clip[v] =
+            program.vertex(&buffer.vertices[v * buffer.stride],
+                           &soft_state.varyings[v * varyings]);
+    }
+  };
+  soft_parallel(vertex_stage);
+
+  // Each worker sets up a contiguous range of primitives so reading the bins
+  // in worker order keeps the draw order
+  auto setup_stage = [&](int worker) {
+    GLIB_ZONE("soft_setup");
+    soft_bin_t &bin = soft_state.bins[worker];
+    size_t first = primitives * worker / workers;
+    size_t last = primitives * (worker + 1) / workers;
+
+    bin.triangles.clear();
+    bin.clipped.clear();
+    bin.clipped.reserve((last - first) * 2 * varyings);
+    bin.tiles.resize(tiles);
+    for (std::vector<unsigned int> &tile : bin.tiles)
+      tile.clear();
+    bin.stats = {};
+
+    for (size_t i = first; i < last; ++i) {
+      unsigned int indices[3];
+      soft_primitive_indices(buffer, primitive, i, indices);
+      soft_vertex_t vertices[3];
+      for (int v = 0; v < 3; ++v)
+        vertices[v] = {soft_state.clip[indices[v]],
+                       &soft_state.varyings[indices[v] * varyings]};
+      soft_assemble(bin, framebuffer, varyings, vertices);
+    }
+  };
+  soft_parallel(setup_stage);
+
+  // Tiles are independent, any worker takes the next one
+  std::atomic<int> next_tile(0);
+  auto raster_stage = [&](int worker) {
+    GLIB_ZONE("soft_raster");
+    soft_stats_t &stats = soft_state.bins[worker].stats;
+    int tile;
+    while ((tile = next_tile.fetch_add(1)) < tiles) {
+      int x0 = (tile % tiles_x) * SOFT_TILE_SIZE;
+      int y0 = (tile / tiles_x) * SOFT_TILE_SIZE;
+      int x1 = std::min(x0 + SOFT_TILE_SIZE, framebuffer.width) - 1;
+      int y1 = std::min(y0 + SOFT_TILE_SIZE, framebuffer.height) - 1;
+
+      for (soft_bin_t &bin : soft_state.bins)
+        for (unsigned int index : bin.tiles[tile])
+          soft_raster(framebuffer, program, bin.triangles[index], x0, y0, x1,
+                      y1, stats);
+    }
+  };
+  soft_parallel(raster_stage);
+
+  soft_state.stats = {};
+  for (const soft_bin_t &bin : soft_state.bins) {
+    soft_state.stats.triangles += bin.stats.triangles;
+    soft_state.stats.culled += bin.stats.culled;
+    soft_state.stats.fragments += bin.stats.fragments;
+    soft_state.stats.shaded += bin.stats.shaded;
+  }
+}
+
+// =============================================================================
+// Shaders
+
+soft_program_t soft_program_basic(const soft_basic_uniforms_t &uniforms) {
+  soft_program_t result = {.varyings = 0};
+  result.vertex = [&uniforms](const float *vertex, float *) {
+    return uniforms.proj * uniforms.view * uniforms.model *
+           glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+  };
+  result.fragment = [&uniforms](const float *, glm::vec4 *colors) {
+    colors[0] = uniforms.color;
+  };
+  return result;
+}
+
+soft_program_t soft_program_textured(const soft_textured_uniforms_t &uniforms) {
+  soft_program_t result = {.varyings = 2};
+  result.vertex = [&uniforms](const float *vertex, float *varyings) {
+    varyings[0] = vertex[3];
+    varyings[1] = vertex[4];
+    return uniforms.proj * uniforms.view * uniforms.model *
+           glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+  };
+  result.fragment = [&uniforms](const float *varyings, glm::vec4 *colors) {
+    colors[0] = soft_texture_sample(*uniforms.texture,
+                                    glm::vec2(varyings[0], varyings[1]));
+  };
+  return result;
+}
+
+// Tangent, bitangent and normal of a vertex of layout_3F3F3F2F
+static inline glm::mat3 soft_tbn(const glm::mat4 &model, const float *vertex) {
+  glm::mat3 normalizer = glm::transpose(glm::inverse(glm::mat3(model)));
+  glm::vec3 N = glm::normalize(
+      normalizer * glm::vec3(vertex[3], vertex[4], vertex[5]));
+  glm::vec3 T = glm::normalize(
+      normalizer * glm::vec3(vertex[6], vertex[7], vertex[8]));
+  T = glm::normalize(T - glm::dot(T, N) * N);
+  return glm::mat3(T, glm::cross(N, T), N);
+}
+
+static inline glm::vec3 soft_rgb(const soft_texture_t &texture, glm::vec2 uv) {
+  return glm::vec3(soft_texture_sample(texture, uv));
+}
+
+#define SOFT_SHININESS 64.0f
+
+soft_program_t soft_program_lit(const soft_lit_uniforms_t &uniforms) {
+  // uv, then frag_pos, camera_pos, sun_dir and light_pos in tangent space
+  soft_program_t result = {.varyings = 14};
+  result.vertex = [&uniforms](const float *vertex, float *varyings) {
+    glm::vec4 position(vertex[0], vertex[1], vertex[2], 1.0f);
+    glm::mat3 TBN = glm::transpose(soft_tbn(uniforms.model, vertex));
+
+    glm::vec3 tspace[4] = {TBN * glm::vec3(uniforms.model * position),
+                           TBN * uniforms.camera_pos, TBN * uniforms.sun_dir,
+                           TBN * uniforms.light_pos};
+    varyings[0] = vertex[9];
+    varyings[1] = vertex[10];
+    for (int i = 0; i < 4; ++i)
+      for (int c = 0; c < 3; ++c)
+        varyings[2 + i * 3 + c] = tspace[i][c];
+    return uniforms.proj * uniforms.view * uniforms.model * position;
+  };
+
+  result.fragment = [&uniforms](const float *varyings, glm::vec4 *colors) {
+    glm::vec2 uv(varyings[0], varyings[1]);
+    glm::vec3 frag_pos(varyings[2], varyings[3], varyings[4]);
+    glm::vec3 camera_pos(varyings[5], varyings[6], varyings[7]);
+    glm::vec3 sun_dir(varyings[8], varyings[9], varyings[10]);
+    glm::vec3 light_pos(varyings[11], varyings[12], varyings[13]);
+
+    glm::vec3 diffuse_map = soft_rgb(*uniforms.diffuse, uv);
+    glm::vec3 specular_map = soft_rgb(*uniforms.specular, uv);
+    glm::vec3 V = glm::normalize(camera_pos - frag_pos);
+    glm::vec3 N =
+        glm::normalize(soft_rgb(*uniforms.normal, uv) * 2.0f - 1.0f);
+
+    // Diffuse and specular terms of a light coming from L
+    auto shade = [&](glm::vec3 L, glm::vec3 color, float k) {
+      glm::vec3 R = glm::reflect(-L, N);
+      float kD = std::max(glm::dot(L, N), 0.0f);
+      float kS = powf(std::max(glm::dot(V, R), 0.0f), SOFT_SHININESS);
+      return color * k * (kD * diffuse_map + kS * specular_map);
+    };
+
+    // Sun with ambient
+    glm::vec3 sun_color(0.15f, 0.5f, 0.15f);
+    glm::vec3 result = sun_color * 0.1f * diffuse_map +
+                       shade(glm::normalize(-sun_dir), sun_color, 1.0f);
+
+    // Point light with attenuation
+    float distance = glm::length(light_pos - frag_pos);
+    float kFO = 1.0f / (1.0f + 0.01f * distance + 0.032f * distance * distance);
+    result += shade(glm::normalize(light_pos - frag_pos),
+                    glm::vec3(1.0f, 0.3f, 0.3f), kFO);
+
+    // Torch on the camera pointing at the origin
+    if (uniforms.torch) {
+      glm::vec3 L = glm::normalize(camera_pos - frag_pos);
+      float inner = cosf(glm::radians(6.5f));
+      float outer = cosf(glm::radians(8.5f));
+      float theta = glm::dot(L, glm::normalize(camera_pos));
+      float cutoff = std::clamp((theta - inner) / (inner - outer), 0.0f, 1.0f);
+      result += shade(L, glm::vec3(0.3f, 0.3f, 1.0f), cutoff);
+    }
+
+    colors[0] = glm::vec4(result, 1.0f);
+  };
+  return result;
+}
+
+soft_program_t soft_program_gbuffer(const soft_gbuffer_uniforms_t &uniforms) {
+  // TBN, frag_pos, uv, clip and prev_clip
+  soft_program_t result = {.varyings = 22};
+  result.vertex = [&uniforms](const float *vertex, float *varyings) {
+    glm::vec4 position(vertex[0], vertex[1], vertex[2], 1.0f);
+    glm::mat3 TBN = soft_tbn(uniforms.model, vertex);
+    glm::vec3 frag_pos = glm::vec3(uniforms.model * position);
+    glm::vec4 clip =
+        uniforms.proj * uniforms.view * uniforms.model * position;
+    glm::vec4 prev_clip =
+        uniforms.prev_view_proj * uniforms.prev_model * position;
+
+    for (int i = 0; i < 9; ++i)
+      varyings[i] = TBN[i / 3][i % 3];
+    for (int c = 0; c < 3; ++c)
+      varyings[9 + c] = frag_pos[c];
+    varyings[12] = vertex[9];
+    varyings[13] = vertex[10];
+    for (int c = 0; c < 4; ++c) {
+      varyings[14 + c] = clip[c];
+      varyings[18 + c] = prev_clip[c];
+    }
+    return clip;
+  };
+
+  result.fragment = [&uniforms](const float *varyings, glm::vec4 *colors) {
+    glm::mat3 TBN;
+    for (int i = 0; i < 9; ++i)
+      TBN[i / 3][i % 3] = varyings[i];
+    glm::vec3 frag_pos(varyings[9], varyings[10], varyings[11]);
+    glm::vec2 uv(varyings[12], varyings[13]);
+    glm::vec4 clip(varyings[14], varyings[15], varyings[16], varyings[17]);
+    glm::vec4 prev_clip(varyings[18], varyings[19], varyings[20],
+                        varyings[21]);
+
+    glm::vec3 N = glm::normalize(soft_rgb(*uniforms.normal, uv) * 2.0f - 1.0f);
+    N = TBN * N;
+
+    glm::vec2 motion = (glm::vec2(clip) / clip.w -
+                        glm::vec2(prev_clip) / prev_clip.w) *
+                       0.5f;
+    colors[0] = glm::vec4(frag_pos, 1.0f);
+    colors[1] = glm::vec4(N, 1.0f);
+    colors[2] = glm::vec4(soft_rgb(*uniforms.diffuse, uv),
+                          soft_texture_sample(*uniforms.specular, uv).r);
+    colors[3] = glm::vec4(motion, prev_clip.w, clip.w);
+  };
+  return result;
+}
+
+#undef SOFT_SHININESS
+
+#endif
+
+} // namespace glib
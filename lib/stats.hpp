@@ -0,0 +1,165 @@
+#ifndef GLIB_STATS_HPP
+#define GLIB_STATS_HPP
+
+#include <GLFW/glfw3.h>
+
+#include <cstddef>
+#include <cstring>
+
+namespace glib {
+
+// GL work issued through glib during a frame, and heap allocations of the
+// render thread when built with GLIB_TRACK_ALLOCATIONS
+struct frame_stats_t {
+  unsigned long calls; // every counted GL call, including the ones below
+  unsigned long draws;
+  unsigned long triangles;
+  unsigned long program_binds;
+  unsigned long vao_binds;
+  unsigned long texture_binds;
+  unsigned long uniform_uploads;
+  unsigned long buffer_uploads;
+  unsigned long buffer_bytes;
+  unsigned long fbo_binds;
+  unsigned long allocations;
+  unsigned long allocated_bytes;
+};
+
+// Counters of the frame in progress and of the last completed one
+extern frame_stats_t frame_stats;
+extern frame_stats_t frame_stats_last;
+
+// Close the frame in progress, called by window_present
+const frame_stats_t &frame_stats_end();
+
+// Named access to the counters, for reports and budgets
+struct frame_stats_field_t {
+  const char *name;
+  size_t offset;
+};
+
+#define GLIB_STATS_FIELD(field) {#field, offsetof(frame_stats_t, field)}
+const frame_stats_field_t frame_stats_fields[] = {
+    GLIB_STATS_FIELD(calls),           GLIB_STATS_FIELD(draws),
+    GLIB_STATS_FIELD(triangles),       GLIB_STATS_FIELD(program_binds),
+    GLIB_STATS_FIELD(vao_binds),       GLIB_STATS_FIELD(texture_binds),
+    GLIB_STATS_FIELD(uniform_uploads), GLIB_STATS_FIELD(buffer_uploads),
+    GLIB_STATS_FIELD(buffer_bytes),    GLIB_STATS_FIELD(fbo_binds),
+    GLIB_STATS_FIELD(allocations),     GLIB_STATS_FIELD(allocated_bytes)};
+#undef GLIB_STATS_FIELD
+
+inline unsigned long &frame_stats_get(frame_stats_t &stats,
+                                      const frame_stats_field_t &field) {
+  return *(unsigned long *)((char *)&stats + field.offset);
+}
+
+// Field by name, NULL if unknown
+inline const frame_stats_field_t *frame_stats_find(const char *name) {
+  for (const frame_stats_field_t &field : frame_stats_fields)
+    if (strcmp(field.name, name) == 0)
+      return &field;
+  return NULL;
+}
+
+// Count any other GL call, for example in layouts: GLIB_GL(glEnable(...))
+#define GLIB_GL(call) (glib::frame_stats.calls += 1, call)
+
+// Counting wrappers of the calls tracked by category
+
+inline unsigned long primitive_triangles(unsigned int mode, int count) {
+  switch (mode) {
+  case GL_TRIANGLES:
+    return count / 3;
+  case GL_TRIANGLE_STRIP:
+  case GL_TRIANGLE_FAN:
+    return count > 2 ? count - 2 : 0;
+  default:
+    return 0;
+  }
+}
+
+inline void gl_draw_arrays(unsigned int mode, int first, int count) {
+  frame_stats.calls += 1;
+  frame_stats.draws += 1;
+  frame_stats.triangles += primitive_triangles(mode, count);
+  glDrawArrays(mode, first, count);
+}
+
+inline void gl_draw_elements(unsigned int mode, int count, unsigned int type,
+                             const void *indices) {
+  frame_stats.calls += 1;
+  frame_stats.draws += 1;
+  frame_stats.triangles += primitive_triangles(mode, count);
+  glDrawElements(mode, count, type, indices);
+}
+
+inline void gl_use_program(unsigned int id) {
+  frame_stats.calls += 1;
+  frame_stats.program_binds += 1;
+  glUseProgram(id);
+}
+
+inline void gl_bind_vertex_array(unsigned int vao) {
+  frame_stats.calls += 1;
+  frame_stats.vao_binds += 1;
+  glBindVertexArray(vao);
+}
+
+inline void gl_bind_texture(unsigned int target, unsigned int id) {
+  frame_stats.calls += 1;
+  frame_stats.texture_binds += 1;
+  glBindTexture(target, id);
+}
+
+// Orphaning with NULL data allocates without uploading
+inline void gl_buffer_data(unsigned int target, size_t size, const void *data,
+                           unsigned int usage) {
+  frame_stats.calls += 1;
+  if (data != NULL) {
+    frame_stats.buffer_uploads += 1;
+    frame_stats.buffer_bytes += size;
+  }
+  glBufferData(target, size, data, usage);
+}
+
+inline void gl_buffer_sub_data(unsigned int target, size_t offset, size_t size,
+                               const void *data) {
+  frame_stats.calls += 1;
+  frame_stats.buffer_uploads += 1;
+  frame_stats.buffer_bytes += size;
+  glBufferSubData(target, offset, size, data);
+}
+
+inline void gl_bind_framebuffer(unsigned int target, unsigned int fbo) {
+  frame_stats.calls += 1;
+  frame_stats.fbo_binds += 1;
+  glBindFramebuffer(target, fbo);
+}
+
+// Wraps a glUniform* call: GLIB_GL_UNIFORM(glUniform1i(location, 0))
+#define GLIB_GL_UNIFORM(call)                                                  \
+  (glib::frame_stats.calls += 1, glib::frame_stats.uniform_uploads += 1, call)
+
+} // namespace glib
+
+#endif
+
+// Counters are defined by graphics.hpp, which includes this again after
+// initialization.hpp did
+#ifdef GLIB_STATS_IMPL
+#undef GLIB_STATS_IMPL
+
+namespace glib {
+
+frame_stats_t frame_stats = {};
+frame_stats_t frame_stats_last = {};
+
+const frame_stats_t &frame_stats_end() {
+  frame_stats_last = frame_stats;
+  frame_stats = {};
+  return frame_stats_last;
+}
+
+} // namespace glib
+
+#endif
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "graphics.hpp"
+
+namespace glib {
+
+// Bytes of the levels resident in all the streamed textures by default
+#define STREAM_BUDGET (256 << 20)
+// Bytes of levels specified per stream_update by default
+#define STREAM_UPLOAD_BUDGET (4 << 20)
+// Largest side of the finest level a texture starts with
+#define STREAM_FIRST_SIZE 64
+
+struct stream_texture_t;
+
+// Textures whose finer levels are resident only while something on screen
+// needs them. The image with its whole mip chain is decoded or mapped by the
+// shared jobs (see jobs.hpp) and kept on the CPU, then each texture starts
+// from its levels no larger than STREAM_FIRST_SIZE. Every frame the level
+// asked by stream_request is streamed in one level at a time, finest first
+// clamped by GL_TEXTURE_BASE_LEVEL. When the budget is full the levels finer
+// than needed of the least recently requested textures are freed. Textures
+// are shared through the texture manager, the streamer holds a reference to
+// each of its own until destroyed.
+struct stream_t {
+  size_t budget;        // bytes of the resident levels
+  size_t upload_budget; // bytes specified per update
+  std::vector<stream_texture_t *> textures; // in request order
+  std::unordered_map<unsigned int, stream_texture_t *> lookup; // by id
+  texture_decoder_t *decoder; // of the images
+  unsigned long frame;
+
+  size_t resident;                 // bytes
+  unsigned long streamed, evicted; // levels
+};
+
+stream_t stream_create(size_t budget = STREAM_BUDGET,
+                       size_t upload_budget = STREAM_UPLOAD_BUDGET);
+// Waits for the decoding jobs, textures keep the levels resident
+void stream_destroy(stream_t &streamer);
+
+// Until decoded the texture holds a 1x1 RGBA8 placeholder, mid grey if NULL
+texture_t texture_load_streamed(stream_t &streamer, const char *path,
+                                unsigned int wrapping,
+                                const unsigned char *placeholder = NULL,
+                                texture_role_e role = TEXTURE_ALBEDO);
+
+// A texture is drawn where a pixel covers uv_per_pixel of its coordinates,
+// the smallest one asked since the last update wins. Textures not streamed
+// are ignored.
+void stream_request(stream_t &streamer, const texture_t &texture,
+                    float uv_per_pixel);
+
+// Start the decoded textures, stream in and evict levels for the requests
+// since the last update, on the GL thread once a frame
+void stream_update(stream_t &streamer);
+
+// Finest level resident in a texture, -1 if it is not streamed or not
+// decoded yet
+int stream_level(const stream_t &streamer, const texture_t &texture);
+
+#ifdef GLIB_STREAM_IMPL
+#undef GLIB_STREAM_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+
+namespace glib {
+
+struct stream_texture_t {
+  texture_pending_t image;
+
+  bool ready;         // the first levels are specified
+  int first;          // coarsest level streamed, never evicted below
+  int resident;       // finest level specified
+  int wanted;         // finest level requested since the last update
+  unsigned long used; // frame of the last request
+  size_t bytes;       // of the resident levels
+};
+
+stream_t stream_create(size_t budget, size_t upload_budget) {
+  stream_t result = {};
+  result.budget = budget;
+  result.upload_budget = std::max<size_t>(upload_budget, 1);
+  result.decoder = new texture_decoder_t();
+  printf("created streamer(budget: %zu KiB)\n", budget / 1024);
+  return result;
+}
+
+void stream_destroy(stream_t &streamer) {
+  if (streamer.decoder == NULL)
+    return;
+  texture_decoder_wait(*streamer.decoder);
+  for (stream_texture_t *texture : streamer.textures) {
+    texture_pixels_free(texture->image.pixels);
+    texture_destroy(texture->image.texture);
+    delete texture;
+  }
+  delete streamer.decoder;
+  streamer = {};
+}
+
+texture_t texture_load_streamed(stream_t &streamer, const char *path,
+                                unsigned int wrapping,
+                                const unsigned char *placeholder,
+                                texture_role_e role) {
+  GLIB_ZONE("texture_load_streamed");
+  return texture_acquire_pending(
+      *streamer.decoder, path, wrapping, placeholder, role,
+      [&](const texture_t &texture) -> texture_pending_t & {
+        stream_texture_t *target = new stream_texture_t();
+        target->wanted = INT_MAX;
+        streamer.textures.push_back(target);
+        streamer.lookup[texture.id] = target;
+        return target->image;
+      });
+}
+
+void stream_request(stream_t &streamer, const texture_t &texture,
+                    float uv_per_pixel) {
+  auto found = streamer.lookup.find(texture.id);
+  if (found == streamer.lookup.end())
+    return;
+  stream_texture_t &target = *found->second;
+  target.used = streamer.frame;
+  if (!target.ready)
+    return;
+
+  // One texel per pixel, rounded to the finer level
+  const dds_level_t &top = target.image.pixels.levels[0];
+  float texels = uv_per_pixel * std::max(top.width, top.height);
+  int level = texels > 1.0f ? (int)floorf(log2f(texels)) : 0;
+  target.wanted = std::min(target.wanted, level);
+}
+
+int stream_level(const stream_t &streamer, const texture_t &texture) {
+  auto found = streamer.lookup.find(texture.id);
+  if (found == streamer.lookup.end() || !found->second->ready)
+    return -1;
+  return found->second->resident;
+}
+
+// Bytes of a level once specified
+static size_t stream_level_bytes(const stream_texture_t &texture, int level) {
+  const texture_pixels_t &pixels = texture.image.pixels;
+  if (dds_block_size(pixels.format) != 0)
+    return pixels.levels[level].size;
+  return texture_bytes(texture_internal_format(pixels.format, pixels.opaque),
+                       pixels.levels[level].width, pixels.levels[level].height,
+                       false);
+}
+
+// The coarse levels, all of them for an image without a mip chain
+static void stream_start(stream_t &streamer, stream_texture_t &texture) {
+  const texture_pixels_t &pixels = texture.image.pixels;
+  glBindTexture(GL_TEXTURE_2D, texture.image.texture.id);
+  if (pixels.level_count == 1) {
+    texture.first = 0;
+    texture.bytes = texture_pixels_specify(pixels);
+  } else {
+    texture.first = pixels.level_count - 1;
+    while (texture.first > 0 &&
+           std::max(pixels.levels[texture.first - 1].width,
+                    pixels.levels[texture.first - 1].height) <=
+               STREAM_FIRST_SIZE)
+      texture.first -= 1;
+
+    // Base first, the levels out of range do not make it incomplete
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.first);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    pixels.level_count - 1);
+    for (int i = texture.first; i < pixels.level_count; ++i)
+      texture.bytes += texture_pixels_specify_level(pixels, i);
+    if (texture.first > 0)
+      texture_pixels_specify_level(pixels, 0, true); // the placeholder
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  gpu_memory_track(GPU_TEXTURE, texture.image.texture.id, texture.bytes, NULL,
+                   texture.image.path.c_str());
+
+  texture.resident = texture.first;
+  texture.ready = true;
+  streamer.resident += texture.bytes;
+  printf("loaded texture(id: %d, level: %d)\n", texture.image.texture.id,
+         texture.first);
+}
+
+// Finest level a texture needs for the requests since the last update, the
+// ones not requested fall back to their first level
+static int stream_target(const stream_texture_t &texture) {
+  return std::clamp(texture.wanted, 0, texture.first);
+}
+
+// Move the finest resident level by one, finer when streaming in
+static void stream_step(stream_t &streamer, stream_texture_t &texture,
+                        bool finer) {
+  int level = finer ? texture.resident - 1 : texture.resident;
+  glBindTexture(GL_TEXTURE_2D, texture.image.texture.id);
+  if (finer) {
+    size_t bytes = texture_pixels_specify_level(texture.image.pixels, level);
+    texture.bytes += bytes;
+    streamer.resident += bytes;
+    texture.resident = level;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    streamer.streamed += 1;
+  } else {
+    size_t bytes = stream_level_bytes(texture, level);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+    texture_pixels_specify_level(texture.image.pixels, level, true);
+    texture.bytes -= bytes;
+    streamer.resident -= bytes;
+    texture.resident = level + 1;
+    streamer.evicted += 1;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  gpu_memory_track(GPU_TEXTURE, texture.image.texture.id, texture.bytes, NULL,
+                   texture.image.path.c_str());
+}
+
+// Bytes of the levels finer than needed, what evictions can free
+static size_t stream_excess(const stream_t &streamer,
+                            const stream_texture_t *keep) {
+  size_t result = 0;
+  for (const stream_texture_t *texture : streamer.textures)
+    if (texture != keep && texture->ready)
+      for (int i = texture->resident; i < stream_target(*texture); ++i)
+        result += stream_level_bytes(*texture, i);
+  return result;
+}
+
+// Free the finest level of the least recently requested texture holding more
+// than it needs, false if none does
+static bool stream_evict(stream_t &streamer, const stream_texture_t *keep) {
+  stream_texture_t *victim = NULL;
+  for (stream_texture_t *texture : streamer.textures)
+    if (texture != keep && texture->ready &&
+        texture->resident < stream_target(*texture) &&
+        (victim == NULL || texture->used < victim->used))
+      victim = texture;
+  if (victim == NULL)
+    return false;
+  stream_step(streamer, *victim, false);
+  return true;
+}
+
+void stream_update(stream_t &streamer) {
+  GLIB_ZONE("stream_update");
+  size_t kept = 0;
+  for (size_t i = 0; i < streamer.textures.size(); ++i) {
+    stream_texture_t *texture = streamer.textures[i];
+    if (!texture->ready) {
+      bool failed;
+      bool decoded =
+          texture_pending_decoded(*streamer.decoder, texture->image, failed);
+      if (decoded && failed) {
+        std::cout << "ERROR::TEXTURE: Unable to load " << texture->image.path
+                  << "\n";
+        streamer.lookup.erase(texture->image.texture.id);
+        texture_destroy(texture->image.texture);
+        delete texture;
+        continue;
+      }
+      if (decoded)
+        stream_start(streamer, *texture);
+    }
+    streamer.textures[kept++] = texture;
+  }
+  streamer.textures.resize(kept);
+
+  // Furthest from what they need first
+  std::vector<stream_texture_t *> missing;
+  for (stream_texture_t *texture : streamer.textures)
+    if (texture->ready && stream_target(*texture) < texture->resident)
+      missing.push_back(texture);
+  std::stable_sort(missing.begin(), missing.end(),
+                   [](const stream_texture_t *a, const stream_texture_t *b) {
+                     return a->resident - stream_target(*a) >
+                            b->resident - stream_target(*b);
+                   });
+
+  // At least one level per update, a level larger than the budget too
+  size_t budget = streamer.upload_budget;
+  for (stream_texture_t *texture : missing) {
+    size_t bytes = stream_level_bytes(*texture, texture->resident - 1);
+    if (budget == 0 || (bytes > budget && budget < streamer.upload_budget))
+      break;
+    // Nothing is evicted for a level that would not fit anyway
+    if (streamer.resident + bytes > streamer.budget &&
+        streamer.resident + bytes - stream_excess(streamer, texture) >
+            streamer.budget)
+      continue;
+    while (streamer.resident + bytes > streamer.budget)
+      stream_evict(streamer, texture);
+    stream_step(streamer, *texture, true);
+    budget -= std::min(bytes, budget);
+  }
+
+  // A budget lowered meanwhile
+  while (streamer.resident > streamer.budget && stream_evict(streamer, NULL))
+    ;
+
+  for (stream_texture_t *texture : streamer.textures)
+    texture->wanted = INT_MAX;
+  streamer.frame += 1;
+}
+
+#endif
+
+} // namespace glib
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "graphics.hpp"
+
+namespace glib {
+
+// Ping-pong history of an effect accumulated over time. The alpha channel of
+// the history stores the view depth of the pixel, zero means no history.
+struct temporal_t {
+  unsigned int fbo[2];
+  texture_t history[2];
+  int width, height;
+  int current;
+
+  // Fraction of pixels recomputed each frame is 1 / rate
+  int rate;
+  unsigned int frame;
+
+  glm::mat4 view_proj;
+  glm::mat4 prev_view_proj;
+};
+
+// GLSL helpers for reprojection, insert them with shader_insert
+const char *shader_temporal = R"(
+uniform struct {
+  sampler2D history;
+  sampler2D velocity;
+  int frame;
+  int rate;
+  float alpha;
+} temporal;
+
+// Relative view depth difference that counts as a disocclusion
+#define TEMPORAL_DEPTH_TOLERANCE 0.05
+
+// True when the pixel belongs to the subset recomputed this frame
+bool temporal_refresh(ivec2 pixel) {
+  return (pixel.x + pixel.y * 3) % temporal.rate == temporal.frame % temporal.rate;
+}
+
+// Fetch the history of the surface at uv, false if it was not visible
+bool temporal_reproject(vec2 uv, out vec4 result) {
+  vec4 motion = texture(temporal.velocity, uv);
+  vec2 prev_uv = uv - motion.xy;
+
+  result = vec4(0.0);
+  if (motion.w <= 0.0 || any(lessThan(prev_uv, vec2(0.0)))
+      || any(greaterThan(prev_uv, vec2(1.0))))
+    return false;
+
+  result = texture(temporal.history, prev_uv);
+  return result.a > 0.0
+    && abs(result.a - motion.z) <= TEMPORAL_DEPTH_TOLERANCE * motion.z;
+}
+
+// Blend a freshly computed value with the history and tag it with depth
+vec4 temporal_resolve(vec2 uv, vec3 color, bool valid, vec4 history) {
+  float depth = texture(temporal.velocity, uv).w;
+  if (valid)
+    color = mix(history.rgb, color, temporal.alpha);
+  return vec4(color, depth);
+}
+)";
+
+temporal_t temporal_create(int width, int height, int rate = 4);
+void temporal_destroy(temporal_t &temporal);
+
+// Advance the frame and remember the camera of the previous one
+void temporal_begin(temporal_t &temporal, const glm::mat4 &view_proj);
+// Current history becomes the previous one
+void temporal_end(temporal_t &temporal);
+// Forget all history, for example after a camera cut
+void temporal_reset(temporal_t &temporal);
+
+// Bind previous history and velocity to the slots and set the uniforms
+void temporal_uniforms(const temporal_t &temporal, const program_t &program,
+                       const texture_t &velocity, int slot, float alpha = 1.0f);
+
+#define temporal_bind(temporal)                                                \
+  glib::gl_bind_framebuffer(GL_FRAMEBUFFER, temporal.fbo[temporal.current])
+#define temporal_output(temporal) (temporal.history[temporal.current])
+
+#ifdef GLIB_TEMPORAL_IMPL
+#undef GLIB_TEMPORAL_IMPL
+
+temporal_t temporal_create(int width, int height, int rate) {
+  temporal_t result = {};
+  result.width = width;
+  result.height = height;
+  result.rate = rate;
+  result.view_proj = glm::mat4(1.0f);
+  result.prev_view_proj = glm::mat4(1.0f);
+
+  glGenFramebuffers(2, result.fbo);
+  for (int i = 0; i < 2; ++i) {
+    glBindFramebuffer(GL_FRAMEBUFFER, result.fbo[i]);
+    {
+      glGenTextures(1, &result.history[i].id);
+      glBindTexture(GL_TEXTURE_2D, result.history[i].id);
+      {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA,
+                     GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      }
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             GL_TEXTURE_2D, result.history[i].id, 0);
+      gpu_memory_track(GPU_TEXTURE, result.history[i].id,
+                       texture_bytes(GL_RGBA16F, width, height, false),
+                       "temporal");
+
+      if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Temporal framebuffer is not complete!\n";
+        exit(1);
+      }
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  framebuffer_default_bind();
+
+  temporal_reset(result);
+  printf("created temporal history(fbo: %d, %d)\n", result.fbo[0],
+         result.fbo[1]);
+  return result;
+}
+
+void temporal_destroy(temporal_t &temporal) {
+  texture_destroy(temporal.history[0]);
+  texture_destroy(temporal.history[1]);
+  glDeleteFramebuffers(2, temporal.fbo);
+  temporal = {};
+}
+
+void temporal_begin(temporal_t &temporal, const glm::mat4 &view_proj) {
+  temporal.prev_view_proj =
+      (temporal.frame == 0) ? view_proj : temporal.view_proj;
+  temporal.view_proj = view_proj;
+  temporal.frame += 1;
+}
+
+void temporal_end(temporal_t &temporal) { temporal.current ^= 1; }
+
+void temporal_reset(temporal_t &temporal) {
+  float clear[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 2; ++i) {
+    glBindFramebuffer(GL_FRAMEBUFFER, temporal.fbo[i]);
+    glClearBufferfv(GL_COLOR, 0, clear);
+  }
+  framebuffer_default_bind();
+  temporal.frame = 0;
+}
+
+void temporal_uniforms(const temporal_t &temporal, const program_t &program,
+                       const texture_t &velocity, int slot, float alpha) {
+  texture_bind(temporal.history[temporal.current ^ 1], slot);
+  texture_bind(velocity, slot + 1);
+
+  program_uniform_1i(program, "temporal.history", slot);
+  program_uniform_1i(program, "temporal.velocity", slot + 1);
+  program_uniform_1i(program, "temporal.frame", temporal.frame);
+  program_uniform_1i(program, "temporal.rate", temporal.rate);
+  program_uniform_1f(program, "temporal.alpha", alpha);
+}
+
+#endif
+
+} // namespace glib
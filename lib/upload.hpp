@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "graphics.hpp"
+
+namespace glib {
+
+// Bytes copied to pixel buffers per upload_update by default
+#define UPLOAD_BUDGET (8 << 20)
+
+struct upload_request_t;
+
+// Loads textures without blocking the render thread. A texture is returned
+// at once holding a 1x1 placeholder, its image is decoded by the shared jobs
+// (see jobs.hpp) and staged in a pixel buffer object a budget of bytes per
+// frame. When the whole image is staged it is specified from the buffer in
+// the same texture object, so handles taken meanwhile stay valid. Textures
+// are shared through the texture manager, the queue holds a reference to
+// those it has yet to upload.
+struct upload_queue_t {
+  size_t budget;
+  std::vector<upload_request_t *> requests; // in request order
+  texture_decoder_t *decoder; // of the images
+
+  unsigned long uploaded; // textures
+  size_t bytes;           // staged so far
+};
+
+upload_queue_t upload_create(size_t budget = UPLOAD_BUDGET);
+// Waits for the decoding jobs, textures not uploaded yet keep the placeholder
+void upload_destroy(upload_queue_t &queue);
+
+// The placeholder is an RGBA8 color, mid grey if NULL
+texture_t texture_load_async(upload_queue_t &queue, const char *path,
+                             unsigned int wrapping,
+                             const unsigned char *placeholder = NULL,
+                             texture_role_e role = TEXTURE_ALBEDO);
+
+// Stage decoded images and specify the textures staged whole, on the GL
+// thread once a frame
+void upload_update(upload_queue_t &queue);
+// Upload everything requested, blocking on the decoding
+void upload_finish(upload_queue_t &queue);
+
+// Textures still waiting for their image
+size_t upload_pending(const upload_queue_t &queue);
+
+#ifdef GLIB_UPLOAD_IMPL
+#undef GLIB_UPLOAD_IMPL
+} // namespace glib
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace glib {
+
+struct upload_request_t {
+  texture_pending_t image;
+
+  unsigned int pbo;
+  size_t size, staged; // bytes of all the levels
+};
+
+upload_queue_t upload_create(size_t budget) {
+  upload_queue_t result = {};
+  result.budget = std::max<size_t>(budget, 1);
+  result.decoder = new texture_decoder_t();
+  printf("created upload queue(budget: %zu KiB)\n", budget / 1024);
+  return result;
+}
+
+void upload_destroy(upload_queue_t &queue) {
+  if (queue.decoder == NULL)
+    return;
+  texture_decoder_wait(*queue.decoder);
+  for (upload_request_t *request : queue.requests) {
+    if (request->pbo != 0)
+      glDeleteBuffers(1, &request->pbo);
+    texture_pixels_free(request->image.pixels);
+    texture_destroy(request->image.texture);
+    delete request;
+  }
+  delete queue.decoder;
+  queue = {};
+}
+
+texture_t texture_load_async(upload_queue_t &queue, const char *path,
+                             unsigned int wrapping,
+                             const unsigned char *placeholder,
+                             texture_role_e role) {
+  GLIB_ZONE("texture_load_async");
+  return texture_acquire_pending(
+      *queue.decoder, path, wrapping, placeholder, role,
+      [&](const texture_t &) -> texture_pending_t & {
+        upload_request_t *request = new upload_request_t();
+        queue.requests.push_back(request);
+        return request->image;
+      });
+}
+
+// Every level from the staged buffer, generated if there is only one
+static void upload_specify(upload_request_t &request) {
+  const texture_pending_t &image = request.image;
+  glBindTexture(GL_TEXTURE_2D, image.texture.id);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request.pbo);
+  size_t bytes = texture_pixels_specify(image.pixels, true);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  gpu_memory_track(GPU_TEXTURE, image.texture.id, bytes, NULL,
+                   image.path.c_str());
+
+  // The copy is queued, the driver keeps the buffer alive until it is done
+  glDeleteBuffers(1, &request.pbo);
+  request.pbo = 0;
+}
+
+// Copy up to budget bytes of the image in its pixel buffer, true once all of
+// it is staged
+static bool upload_stage(upload_request_t &request, size_t &budget) {
+  const texture_pixels_t &pixels = request.image.pixels;
+  if (request.pbo == 0) {
+    for (int i = 0; i < pixels.level_count; ++i)
+      request.size += pixels.levels[i].size;
+    glGenBuffers(1, &request.pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request.pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, request.size, NULL, GL_STREAM_DRAW);
+  } else {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request.pbo);
+  }
+
+  size_t bytes = std::min(budget, request.size - request.staged);
+  if (bytes > 0) {
+    unsigned char *mapped = (unsigned char *)glMapBufferRange(
+        GL_PIXEL_UNPACK_BUFFER, request.staged, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT);
+    if (mapped == NULL) {
+      // Nothing staged, the request tries again next update
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      return false;
+    }
+
+    // The levels follow each other in the buffer
+    size_t offset = 0, copied = 0;
+    for (int i = 0; i < pixels.level_count && copied < bytes; ++i) {
+      const dds_level_t &level = pixels.levels[i];
+      size_t end = offset + level.size;
+      if (request.staged + copied < end) {
+        size_t from = request.staged + copied - offset;
+        size_t count = std::min(level.size - from, bytes - copied);
+        memcpy(mapped + copied, level.data + from, count);
+        copied += count;
+      }
+      offset = end;
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    request.staged += bytes;
+    budget -= bytes;
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return request.staged == request.size;
+}
+
+void upload_update(upload_queue_t &queue) {
+  GLIB_ZONE("upload_update");
+  size_t budget = queue.budget;
+  size_t kept = 0;
+  for (size_t i = 0; i < queue.requests.size(); ++i) {
+    upload_request_t *request = queue.requests[i];
+    texture_pending_t &image = request->image;
+    bool failed;
+    bool decoded = texture_pending_decoded(*queue.decoder, image, failed);
+
+    // In request order among the decoded ones
+    bool done = false;
+    if (decoded && failed) {
+      std::cout << "ERROR::TEXTURE: Unable to load " << image.path << "\n";
+      done = true;
+    } else if (decoded && budget > 0) {
+      size_t before = budget;
+      done = upload_stage(*request, budget);
+      queue.bytes += before - budget;
+      if (done) {
+        upload_specify(*request);
+        queue.uploaded += 1;
+        printf("loaded texture(id: %d)\n", image.texture.id);
+      }
+    }
+
+    if (done) {
+      texture_pixels_free(image.pixels);
+      texture_destroy(image.texture); // the reference of the queue
+      delete request;
+    } else {
+      queue.requests[kept++] = request;
+    }
+  }
+  queue.requests.resize(kept);
+}
+
+void upload_finish(upload_queue_t &queue) {
+  GLIB_ZONE("upload_finish");
+  texture_decoder_wait(*queue.decoder);
+  size_t budget = queue.budget;
+  queue.budget = SIZE_MAX;
+  upload_update(queue);
+  queue.budget = budget;
+}
+
+size_t upload_pending(const upload_queue_t &queue) {
+  return queue.requests.size();
+}
+
+#endif
+
+} // namespace glib